@@ -44,6 +44,18 @@ aeEventLoop *aeCreateEventLoop(int setsize) {
     eventLoop->stop = 0;
     eventLoop->maxfd = -1;
     eventLoop->beforesleep = NULL;
+    eventLoop->aftersleep = NULL;
+    eventLoop->flags = 0;
+    eventLoop->busypoll_usec = 0;
+    eventLoop->busypoll_hits = 0;
+    eventLoop->busypoll_sleeps = 0;
+    eventLoop->busypoll_spin_usec = 0;
+    eventLoop->poll_usec = 0;
+    eventLoop->file_usec = 0;
+    eventLoop->time_usec = 0;
+    eventLoop->fired_count = 0;
+    memset(eventLoop->wakeup_hist,0,sizeof(eventLoop->wakeup_hist));
+    memset(eventLoop->timer_hist,0,sizeof(eventLoop->timer_hist));
     if (aeApiCreate(eventLoop) == -1) goto err;
     /* Events with mask == AE_NONE are not set. So let's initialize the
      * vector with it. */
@@ -155,6 +167,61 @@ static void aeGetTime(long *seconds, long *milliseconds)
     *milliseconds = tv.tv_usec/1000;
 }
 
+static long long aeUstime(void) {
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+    return ((long long)tv.tv_sec)*1000000+tv.tv_usec;
+}
+
+/* Account a latency sample in the power of two histogram 'hist'. */
+static void aeLatencyAdd(long long *hist, long long usec) {
+    int bucket = 0;
+
+    while (usec > 1 && bucket < AE_LATENCY_BUCKETS-1) {
+        usec >>= 1;
+        bucket++;
+    }
+    hist[bucket]++;
+}
+
+/* Busy poll: instead of going to sleep in the multiplexing API right away,
+ * poll it without timeout for up to eventLoop->busypoll_usec microseconds,
+ * so that events arriving in the meantime are served without paying the
+ * wake up latency of the kernel scheduler. If nothing arrives we block for
+ * what is left of the timeout 'tvp' as usual (NULL means wait forever). */
+static int aeBusyPoll(aeEventLoop *eventLoop, struct timeval *tvp) {
+    long long start = aeUstime(), elapsed, limit = eventLoop->busypoll_usec;
+    int numevents;
+
+    if (tvp) {
+        long long timeout = (long long)tvp->tv_sec*1000000+tvp->tv_usec;
+        if (timeout < limit) limit = timeout;
+    }
+
+    do {
+        struct timeval tv = {0, 0};
+
+        numevents = aeApiPoll(eventLoop, &tv);
+        elapsed = aeUstime()-start;
+    } while (numevents == 0 && elapsed < limit);
+    eventLoop->busypoll_spin_usec += elapsed;
+
+    if (numevents) {
+        eventLoop->busypoll_hits++;
+        return numevents;
+    }
+    eventLoop->busypoll_sleeps++;
+    if (tvp) {
+        long long left = (long long)tvp->tv_sec*1000000+tvp->tv_usec-elapsed;
+
+        if (left < 0) left = 0;
+        tvp->tv_sec = left/1000000;
+        tvp->tv_usec = left%1000000;
+    }
+    return aeApiPoll(eventLoop, tvp);
+}
+
 static void aeAddMillisecondsToNow(long long milliseconds, long *sec, long *ms) {
     long cur_sec, cur_ms, when_sec, when_ms;
 
@@ -256,7 +323,7 @@ static int processTimeEvents(aeEventLoop *eventLoop) {
     maxId = eventLoop->timeEventNextId-1;
     while(te) {
         long now_sec, now_ms;
-        long long id;
+        long long id, now_us;
 
         /* Remove events scheduled for deletion. */
         if (te->id == AE_DELETED_EVENT_ID) {
@@ -281,12 +348,18 @@ static int processTimeEvents(aeEventLoop *eventLoop) {
             te = te->next;
             continue;
         }
-        aeGetTime(&now_sec, &now_ms);
+        now_us = aeUstime();
+        now_sec = now_us/1000000;
+        now_ms = (now_us/1000)%1000;
         if (now_sec > te->when_sec ||
             (now_sec == te->when_sec && now_ms >= te->when_ms))
         {
             int retval;
 
+            /* Timers forced to fire by a clock skew are not late. */
+            if (te->when_sec)
+                aeLatencyAdd(eventLoop->timer_hist,
+                    now_us-((long long)te->when_sec*1000000+te->when_ms*1000));
             id = te->id;
             retval = te->timeProc(eventLoop, id, te->clientData);
             processed++;
@@ -313,6 +386,7 @@ static int processTimeEvents(aeEventLoop *eventLoop) {
  * if flags has AE_TIME_EVENTS set, time events are processed.
  * if flags has AE_DONT_WAIT set the function returns ASAP until all
  * the events that's possible to process without to wait are processed.
+ * if flags has AE_CALL_AFTER_SLEEP set, the aftersleep callback is called.
  *
  * The function returns the number of events processed. */
 int aeProcessEvents(aeEventLoop *eventLoop, int flags)
@@ -331,6 +405,7 @@ int aeProcessEvents(aeEventLoop *eventLoop, int flags)
         int j;
         aeTimeEvent *shortest = NULL;
         struct timeval tv, *tvp;
+        long long start = aeUstime(), now, deadline;
 
         if (flags & AE_TIME_EVENTS && !(flags & AE_DONT_WAIT))
             shortest = aeSearchNearestTimer(eventLoop);
@@ -366,7 +441,37 @@ int aeProcessEvents(aeEventLoop *eventLoop, int flags)
             }
         }
 
-        numevents = aeApiPoll(eventLoop, tvp);
+        /* The user asked to not block, since there is already work that
+         * the next iteration must perform. */
+        if (eventLoop->flags & AE_DONT_WAIT) {
+            tv.tv_sec = tv.tv_usec = 0;
+            tvp = &tv;
+        }
+
+        /* When the poll is going to block until a timeout, the time we wake
+         * up past it is the wake up latency of the loop. The multiplexing
+         * API rounds the timeout down to milliseconds: polls returning
+         * before it expired are not sampled. */
+        deadline = 0;
+        if (tvp && (tvp->tv_sec || tvp->tv_usec))
+            deadline = start+(long long)tvp->tv_sec*1000000+tvp->tv_usec;
+
+        /* Spin only when we would otherwise block. */
+        if (eventLoop->busypoll_usec &&
+            (tvp == NULL || tvp->tv_sec || tvp->tv_usec))
+            numevents = aeBusyPoll(eventLoop, tvp);
+        else
+            numevents = aeApiPoll(eventLoop, tvp);
+        now = aeUstime();
+        eventLoop->poll_usec += now-start;
+        start = now;
+        if (numevents == 0 && deadline && now >= deadline)
+            aeLatencyAdd(eventLoop->wakeup_hist,now-deadline);
+
+        /* After sleep callback. */
+        if (eventLoop->aftersleep != NULL && flags & AE_CALL_AFTER_SLEEP)
+            eventLoop->aftersleep(eventLoop);
+
         for (j = 0; j < numevents; j++) {
             aeFileEvent *fe = &eventLoop->events[eventLoop->fired[j].fd];
             int mask = eventLoop->fired[j].mask;
@@ -386,10 +491,16 @@ int aeProcessEvents(aeEventLoop *eventLoop, int flags)
             }
             processed++;
         }
+        eventLoop->file_usec += aeUstime()-start;
+        eventLoop->fired_count += numevents;
     }
     /* Check time events */
-    if (flags & AE_TIME_EVENTS)
+    if (flags & AE_TIME_EVENTS) {
+        long long start = aeUstime();
+
         processed += processTimeEvents(eventLoop);
+        eventLoop->time_usec += aeUstime()-start;
+    }
 
     return processed; /* return the number of processed file/time events */
 }
@@ -421,7 +532,7 @@ void aeMain(aeEventLoop *eventLoop) {
     while (!eventLoop->stop) {
         if (eventLoop->beforesleep != NULL)
             eventLoop->beforesleep(eventLoop);
-        aeProcessEvents(eventLoop, AE_ALL_EVENTS);
+        aeProcessEvents(eventLoop, AE_ALL_EVENTS|AE_CALL_AFTER_SLEEP);
     }
 }
 
@@ -432,3 +543,22 @@ char *aeGetApiName(void) {
 void aeSetBeforeSleepProc(aeEventLoop *eventLoop, aeBeforeSleepProc *beforesleep) {
     eventLoop->beforesleep = beforesleep;
 }
+
+void aeSetAfterSleepProc(aeEventLoop *eventLoop, aeBeforeSleepProc *aftersleep) {
+    eventLoop->aftersleep = aftersleep;
+}
+
+/* Spin polling for up to 'usec' microseconds before blocking for events.
+ * Zero disables busy polling. */
+void aeSetBusyPoll(aeEventLoop *eventLoop, long long usec) {
+    eventLoop->busypoll_usec = usec;
+}
+
+/* When noWait is true the multiplexing API is polled without blocking,
+ * until the flag is cleared again. */
+void aeSetDontWait(aeEventLoop *eventLoop, int noWait) {
+    if (noWait)
+        eventLoop->flags |= AE_DONT_WAIT;
+    else
+        eventLoop->flags &= ~AE_DONT_WAIT;
+}
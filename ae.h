@@ -14,10 +14,13 @@
 #define AE_TIME_EVENTS 2
 #define AE_ALL_EVENTS (AE_FILE_EVENTS|AE_TIME_EVENTS)
 #define AE_DONT_WAIT 4
+#define AE_CALL_AFTER_SLEEP 8
 
 #define AE_NOMORE -1
 #define AE_DELETED_EVENT_ID -1
 
+#define AE_LATENCY_BUCKETS 24 /* Power of two usec, up to ~8s. */
+
 /* Macros */
 #define AE_NOTUSED(V) ((void) V)
 
@@ -66,6 +69,23 @@ typedef struct aeEventLoop {
     int stop;
     void *apidata; /* This is used for polling API specific data */
     aeBeforeSleepProc *beforesleep;
+    aeBeforeSleepProc *aftersleep;
+    int flags; /* AE_DONT_WAIT to poll without blocking on next iterations */
+    long long busypoll_usec; /* Max usec to spin polling before blocking. */
+    long long busypoll_hits; /* Times events arrived while spinning. */
+    long long busypoll_sleeps; /* Times we spun in vain, then blocked. */
+    long long busypoll_spin_usec; /* Total usec spent spinning. */
+    /* Usec spent in every phase of aeProcessEvents(), accumulated until
+     * the caller resets them. */
+    long long poll_usec;  /* Waiting in the multiplexing API. */
+    long long file_usec;  /* Running file event handlers. */
+    long long time_usec;  /* Running time event handlers. */
+    long long fired_count; /* File events processed. */
+    /* Wake up latency, power of two usec histograms: time past the timeout
+     * when the multiplexing API returned because it expired, and time a
+     * time event fired after it was due. */
+    long long wakeup_hist[AE_LATENCY_BUCKETS];
+    long long timer_hist[AE_LATENCY_BUCKETS];
 } aeEventLoop;
 
 /* Prototypes */
@@ -89,6 +109,9 @@ void aeMain(aeEventLoop *eventLoop);
 
 char *aeGetApiName(void);
 void aeSetBeforeSleepProc(aeEventLoop *eventLoop, aeBeforeSleepProc *beforesleep);
+void aeSetAfterSleepProc(aeEventLoop *eventLoop, aeBeforeSleepProc *aftersleep);
+void aeSetDontWait(aeEventLoop *eventLoop, int noWait);
+void aeSetBusyPoll(aeEventLoop *eventLoop, long long usec);
 
 int aeGetSetSize(aeEventLoop *eventLoop);
 int aeResizeSetSize(aeEventLoop *eventLoop, int setsize);
@@ -1,4 +1,5 @@
-#include "anet.h"
+#include "fmacros.h"
+
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <sys/stat.h>
@@ -16,6 +17,7 @@
 #include <stdio.h>
 
 #include "anet.h"
+#include "config.h"
 
 static void anetSetError(char *err, const char *fmt, ...)
 {
@@ -128,6 +130,26 @@ int anetDisableTcpNoDelay(char *err, int fd)
 }
 
 
+/* Set SO_BUSY_POLL, so that blocking receives on the socket busy wait on
+ * the device queue for up to 'usec' microseconds. Note that values above
+ * net.core.busy_read need CAP_NET_ADMIN. */
+int anetSetBusyPoll(char *err, int fd, int usec)
+{
+#ifdef SO_BUSY_POLL
+    if (setsockopt(fd, SOL_SOCKET, SO_BUSY_POLL, &usec, sizeof(usec)) == -1)
+    {
+        anetSetError(err, "setsockopt SO_BUSY_POLL: %s", strerror(errno));
+        return ANET_ERR;
+    }
+    return ANET_OK;
+#else
+    ((void) fd);
+    ((void) usec);
+    anetSetError(err, "SO_BUSY_POLL not supported by this system");
+    return ANET_ERR;
+#endif
+}
+
 int anetSetSendBuffer(char *err, int fd, int buffsize)
 {
     if (setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &buffsize, sizeof(buffsize)) == -1)
@@ -498,7 +520,14 @@ int anetUnixServer(char *err, char *path, mode_t perm, int backlog)
 static int anetGenericAccept(char *err, int s, struct sockaddr *sa, socklen_t *len) {
     int fd;
     while(1) {
+#ifdef HAVE_ACCEPT4
+        /* Get the socket already non blocking and close-on-exec, saving
+         * the fcntl() round trips createClient() would otherwise do for
+         * every new connection. */
+        fd = accept4(s,sa,len,SOCK_NONBLOCK|SOCK_CLOEXEC);
+#else
         fd = accept(s,sa,len);
+#endif
         if (fd == -1) {
             if (errno == EINTR)
                 continue;
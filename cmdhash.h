@@ -0,0 +1,47 @@
+/* Perfect hash of the command table.
+ *
+ * The command names of redisCommandTable are hashed at build time by
+ * mkcmdhash, that writes cmdhash_table.h: a table with exactly one slot per
+ * command, and a displacement array so that every name is hashed to its
+ * own slot (hash and displace). Looking up a command is two hash
+ * computations and a compare, without any allocation.
+ *
+ * This file is shared by mkcmdhash and the server, so that they always use
+ * the same hash function. */
+
+#ifndef __CMDHASH_H
+#define __CMDHASH_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define CMDHASH_MAXLEN 32   /* Longest command name, multiple of 8. */
+
+/* A slot of the table. The name is stored lower case and zero padded, and
+ * the mask has 0x20 in the positions of the letters, so that names can be
+ * compared case insensitively eight bytes at a time:
+ * ((input ^ name) & ~mask) == 0 for every word. */
+typedef struct cmdhashEntry {
+    union { char c[CMDHASH_MAXLEN]; uint64_t w[CMDHASH_MAXLEN/8]; } name;
+    union { char c[CMDHASH_MAXLEN]; uint64_t w[CMDHASH_MAXLEN/8]; } mask;
+    size_t len;
+    int index;              /* Position in redisCommandTable. */
+} cmdhashEntry;
+
+/* FNV-1a variant, seeded, with ASCII letters folded to lower case. Other
+ * characters may be folded as well, the final compare sorts it out. */
+static inline uint32_t cmdhashFunction(uint32_t seed, const char *s, size_t len) {
+    uint32_t h = 2166136261u ^ (seed * 2654435761u);
+    size_t j;
+
+    for (j = 0; j < len; j++) {
+        h ^= (unsigned char)s[j] | 0x20;
+        h *= 16777619u;
+    }
+    h ^= h >> 15;
+    h *= 0x2c1b3c6du;
+    h ^= h >> 12;
+    return h;
+}
+
+#endif
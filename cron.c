@@ -0,0 +1,151 @@
+/* Maintenance jobs run by serverCron().
+ *
+ * Jobs are registered at startup with the period they want to run at, and
+ * serverCron() runs the ones that are due. Every cron cycle has a time
+ * budget, cron-max-cpu-perc percent of the cycle period (1000/hz ms): the
+ * jobs run one after the other, each one is given what is left of the
+ * budget, and once it is used the remaining due jobs are postponed. The next
+ * cycle starts from the first postponed job, so no job starves, and the
+ * first job of a cycle always runs.
+ *
+ * server.hz adapts to the load: with many clients or keys the cron runs
+ * more often, so that every run has less work to do (clients to check, keys
+ * to sample) and never blocks the event loop for long. */
+
+#include "cron.h"
+
+static cronJob jobs[CRON_MAX_JOBS];
+static int numjobs;
+static int nextjob;                 /* First job to try in the next cycle. */
+static long long cron_start;        /* ustime() at cronInit(). */
+static long long cron_usec;         /* Usec spent running jobs. */
+static long long cron_cycles;       /* Cycles run. */
+static long long cron_budget_hits;  /* Cycles that postponed some job. */
+
+void cronInit(void) {
+    numjobs = 0;
+    nextjob = 0;
+    cron_start = ustime();
+    cron_usec = 0;
+    cron_cycles = 0;
+    cron_budget_hits = 0;
+}
+
+/* Register a job, run every 'period' milliseconds, or every cycle if the
+ * period is zero. Jobs are tried in registration order. */
+void cronRegisterJob(char *name, cronJobProc *proc, long long period) {
+    cronJob *job;
+
+    serverAssert(numjobs < CRON_MAX_JOBS);
+    job = jobs+numjobs++;
+    memset(job,0,sizeof(*job));
+    job->name = name;
+    job->proc = proc;
+    job->period = period;
+}
+
+/* Usec the jobs can use in a cron cycle. */
+static long long cronCycleBudget(void) {
+    long long budget = 1000000LL/server.hz*server.cron_max_cpu_perc/100;
+
+    return budget > 0 ? budget : 1;
+}
+
+/* Run the jobs that are due, within the budget of the cycle. */
+void cronRunJobs(void) {
+    long long budget = cronCycleBudget(), spent = 0;
+    long long now = mstime();
+    int j, ran = 0;
+
+    cron_cycles++;
+    for (j = 0; j < numjobs; j++) {
+        int idx = (nextjob+j) % numjobs;
+        cronJob *job = jobs+idx;
+        long long start, elapsed;
+
+        if (job->period && now-job->last_run < job->period) continue;
+        if (ran && spent >= budget) {
+            job->deferred++;
+            cron_budget_hits++;
+            nextjob = idx;
+            return;
+        }
+
+        start = ustime();
+        job->proc(budget-spent);
+        elapsed = ustime()-start;
+
+        job->last_run = now;
+        job->calls++;
+        job->usec += elapsed;
+        if (elapsed > job->max_usec) job->max_usec = elapsed;
+        cron_usec += elapsed;
+        spent += elapsed;
+        ran++;
+    }
+    nextjob = 0;
+}
+
+/* Set server.hz from the configured one, doubling it while there are more
+ * than CRON_MAX_CLIENTS_PER_TICK clients or CRON_MAX_KEYS_PER_TICK keys per
+ * cron cycle, up to CONFIG_MAX_HZ. */
+void cronUpdateHz(void) {
+    unsigned long long keys = 0;
+    unsigned long clients = listLength(server.clients);
+    int hz = server.config_hz, j;
+
+    if (server.dynamic_hz) {
+        for (j = 0; j < server.dbnum; j++)
+            keys += server.db[j].key_count;
+        while (hz < CONFIG_MAX_HZ &&
+               (clients/hz > CRON_MAX_CLIENTS_PER_TICK ||
+                keys/hz > CRON_MAX_KEYS_PER_TICK))
+        {
+            hz *= 2;
+        }
+        if (hz > CONFIG_MAX_HZ) hz = CONFIG_MAX_HZ;
+    }
+    if (hz != server.hz) {
+        serverLog(LL_VERBOSE,"Cron frequency changed from %d to %d hz "
+            "(%lu clients, %llu keys).", server.hz, hz, clients, keys);
+        server.hz = hz;
+    }
+}
+
+/* Append the cron section of INFO. The shares are the percentage of the
+ * wall clock time since startup spent running the jobs. */
+sds cronCatInfoString(sds info) {
+    double wall = ustime()-cron_start;
+    int j;
+
+    if (wall <= 0) wall = 1;
+    info = sdscatprintf(info,
+        "# Cron\r\n"
+        "hz:%d\r\n"
+        "configured_hz:%d\r\n"
+        "dynamic_hz:%d\r\n"
+        "cron_max_cpu_perc:%d\r\n"
+        "cron_cycle_budget_usec:%lld\r\n"
+        "cron_cycles:%lld\r\n"
+        "cron_budget_hits:%lld\r\n"
+        "cron_cpu_perc:%.4f\r\n",
+        server.hz,
+        server.config_hz,
+        server.dynamic_hz,
+        server.cron_max_cpu_perc,
+        cronCycleBudget(),
+        cron_cycles,
+        cron_budget_hits,
+        cron_usec*100/wall);
+    for (j = 0; j < numjobs; j++) {
+        cronJob *job = jobs+j;
+
+        info = sdscatprintf(info,
+            "cron_job_%s:calls=%lld,usec=%lld,usec_per_call=%.2f,"
+            "max_usec=%lld,deferred=%lld,share_perc=%.4f\r\n",
+            job->name, job->calls, job->usec,
+            job->calls ? (double)job->usec/job->calls : 0,
+            job->max_usec, job->deferred, job->usec*100/wall);
+    }
+    return info;
+}
@@ -0,0 +1,33 @@
+#ifndef __CRON_H
+#define __CRON_H
+
+#include "server.h"
+
+#define CRON_MAX_JOBS 16
+#define CRON_MAX_CLIENTS_PER_TICK 200   /* Above this server.hz doubles, */
+#define CRON_MAX_KEYS_PER_TICK 100000   /* as it does above this. */
+
+/* A maintenance job is called with the microseconds it may use in this
+ * cycle. Jobs doing incremental work must stop once the budget is used and
+ * resume from there the next time they are called. */
+typedef void cronJobProc(long long budget);
+
+typedef struct cronJob {
+    char *name;
+    cronJobProc *proc;
+    long long period;           /* Milliseconds between runs, 0 = every cycle. */
+    long long last_run;         /* mstime() of the last run. */
+    long long calls;            /* Stats: number of runs, */
+    long long usec;             /* total and */
+    long long max_usec;         /* max run time, */
+    long long deferred;         /* runs postponed because of the budget. */
+} cronJob;
+
+/* Exported API */
+void cronInit(void);
+void cronRegisterJob(char *name, cronJobProc *proc, long long period);
+void cronRunJobs(void);
+void cronUpdateHz(void);
+sds cronCatInfoString(sds info);
+
+#endif
@@ -4,9 +4,12 @@
 #include <signal.h>
 #include <ctype.h>
 
-void slotToKeyAdd(robj *key);
-void slotToKeyDel(robj *key);
-void slotToKeyFlush(void);
+static int expireEntryIfNeeded(redisDb *db, robj *key, dictEntry *de);
+static int removeEntryExpire(redisDb *db, dictEntry *de);
+static robj *lookupKeyEntry(dictEntry *de, int flags);
+static void dbEmptyKeyspace(redisDb *db, void(callback)(void*));
+static int dbKeySlot(redisDb *db, sds key);
+static void dbKeyCountAdd(redisDb *db, int slot, long delta);
 
 int selectDb(client *c, int id) {
     if (id < 0 || id >= server.dbnum)
@@ -37,9 +40,13 @@ int selectDb(client *c, int id) {
  * correctly report a key is expired on slaves even if the master is lagging
  * expiring our key via DELs in the replication link. */
 robj *lookupKeyReadWithFlags(redisDb *db, robj *key, int flags) {
+    dictEntry *de = dbFind(db,key->ptr);
     robj *val;
 
-    if (expireIfNeeded(db,key) == 1) {
+    if (server.admission_sketch) admissionRecordAccess(key);
+    if (server.hotkeys_sample_rate) keystatsRecordAccess(db,key);
+    if (server.mrc) mrcRecordAccess(key);
+    if (de && expireEntryIfNeeded(db,key,de) == 1) {
         /* Key expired. If we are in the context of a master, expireIfNeeded()
          * returns 0 only when the key does not exist at all, so it's safe
          * to return NULL ASAP. */
@@ -65,11 +72,11 @@ robj *lookupKeyReadWithFlags(redisDb *db, robj *key, int flags) {
             return NULL;
         }
     }
-    val = lookupKey(db,key,flags);
+    val = de ? lookupKeyEntry(de,flags) : NULL;
     if (val == NULL)
-        server.stat_keyspace_misses++;
+        atomicStatIncr(server.stat_keyspace_misses);
     else
-        server.stat_keyspace_hits++;
+        atomicStatIncr(server.stat_keyspace_hits);
     return val;
 }
 
@@ -122,12 +129,16 @@ void getKeysFreeResult(int *result) {
     zfree(result);
 }
 
-void delCommand(client *c) {
+/* DEL and UNLINK. With 'lazy' set the values that are expensive to free are
+ * reclaimed by a background thread, see dbAsyncDelete(). */
+void delGenericCommand(client *c, int lazy) {
     int deleted = 0, j;
 
     for (j = 1; j < c->argc; j++) {
         expireIfNeeded(c->db,c->argv[j]);
-        if (dbDelete(c->db,c->argv[j])) {
+        if (lazy ? dbAsyncDelete(c->db,c->argv[j]) :
+                   dbDelete(c->db,c->argv[j]))
+        {
             signalModifiedKey(c->db,c->argv[j]);
             notifyKeyspaceEvent(NOTIFY_GENERIC,
                 "del",c->argv[j],c->db->id);
@@ -138,8 +149,200 @@ void delCommand(client *c) {
     addReplyLongLong(c,deleted);
 }
 
+void delCommand(client *c) {
+    delGenericCommand(c,server.lazyfree_lazy_user_del);
+}
+
+void unlinkCommand(client *c) {
+    delGenericCommand(c,1);
+}
+
+/* Return the set of flags to use for the emptyDb() call for FLUSHALL
+ * and FLUSHDB commands.
+ *
+ * Currently the command just attempts to parse the "ASYNC" option. It
+ * also checks if the command arity is wrong.
+ *
+ * On success C_OK is returned and the flags are stored in *flags, otherwise
+ * C_ERR is returned and the function sends an error to the client. */
+int getFlushCommandFlags(client *c, int *flags) {
+    /* Parse the optional ASYNC option. */
+    if (c->argc > 1) {
+        if (c->argc > 2 || strcasecmp(c->argv[1]->ptr,"async")) {
+            addReply(c,shared.syntaxerr);
+            return C_ERR;
+        }
+        *flags = EMPTYDB_ASYNC;
+    } else {
+        *flags = EMPTYDB_NO_FLAGS;
+    }
+    return C_OK;
+}
+
+/* FLUSHDB [ASYNC]
+ *
+ * Flushes the currently SELECTed Redis DB. */
+void flushdbCommand(client *c) {
+    int flags;
+
+    if (getFlushCommandFlags(c,&flags) == C_ERR) return;
+    signalFlushedDb(c->db->id);
+    server.dirty += emptyDb(c->db->id,flags,NULL);
+    addReply(c,shared.ok);
+}
+
+/* FLUSHALL [ASYNC]
+ *
+ * Flushes the whole server data set. */
+void flushallCommand(client *c) {
+    int flags;
+
+    if (getFlushCommandFlags(c,&flags) == C_ERR) return;
+    signalFlushedDb(-1);
+    server.dirty += emptyDb(-1,flags,NULL);
+    addReply(c,shared.ok);
+    server.dirty++;
+}
+
+/* State of a KEYS command, that visits the keyspace in batches when it
+ * can be resumed, see keysBatch(). */
+typedef struct keysState {
+    void *replylen;             /* Deferred length of the reply. */
+    unsigned long numkeys;      /* Keys replied so far. */
+    size_t prefixlen;           /* Literal prefix of the pattern. */
+    int indexed;                /* Walk the prefix index, not the dicts. */
+    sds last;                   /* Last key of the index walk, or NULL. */
+    int dictidx;                /* Dict being scanned, and the dictScan() */
+    unsigned long cursor;       /* cursor in it. */
+    sds pattern;
+    int allkeys;                /* The pattern is "*". */
+    list *keys;                 /* Matching keys found by the batch. */
+    long visited;               /* Keys visited by the batch, and the */
+    long limit;                 /* maximum before it stops. */
+} keysState;
+
+/* Collects the keys found in the prefix index that match the pattern,
+ * stopping the walk at the last key of the batch. */
+static int keysWalkCallback(void *privdata, unsigned char *key, size_t len) {
+    keysState *ks = privdata;
+
+    if (stringmatchlen(ks->pattern,sdslen(ks->pattern),(char*)key,len,0))
+        listAddNodeTail(ks->keys,createStringObject((char*)key,len));
+    if (++ks->visited < ks->limit) return 1;
+    ks->last = ks->last ? sdscpylen(ks->last,(char*)key,len) :
+                          sdsnewlen(key,len);
+    return 0;
+}
+
+static void keysScanCallback(void *privdata, const dictEntry *de) {
+    keysState *ks = privdata;
+    sds key = dictGetKey(de);
+
+    if (ks->allkeys ||
+        stringmatchlen(ks->pattern,sdslen(ks->pattern),key,sdslen(key),0))
+        listAddNodeTail(ks->keys,createStringObject(key,sdslen(key)));
+    ks->visited++;
+}
+
+/* Length of the literal prefix of a glob style pattern. */
+static size_t patternPrefixLen(sds pattern) {
+    size_t j;
+
+    for (j = 0; j < sdslen(pattern); j++)
+        if (strchr("*?[\\",pattern[j])) break;
+    return j;
+}
+
+/* Run the next batch of KEYS, that visits up to ks->limit keys. Returns 1
+ * once the whole keyspace, or the subtree of the prefix, was visited.
+ *
+ * The position in the keyspace is saved as the last key of the prefix index
+ * walk, or as a dictScan() cursor, that are both valid even if keys are
+ * deleted between the batches. The matching keys are collected first and
+ * the expired ones deleted later, as the keyspace can't change while it is
+ * visited. */
+static int keysBatch(client *c, void *state) {
+    keysState *ks = state;
+    redisDb *db = c->db;
+    listNode *ln;
+    int done;
+
+    ks->keys = listCreate();
+    ks->visited = 0;
+    if (ks->indexed) {
+        radixWalkPrefix(db->prefix_index,(unsigned char*)ks->pattern,
+                        ks->prefixlen,(unsigned char*)ks->last,
+                        ks->last ? sdslen(ks->last) : 0,keysWalkCallback,ks);
+        done = ks->visited < ks->limit;
+    } else {
+        while (ks->dictidx < db->dict_count && ks->visited < ks->limit) {
+            dict *d = db->dict[ks->dictidx];
+
+            if (d) ks->cursor = dictScan(d,ks->cursor,keysScanCallback,ks);
+            if (d == NULL || ks->cursor == 0) ks->dictidx++;
+        }
+        done = ks->dictidx == db->dict_count;
+    }
+
+    while ((ln = listFirst(ks->keys)) != NULL) {
+        robj *keyobj = listNodeValue(ln);
+
+        if (expireIfNeeded(db,keyobj) == 0) {
+            addReplyBulk(c,keyobj);
+            ks->numkeys++;
+        }
+        decrRefCount(keyobj);
+        listDelNode(ks->keys,ln);
+    }
+    listRelease(ks->keys);
+    ks->keys = NULL;
+
+    if (done) setDeferredMultiBulkLength(c,ks->replylen,ks->numkeys);
+    return done;
+}
+
+static void keysStateFree(void *state) {
+    keysState *ks = state;
+
+    sdsfree(ks->last);
+    zfree(ks);
+}
+
+/* KEYS pattern
+ *
+ * When the pattern starts with a literal prefix and the DB has a prefix
+ * index only the keys with the prefix are visited, otherwise the whole
+ * keyspace is scanned. With a big keyspace the command is executed in
+ * batches of server.resume_batch keys, see resume.c. */
+void keysCommand(client *c) {
+    keysState *ks = zmalloc(sizeof(*ks));
+
+    ks->pattern = c->argv[1]->ptr;
+    ks->allkeys = (ks->pattern[0] == '*' && ks->pattern[1] == '\0');
+    ks->prefixlen = patternPrefixLen(ks->pattern);
+    ks->indexed = c->db->prefix_index && ks->prefixlen > 0;
+    ks->last = NULL;
+    ks->dictidx = 0;
+    ks->cursor = 0;
+    ks->numkeys = 0;
+    ks->limit = resumeCanYield(c) ? server.resume_batch : LONG_MAX;
+    ks->replylen = addDeferredMultiBulkLength(c);
+
+    if (keysBatch(c,ks))
+        keysStateFree(ks);
+    else
+        resumeCommand(c,keysBatch,keysStateFree,ks);
+}
+
 int expireIfNeeded(redisDb *db, robj *key) {
-    mstime_t when = getExpire(db,key);
+    dictEntry *de = dbFind(db,key->ptr);
+
+    return de ? expireEntryIfNeeded(db,key,de) : 0;
+}
+
+/* expireIfNeeded() for the entry 'de' of 'key', already looked up. */
+static int expireEntryIfNeeded(redisDb *db, robj *key, dictEntry *de) {
+    mstime_t when = getEntryExpire(de);
     mstime_t now;
 
     if (when < 0) return 0; /* No expire for this key */
@@ -163,6 +366,10 @@ int expireIfNeeded(redisDb *db, robj *key) {
      * we think the key is expired at this time. */
     if (server.masterhost != NULL) return now > when;
 
+    /* The same for commands running in parallel, that can't modify the
+     * keyspace: the key is deleted later by the main thread. */
+    if (threadexec_parallel) return now > when;
+
     /* Return when this key has not expired */
     if (now <= when) return 0;
 
@@ -201,53 +408,93 @@ void propagateExpire(redisDb *db, robj *key) {
 
 /* Delete a key, value, and associated expiration entry if any, from the DB */
 int dbDelete(redisDb *db, robj *key) {
-    /* Deleting an entry from the expires dict will not free the sds of
-     * the key, because it is shared with the main dictionary. */
-    if (dictSize(db->expires) > 0) dictDelete(db->expires,key->ptr);
-    if (dictDelete(db->dict,key->ptr) == DICT_OK) {
-        if (server.cluster_enabled) slotToKeyDel(key);
-        return 1;
-    } else {
-        return 0;
+    dictEntry *de;
+
+    if (db->expires_index->length == 0 && !server.bigkeys_capacity)
+        return dbDictDelete(db,key->ptr);
+    if ((de = dbFind(db,key->ptr)) == NULL) return 0;
+    /* The expire is stored in the key, only the index needs an update. */
+    if (db->expires_index->length > 0) removeEntryExpire(db,de);
+    if (server.bigkeys_capacity) {
+        robj *val = dictGetVal(de);
+        keystatsUntrackKey(db,key,val->type);
     }
+    return dbDictDelete(db,key->ptr);
+}
+
+/* Remove all keys from all the databases in a Redis server, or only the
+ * database 'dbnum' if it is not -1. If callback is given the function is
+ * called from time to time to signal that work is in progress.
+ *
+ * With the EMPTYDB_ASYNC flag the databases are swapped with empty ones
+ * and the old ones are released by a background thread.
+ *
+ * On success the function returns the number of keys removed from the
+ * database(s). Otherwise -1 is returned in the specific case the
+ * DB number is out of range, and errno is set to EINVAL. */
+long long emptyDb(int dbnum, int flags, void(callback)(void*)) {
+    int j, async = (flags & EMPTYDB_ASYNC);
+    long long removed = 0;
+
+    if (dbnum < -1 || dbnum >= server.dbnum) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    for (j = 0; j < server.dbnum; j++) {
+        if (dbnum != -1 && dbnum != j) continue;
+        removed += server.db[j].key_count;
+        if (server.bigkeys_capacity) keystatsEmptyDb(j);
+        if (async) {
+            emptyDbAsync(&server.db[j]);
+        } else {
+            dbEmptyKeyspace(&server.db[j],callback);
+            zslFree(server.db[j].expires_index);
+            server.db[j].expires_index = zslCreate();
+        }
+    }
+    return removed;
+}
+
+void signalFlushedDb(int dbid) {
+    touchWatchedKeysOnFlush(dbid);
 }
 
 /* Low level key lookup API, not actually called directly from commands
  * implementations that should instead rely on lookupKeyRead(),
  * lookupKeyWrite() and lookupKeyReadWithFlags(). */
 robj *lookupKey(redisDb *db, robj *key, int flags) {
-    dictEntry *de = dictFind(db->dict,key->ptr);
-    if (de) {
-        robj *val = dictGetVal(de);
+    dictEntry *de = dbFind(db,key->ptr);
 
-        /* Update the access time for the ageing algorithm.
-         * Don't do it if we have a saving child, as this will trigger
-         * a copy on write madness. */
-        if (server.rdb_child_pid == -1 &&
-            server.aof_child_pid == -1 &&
-            !(flags & LOOKUP_NOTOUCH))
-        {
+    return de ? lookupKeyEntry(de,flags) : NULL;
+}
+
+/* Return the value of the main dict entry 'de', updating its access time. */
+static robj *lookupKeyEntry(dictEntry *de, int flags) {
+    robj *val = dictGetVal(de);
+
+    /* Update the access time for the ageing algorithm.
+     * Don't do it if we have a saving child, as this will trigger
+     * a copy on write madness. */
+    if (server.rdb_child_pid == -1 &&
+        server.aof_child_pid == -1 &&
+        !(flags & LOOKUP_NOTOUCH))
+    {
+        if (server.maxmemory_policy & MAXMEMORY_FLAG_LFU) {
+            updateLFU(val);
+        } else {
             val->lru = LRU_CLOCK();
         }
-        return val;
-    } else {
-        return NULL;
     }
+    return val;
 }
 
 /* Return the expire time of the specified key, or -1 if no expire
  * is associated with this key (i.e. the key is non volatile) */
 long long getExpire(redisDb *db, robj *key) {
-    dictEntry *de;
-
-    /* No expire? return ASAP */
-    if (dictSize(db->expires) == 0 ||
-       (de = dictFind(db->expires,key->ptr)) == NULL) return -1;
+    dictEntry *de = dbFind(db,key->ptr);
 
-    /* The entry was found in the expire dict, this means it should also
-     * be present in the main dict (safety check). */
-    serverAssertWithInfo(NULL,key,dictFind(db->dict,key->ptr) != NULL);
-    return dictGetSignedIntegerVal(de);
+    return de ? getEntryExpire(de) : -1;
 }
 
 /* Like lookupKeyReadWithFlags(), but does not use any flag, which is the
@@ -269,29 +516,103 @@ robj *lookupKeyReadOrReply(client *c, robj *key, robj *reply) {
  * Returns the linked value object if the key exists or NULL if the key
  * does not exist in the specified DB. */
 robj *lookupKeyWrite(redisDb *db, robj *key) {
-    expireIfNeeded(db,key);
-    return lookupKey(db,key,LOOKUP_NONE);
+    dictEntry *de = dbFind(db,key->ptr);
+
+    if (server.admission_sketch) admissionRecordAccess(key);
+    if (server.hotkeys_sample_rate) keystatsRecordAccess(db,key);
+    /* Look the key up again only if it was just deleted. */
+    if (de && expireEntryIfNeeded(db,key,de) == 1)
+        de = dbFind(db,key->ptr);
+    return de ? lookupKeyEntry(de,LOOKUP_NONE) : NULL;
 }
 
 /*-----------------------------------------------------------------------------
  * Expires API
  *----------------------------------------------------------------------------*/
 
+/* The expire of a key is stored in the main dict, in the key itself: the
+ * timeout (unix time in milliseconds) is in the free space of the sds after
+ * the null terminator, and SDS_AUX_FLAG in the sds flags tells the keys with
+ * an expire from the others (type 5 strings, that use the flag bits for
+ * the length, never have one). This way the lookup of a key resolves both its
+ * value and its TTL, and keys without an expire take no extra memory. */
+#define keyHasExpire(k) (((k)[-1] & SDS_TYPE_MASK) != SDS_TYPE_5 && \
+                         ((k)[-1] & SDS_AUX_FLAG))
+
+static long long keyGetExpire(sds k) {
+    long long when;
+
+    memcpy(&when,k+sdslen(k)+1,sizeof(when));
+    return when;
+}
+
+/* Store the expire in the key, that may be reallocated to make room for it.
+ * Returns the key to use from now on. */
+static sds keySetExpire(sds k, long long when) {
+    k = sdsMakeRoomForNonGreedy(k,sizeof(when));
+    memcpy(k+sdslen(k)+1,&when,sizeof(when));
+    k[-1] |= SDS_AUX_FLAG;
+    return k;
+}
+
+/* Return the expire time of the key of the main dict entry 'de', or -1. */
+long long getEntryExpire(dictEntry *de) {
+    sds k = dictGetKey(de);
+
+    return keyHasExpire(k) ? keyGetExpire(k) : -1;
+}
+
+/* Every key with a timeout is also in db->expires_index, a skiplist ordered
+ * by timeout (milliseconds, exactly represented by the double score), so
+ * that activeExpireCycle() can pop exactly the keys that are expired. It's
+ * only used for active expiry. The skiplist elements are string objects
+ * with their own copy of the key. */
+static void expireIndexAdd(redisDb *db, sds key, long long when) {
+    zslInsert(db->expires_index,(double)when,
+        createStringObject(key,sdslen(key)));
+}
+
+static void expireIndexDelete(redisDb *db, sds key, long long when) {
+    robj keyobj;
+
+    initStaticStringObject(keyobj,key);
+    serverAssertWithInfo(NULL,&keyobj,
+        zslDelete(db->expires_index,(double)when,&keyobj));
+}
+
+/* Remove the expire of the key of the main dict entry 'de', if it has
+ * one. Returns 1 if the key had an expire. */
+static int removeEntryExpire(redisDb *db, dictEntry *de) {
+    sds k = dictGetKey(de);
+
+    if (!keyHasExpire(k)) return 0;
+    expireIndexDelete(db,k,keyGetExpire(k));
+    k[-1] &= ~SDS_AUX_FLAG;
+    return 1;
+}
+
 int removeExpire(redisDb *db, robj *key) {
+    dictEntry *de = dbFind(db,key->ptr);
+
     /* An expire may only be removed if there is a corresponding entry in the
      * main dict. Otherwise, the key will never be freed. */
-    serverAssertWithInfo(NULL,key,dictFind(db->dict,key->ptr) != NULL);
-    return dictDelete(db->expires,key->ptr) == DICT_OK;
+    serverAssertWithInfo(NULL,key,de != NULL);
+    return removeEntryExpire(db,de);
 }
 
 void setExpire(redisDb *db, robj *key, long long when) {
-    dictEntry *kde, *de;
+    dictEntry *de = dbFind(db,key->ptr);
+    sds k;
 
-    /* Reuse the sds from the main dict in the expire dict */
-    kde = dictFind(db->dict,key->ptr);
-    serverAssertWithInfo(NULL,key,kde != NULL);
-    de = dictReplaceRaw(db->expires,dictGetKey(kde));
-    dictSetSignedIntegerVal(de,when);
+    serverAssertWithInfo(NULL,key,de != NULL);
+    k = dictGetKey(de);
+    if (keyHasExpire(k)) expireIndexDelete(db,k,keyGetExpire(k));
+
+    /* The key may move: the entry is updated in place, the hash is the
+     * same. */
+    k = keySetExpire(k,when);
+    dictSetKey(dbKeyDict(db,k),de,k);
+    expireIndexAdd(db,k,when);
 }
 
 /* High level Set operation. This function can be used in order to set
@@ -301,6 +622,7 @@ void setExpire(redisDb *db, robj *key, long long when) {
  * 2) clients WATCHing for the destination key notified.
  * 3) The expire time of the key is reset (the key is made persistent). */
 void setKey(redisDb *db, robj *key, robj *val) {
+    if (server.mrc) mrcRecordAccess(key);
     if (lookupKeyWrite(db,key) == NULL) {
         dbAdd(db,key,val);
     } else {
@@ -311,6 +633,20 @@ void setKey(redisDb *db, robj *key, robj *val) {
     signalModifiedKey(db,key);
 }
 
+/* Add the key to the keyspace dict 'd' of the DB, or replace its value if
+ * 'replace' is true. Every insertion into a keyspace dict goes through this
+ * function: an insertion may start a rehash, even when it just replaces a
+ * value, and the dicts that are rehashing must be in db->rehashing (see the
+ * keyspace layout below). Returns the dictAdd() or dictReplace() result. */
+static int dbDictInsert(redisDb *db, dict *d, sds key, robj *val,
+                        int replace)
+{
+    int rehashing = dictIsRehashing(d), retval;
+
+    retval = replace ? dictReplace(d,key,val) : dictAdd(d,key,val);
+    if (!rehashing && dictIsRehashing(d)) listAddNodeTail(db->rehashing,d);
+    return retval;
+}
 
 /* Overwrite an existing key with a new value. Incrementing the reference
  * count of the new value is up to the caller.
@@ -318,10 +654,15 @@ void setKey(redisDb *db, robj *key, robj *val) {
  *
  * The program is aborted if the key was not already present. */
 void dbOverwrite(redisDb *db, robj *key, robj *val) {
-    dictEntry *de = dictFind(db->dict,key->ptr);
+    dictEntry *de = dbFind(db,key->ptr);
+    robj *old;
 
     serverAssertWithInfo(NULL,key,de != NULL);
-    dictReplace(db->dict, key->ptr, val);
+    old = dictGetVal(de);
+    /* The access frequency belongs to the key, not to the value. */
+    if (server.maxmemory_policy & MAXMEMORY_FLAG_LFU) val->lru = old->lru;
+    if (server.bigkeys_capacity) keystatsTrackSize(db,key,val,old->type);
+    dbDictInsert(db,dbKeyDict(db,key->ptr),key->ptr,val,1);
 }
 
 /* Add the key to the DB. It's up to the caller to increment the reference
@@ -330,31 +671,192 @@ void dbOverwrite(redisDb *db, robj *key, robj *val) {
  * The program is aborted if the key already exists. */
 void dbAdd(redisDb *db, robj *key, robj *val) {
     sds copy = sdsdup(key->ptr);
-    int retval = dictAdd(db->dict, copy, val);
+    int slot = dbKeySlot(db,copy);
+    dict *d = db->dict[slot];
+    int retval;
+
+    if (d == NULL) d = db->dict[slot] = dictCreate(&dbDictType,NULL);
+    retval = dbDictInsert(db,d,copy,val,0);
 
     serverAssertWithInfo(NULL,key,retval == DICT_OK);
+    dbKeyCountAdd(db,slot,1);
+    if (db->prefix_index)
+        radixInsert(db->prefix_index,(unsigned char*)copy,sdslen(copy));
+    /* A rejected key is still added, it's just the next one evicted. */
+    if (server.admission_sketch) admissionRejectKey(db,key);
+    if (server.bigkeys_capacity) keystatsTrackSize(db,key,val,-1);
     if (val->type == OBJ_LIST) signalListAsReady(db, key);
-    if (server.cluster_enabled) slotToKeyAdd(key);
- }
+}
 
+/*-----------------------------------------------------------------------------
+ * Keyspace layout
+ *
+ * The keys of a DB are in db->dict, an array of db->dict_count dicts: a
+ * single dict, or with server.keyspace_slots one dict per cluster hash slot.
+ * In the latter case a resize or a rehash only involves the keys of one slot,
+ * and the keys of a slot are counted, enumerated or deleted without visiting
+ * the rest of the keyspace. The dict of a slot is created with its first key.
+ *
+ * db->slot_key_index is a Fenwick tree of the number of keys per slot: it
+ * finds in O(log(slots)) the slot of the Nth key, so that random keys are
+ * sampled from a slot picked with a probability proportional to its size.
+ *
+ * The dicts that started a rehash are tracked in db->rehashing, so that
+ * serverCron() and the threaded execution, that needs to pause the rehash,
+ * don't have to visit all the slots. A dict stays in the list until it is
+ * seen with the rehash completed.
+ *----------------------------------------------------------------------------*/
 
- /* Slot to Key API. This is used by Redis Cluster in order to obtain in
- * a fast way a key that belongs to a specified hash slot. This is useful
- * while rehashing the cluster. */
-void slotToKeyAdd(robj *key) {
-    // unsigned int hashslot = keyHashSlot(key->ptr,sdslen(key->ptr));
+void dbInitKeyspace(redisDb *db) {
+    db->dict_count = server.keyspace_slots ? CLUSTER_SLOTS : 1;
+    db->dict = zcalloc(sizeof(dict*)*db->dict_count);
+    if (db->dict_count == 1) db->dict[0] = dictCreate(&dbDictType,NULL);
+    db->key_count = 0;
+    db->slot_key_index = server.keyspace_slots ?
+        zcalloc(sizeof(unsigned long long)*(CLUSTER_SLOTS+1)) : NULL;
+    db->rehashing = listCreate();
+    db->resize_cursor = 0;
+    db->prefix_index = server.prefix_index ? radixNew() : NULL;
+}
 
-    // zslInsert(server.cluster->slots_to_keys,hashslot,key);
-    // incrRefCount(key);
+/* Remove all the keys, keeping the dicts. */
+static void dbEmptyKeyspace(redisDb *db, void(callback)(void*)) {
+    int j;
+
+    for (j = 0; j < db->dict_count; j++)
+        if (db->dict[j]) dictEmpty(db->dict[j],callback);
+    db->key_count = 0;
+    if (db->slot_key_index)
+        memset(db->slot_key_index,0,
+               sizeof(unsigned long long)*(CLUSTER_SLOTS+1));
+    while (listLength(db->rehashing))
+        listDelNode(db->rehashing,listFirst(db->rehashing));
+    if (db->prefix_index) {
+        radixFree(db->prefix_index);
+        db->prefix_index = radixNew();
+    }
 }
 
-void slotToKeyDel(robj *key) {
-    // unsigned int hashslot = keyHashSlot(key->ptr,sdslen(key->ptr));
+static int dbKeySlot(redisDb *db, sds key) {
+    return db->dict_count == 1 ? 0 : (int)keyHashSlot(key,sdslen(key));
+}
 
-    // zslDelete(server.cluster->slots_to_keys,hashslot,key);
+/* Return the dict of the key, or NULL if its slot has no dict yet. */
+dict *dbKeyDict(redisDb *db, sds key) {
+    return db->dict[dbKeySlot(db,key)];
 }
 
-void slotToKeyFlush(void) {
-    // zslFree(server.cluster->slots_to_keys);
-    // server.cluster->slots_to_keys = zslCreate();
-}
\ No newline at end of file
+dictEntry *dbFind(redisDb *db, sds key) {
+    dict *d = dbKeyDict(db,key);
+
+    return d ? dictFind(d,key) : NULL;
+}
+
+static void dbKeyCountAdd(redisDb *db, int slot, long delta) {
+    int j;
+
+    db->key_count += delta;
+    if (db->slot_key_index == NULL) return;
+    for (j = slot+1; j <= CLUSTER_SLOTS; j += j & -j)
+        db->slot_key_index[j] += delta;
+}
+
+/* Return the slot of the key of rank 'rank' (starting from 0) when the keys
+ * are ordered by slot, that must be less than db->key_count. */
+static int dbSlotByKeyRank(redisDb *db, unsigned long long rank) {
+    int pos = 0, step;
+
+    for (step = CLUSTER_SLOTS; step; step >>= 1) {
+        if (pos+step <= CLUSTER_SLOTS && db->slot_key_index[pos+step] <= rank) {
+            pos += step;
+            rank -= db->slot_key_index[pos];
+        }
+    }
+    return pos;
+}
+
+/* Return a slot with a probability proportional to its number of keys. The
+ * DB must not be empty. */
+static int dbRandomSlot(redisDb *db) {
+    unsigned long long r;
+
+    if (db->dict_count == 1) return 0;
+    r = ((unsigned long long)random() << 31) | random();
+    return dbSlotByKeyRank(db,r % db->key_count);
+}
+
+/* Remove the key from its dict, returns 1 if the key existed. */
+int dbDictDelete(redisDb *db, sds key) {
+    int slot = dbKeySlot(db,key);
+    dict *d = db->dict[slot];
+
+    if (d == NULL) return 0;
+    /* Remove the key from the index first: the key may be the one of the
+     * dict entry, freed by dictDelete(). */
+    if (db->prefix_index &&
+        !radixRemove(db->prefix_index,(unsigned char*)key,sdslen(key)))
+        return 0;
+    if (dictDelete(d,key) != DICT_OK) return 0;
+    dbKeyCountAdd(db,slot,-1);
+    return 1;
+}
+
+/* dictGetRandomKey() for the whole keyspace. */
+dictEntry *dbGetRandomEntry(redisDb *db) {
+    if (db->key_count == 0) return NULL;
+    return dictGetRandomKey(db->dict[dbRandomSlot(db)]);
+}
+
+/* dictGetSomeKeys() for the whole keyspace: the keys are taken from
+ * randomly picked slots, as in dbGetRandomEntry(). */
+unsigned int dbGetSomeEntries(redisDb *db, dictEntry **des, unsigned int count) {
+    unsigned int stored = 0, j;
+
+    if (db->key_count == 0) return 0;
+    if (db->dict_count == 1) return dictGetSomeKeys(db->dict[0],des,count);
+    for (j = 0; j < count && stored < count; j++) {
+        dict *d = db->dict[dbRandomSlot(db)];
+        stored += dictGetSomeKeys(d,des+stored,count-stored);
+    }
+    return stored;
+}
+
+/* Return up to 'count' keys of the hash slot in DB 0, the only DB used by
+ * Redis Cluster. Without the per slot keyspace the whole DB is scanned. */
+unsigned int getKeysInSlot(unsigned int hashslot, robj **keys, unsigned int count) {
+    redisDb *db = server.db;
+    dict *d = db->dict[db->dict_count == 1 ? 0 : hashslot];
+    dictIterator *di;
+    dictEntry *de;
+    unsigned int j = 0;
+
+    if (d == NULL) return 0;
+    di = dictGetIterator(d);
+    while (j < count && (de = dictNext(di)) != NULL) {
+        sds key = dictGetKey(de);
+
+        if (db->dict_count == 1 && keyHashSlot(key,sdslen(key)) != hashslot)
+            continue;
+        keys[j++] = createStringObject(key,sdslen(key));
+    }
+    dictReleaseIterator(di);
+    return j;
+}
+
+unsigned int countKeysInSlot(unsigned int hashslot) {
+    redisDb *db = server.db;
+    dictIterator *di;
+    dictEntry *de;
+    unsigned int count = 0;
+
+    if (db->dict_count > 1)
+        return db->dict[hashslot] ? dictSize(db->dict[hashslot]) : 0;
+    di = dictGetIterator(db->dict[0]);
+    while ((de = dictNext(di)) != NULL) {
+        sds key = dictGetKey(de);
+
+        if (keyHashSlot(key,sdslen(key)) == hashslot) count++;
+    }
+    dictReleaseIterator(di);
+    return count;
+}
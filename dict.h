@@ -109,6 +109,8 @@ typedef void (dictScanFunction)(void *privdata, const dictEntry *de);
 #define dictSlots(d) ((d)->ht[0].size+(d)->ht[1].size)
 #define dictSize(d) ((d)->ht[0].used+(d)->ht[1].used)
 #define dictIsRehashing(d) ((d)->rehashidx != -1)
+#define dictPauseRehashing(d) ((d)->iterators++)
+#define dictResumeRehashing(d) ((d)->iterators--)
 
 /* API */
 dict *dictCreate(dictType *type, void *privDataPtr);
@@ -1,6 +1,7 @@
 #ifndef ENDIANCONV_H
 #define ENDIANCONV_H
 #include<stdlib.h>
+#include <stdint.h>
 
 void memrev16(void *p);
 void memrev32(void *p);
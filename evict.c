@@ -0,0 +1,528 @@
+/* Maxmemory directive handling (LRU and LFU eviction).
+ *
+ * When the memory used is over maxmemory, freeMemoryIfNeeded() evicts keys
+ * according to maxmemory-policy until it is under the limit again:
+ *
+ * - The LRU and LFU policies sample maxmemory-samples keys per DB, every
+ *   sampled key gets a score (higher is better to evict) and the best
+ *   candidates are kept in the DB eviction pool across calls, so that the
+ *   approximation gets closer to the real LRU/LFU as more keys are
+ *   sampled. The allkeys policies sample the main dictionary, the volatile
+ *   ones db->expires_index.
+ * - volatile-ttl evicts the key with the nearest timeout, that is exactly
+ *   the head of db->expires_index, with no sampling.
+ * - The random policies evict a random key.
+ *
+ * The LFU policies store an access frequency instead of the access time in
+ * the 24 lru bits of the value object:
+ *
+ *          16 bits      8 bits
+ *     +----------------+--------+
+ *     + Last decr time | LOG_C  |
+ *     +----------------+--------+
+ *
+ * LOG_C is a logarithmic counter (a Morris counter): it is incremented with
+ * probability 1/((counter-LFU_INIT_VAL)*lfu_log_factor+1), so 8 bits are
+ * enough to tell apart keys accessed a few times from keys accessed
+ * millions of times. New keys start at LFU_INIT_VAL so that they are not
+ * evicted before having a chance to be accessed. The counter is decremented
+ * by one every lfu_decay_time minutes of idle time, so keys that were hot
+ * in the past but are not accessed anymore end up being evicted. The last
+ * decrement time is in minutes, modulo 2^16.
+ *
+ * With maxmemory-admission on (allkeys-lru and allkeys-lfu only) a TinyLFU
+ * admission filter protects the cache from keys used once, such as scans:
+ * every key lookup is recorded in a frequency sketch (see freqsketch.c),
+ * and a key added while over maxmemory is kept only if it was accessed
+ * more often than the next key the eviction pool would evict. Otherwise
+ * the new key itself becomes the next key to evict. */
+
+#include "server.h"
+
+#define EVICTION_SAMPLES_ARRAY_SIZE 16
+
+/* ----------------------------------------------------------------------------
+ * LFU implementation
+ * --------------------------------------------------------------------------*/
+
+/* Return the current time in minutes, just taking the least significant
+ * 16 bits. The returned time is suitable to be stored as LDT (last
+ * decrement time) for the LFU implementation. */
+unsigned long LFUGetTimeInMinutes(void) {
+    return (server.unixtime/60) & 65535;
+}
+
+/* Given an object last decrement time, compute the minimum number of
+ * minutes that elapsed since the last decrement. Handle overflow (ldt
+ * greater than the current 16 bits minutes time) considering the time as
+ * wrapping exactly once. */
+unsigned long LFUTimeElapsed(unsigned long ldt) {
+    unsigned long now = LFUGetTimeInMinutes();
+
+    if (now >= ldt) return now-ldt;
+    return 65535-ldt+now;
+}
+
+/* Logarithmically increment a counter. The greater the current counter
+ * value, the less likely it is that it gets really incremented. Saturate
+ * it at 255. */
+uint8_t LFULogIncr(uint8_t counter) {
+    double r, baseval, p;
+
+    if (counter == 255) return 255;
+    r = (double)rand()/RAND_MAX;
+    baseval = counter - LFU_INIT_VAL;
+    if (baseval < 0) baseval = 0;
+    p = 1.0/(baseval*server.lfu_log_factor+1);
+    if (r < p) counter++;
+    return counter;
+}
+
+/* Return the counter of the object, decremented by the number of decay
+ * periods elapsed since its last access. The object is not modified: the
+ * new time and counter are stored by updateLFU() when the key is
+ * accessed. */
+unsigned long LFUDecrAndReturn(robj *o) {
+    unsigned long ldt = o->lru >> 8;
+    unsigned long counter = o->lru & 255;
+    unsigned long num_periods = server.lfu_decay_time ?
+        LFUTimeElapsed(ldt) / server.lfu_decay_time : 0;
+
+    if (num_periods)
+        counter = (num_periods > counter) ? 0 : counter - num_periods;
+    return counter;
+}
+
+/* Update the LFU fields of an object accessed by a command: decay the
+ * counter, then increment it. */
+void updateLFU(robj *val) {
+    unsigned long counter = LFUDecrAndReturn(val);
+
+    counter = LFULogIncr(counter);
+    val->lru = (LFUGetTimeInMinutes()<<8) | counter;
+}
+
+/* Initial value of the lru field of new objects, according to the policy. */
+unsigned int objectInitialLRU(void) {
+    if (server.maxmemory_policy & MAXMEMORY_FLAG_LFU)
+        return (LFUGetTimeInMinutes()<<8) | LFU_INIT_VAL;
+    return LRU_CLOCK();
+}
+
+/* ----------------------------------------------------------------------------
+ * Eviction pool
+ * --------------------------------------------------------------------------*/
+
+/* Create a new eviction pool. */
+struct evictionPoolEntry *evictionPoolAlloc(void) {
+    struct evictionPoolEntry *ep;
+    int j;
+
+    ep = zmalloc(sizeof(*ep)*MAXMEMORY_EVICTION_POOL_SIZE);
+    for (j = 0; j < MAXMEMORY_EVICTION_POOL_SIZE; j++) {
+        ep[j].idle = 0;
+        ep[j].key = NULL;
+    }
+    return ep;
+}
+
+/* The eviction score of a value, higher is better to evict: the idle time
+ * for LRU, the inverse of the frequency for LFU. */
+static unsigned long long evictionScore(robj *o) {
+    if (server.maxmemory_policy & MAXMEMORY_FLAG_LFU)
+        return 255-LFUDecrAndReturn(o);
+    return estimateObjectIdleTime(o);
+}
+
+/* Sample up to 'count' entries of the main dict of 'db' among the keys the
+ * policy may evict. The volatile keys are sampled by random rank in the
+ * expires index, that is O(log N) per key. Returns the number of entries
+ * stored in 'samples'. */
+static unsigned int evictionSample(redisDb *db, dictEntry **samples,
+                                   unsigned int count)
+{
+    unsigned long len = db->expires_index->length;
+    unsigned int j, found = 0;
+
+    if (server.maxmemory_policy & MAXMEMORY_FLAG_ALLKEYS)
+        return dbGetSomeEntries(db,samples,count);
+
+    for (j = 0; j < count && len; j++) {
+        zskiplistNode *ln =
+            zslGetElementByRank(db->expires_index,1+random()%len);
+        dictEntry *de = dbFind(db,ln->obj->ptr);
+
+        serverAssert(de != NULL);
+        samples[found++] = de;
+    }
+    return found;
+}
+
+/* This is an helper function for freeMemoryIfNeeded(), it is used in order
+ * to populate the evictionPool with a few entries every time we want to
+ * expire a key. Keys with a score greater than one of the current keys are
+ * added. Keys are always added if there are free entries.
+ *
+ * We insert keys on place in ascending order, so keys with the smaller
+ * score are on the left, and keys with the higher score on the right. */
+static void evictionPoolPopulate(redisDb *db, struct evictionPoolEntry *pool) {
+    dictEntry *_samples[EVICTION_SAMPLES_ARRAY_SIZE], **samples;
+    unsigned int count, j;
+    int k;
+
+    /* Try to use a static buffer: this function is a big hit...
+     * Note: it was actually measured that this helps. */
+    if (server.maxmemory_samples <= EVICTION_SAMPLES_ARRAY_SIZE) {
+        samples = _samples;
+    } else {
+        samples = zmalloc(sizeof(samples[0])*server.maxmemory_samples);
+    }
+
+    count = evictionSample(db,samples,server.maxmemory_samples);
+    for (j = 0; j < count; j++) {
+        unsigned long long idle;
+        sds key = dictGetKey(samples[j]);
+
+        idle = evictionScore(dictGetVal(samples[j]));
+
+        /* Insert the element inside the pool.
+         * First, find the first empty bucket or the first populated
+         * bucket that has a score smaller than our score. */
+        k = 0;
+        while (k < MAXMEMORY_EVICTION_POOL_SIZE &&
+               pool[k].key &&
+               pool[k].idle < idle) k++;
+        if (k == 0 && pool[MAXMEMORY_EVICTION_POOL_SIZE-1].key != NULL) {
+            /* Can't insert if the element is < the worst element we have
+             * and there are no empty buckets. */
+            continue;
+        } else if (k < MAXMEMORY_EVICTION_POOL_SIZE && pool[k].key == NULL) {
+            /* Inserting into empty position. No setup needed before insert. */
+        } else {
+            /* Inserting in the middle. Now k points to the first element
+             * greater than the element to insert.  */
+            if (pool[MAXMEMORY_EVICTION_POOL_SIZE-1].key == NULL) {
+                /* Free space on the right? Insert at k shifting
+                 * all the elements from k to end to the right. */
+                memmove(pool+k+1,pool+k,
+                    sizeof(pool[0])*(MAXMEMORY_EVICTION_POOL_SIZE-k-1));
+            } else {
+                /* No free space on right? Insert at k-1 */
+                k--;
+                /* Shift all elements on the left of k (included) to the
+                 * left, so we discard the element with the smaller score. */
+                sdsfree(pool[0].key);
+                memmove(pool,pool+1,sizeof(pool[0])*k);
+            }
+        }
+        pool[k].key = sdsdup(key);
+        pool[k].idle = idle;
+    }
+    if (samples != _samples) zfree(samples);
+}
+
+/* Pop from the pool the best key to evict that still exists in the DB.
+ * Returns the key, that the caller should free, or NULL. */
+static sds evictionPoolPop(redisDb *db, struct evictionPoolEntry *pool) {
+    int k;
+
+    /* Go backward from best to worst element to evict. */
+    for (k = MAXMEMORY_EVICTION_POOL_SIZE-1; k >= 0; k--) {
+        sds key = pool[k].key;
+        dictEntry *de;
+
+        if (key == NULL) continue;
+        de = dbFind(db,key);
+
+        /* Remove the entry from the pool. */
+        memmove(pool+k,pool+k+1,
+            sizeof(pool[0])*(MAXMEMORY_EVICTION_POOL_SIZE-k-1));
+        pool[MAXMEMORY_EVICTION_POOL_SIZE-1].key = NULL;
+        pool[MAXMEMORY_EVICTION_POOL_SIZE-1].idle = 0;
+
+        /* The key may have been deleted, or made persistent under a
+         * volatile policy, since it entered the pool. */
+        if (de && ((server.maxmemory_policy & MAXMEMORY_FLAG_ALLKEYS) ||
+                   getEntryExpire(de) != -1))
+        {
+            return key;
+        }
+        sdsfree(key);
+    }
+    return NULL;
+}
+
+/* Return the key the pool would evict next, without removing it, or NULL
+ * if the DB is empty. */
+static sds evictionPoolCandidate(redisDb *db) {
+    struct evictionPoolEntry *pool = db->eviction_pool;
+    int k;
+
+    if (db->key_count == 0) return NULL;
+    if (pool[0].key == NULL) evictionPoolPopulate(db,pool);
+    for (k = MAXMEMORY_EVICTION_POOL_SIZE-1; k >= 0; k--) {
+        if (pool[k].key && dbFind(db,pool[k].key))
+            return pool[k].key;
+    }
+    return NULL;
+}
+
+/* Put the key in the pool as the next key to evict. */
+static void evictionPoolPushVictim(redisDb *db, sds key) {
+    struct evictionPoolEntry *pool = db->eviction_pool;
+    int k = 0;
+
+    while (k < MAXMEMORY_EVICTION_POOL_SIZE && pool[k].key) k++;
+    if (k == MAXMEMORY_EVICTION_POOL_SIZE) {
+        /* Full: drop the worst candidate on the left. */
+        sdsfree(pool[0].key);
+        memmove(pool,pool+1,sizeof(pool[0])*(MAXMEMORY_EVICTION_POOL_SIZE-1));
+        k--;
+    }
+    pool[k].key = sdsdup(key);
+    pool[k].idle = ULLONG_MAX;
+}
+
+/* ----------------------------------------------------------------------------
+ * Admission filter
+ * --------------------------------------------------------------------------*/
+
+/* 64 bit hash of the key for the sketch and the miss ratio curve: FNV-1a,
+ * then the MurmurHash3 finalizer to spread the bits. */
+static uint64_t keyHash(const char *s, size_t len) {
+    uint64_t h = 14695981039346656037ULL;
+    size_t j;
+
+    for (j = 0; j < len; j++) {
+        h ^= (unsigned char)s[j];
+        h *= 1099511628211ULL;
+    }
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+    return h;
+}
+
+void admissionInit(void) {
+    server.admission_sketch = NULL;
+    if (!server.maxmemory_admission) return;
+    server.admission_sketch = freqSketchCreate(server.admission_sketch_width);
+}
+
+/* Record an access to the key, hit or miss. Called by the lookup functions
+ * when the admission filter is enabled. The sketch is not thread safe: the
+ * commands running in parallel are recorded by threadexecFinishJob(). */
+void admissionRecordAccess(robj *key) {
+    freqSketch *fs = server.admission_sketch;
+
+    if (threadexec_parallel) return;
+    freqSketchAdd(fs,keyHash(key->ptr,sdslen(key->ptr)));
+    if (freqSketchNeedsReset(fs)) freqSketchReset(fs);
+}
+
+/* Called by dbAdd() when the admission filter is enabled, after the key
+ * was added. If we are over maxmemory the new key competes with the next
+ * eviction candidate: it is admitted only if it is accessed more often,
+ * otherwise it is made the next key to evict and 1 is returned. */
+int admissionRejectKey(redisDb *db, robj *key) {
+    freqSketch *fs = server.admission_sketch;
+    unsigned int keyfreq, victimfreq;
+    sds victim;
+
+    if (!server.maxmemory ||
+        !(server.maxmemory_policy & MAXMEMORY_FLAG_ALLKEYS) ||
+        !(server.maxmemory_policy & (MAXMEMORY_FLAG_LRU|MAXMEMORY_FLAG_LFU)) ||
+        zmalloc_used_memory() <= server.maxmemory) return 0;
+
+    if ((victim = evictionPoolCandidate(db)) == NULL) return 0;
+    keyfreq = freqSketchEstimate(fs,keyHash(key->ptr,sdslen(key->ptr)));
+    victimfreq = freqSketchEstimate(fs,keyHash(victim,sdslen(victim)));
+    if (keyfreq > victimfreq) {
+        server.stat_admission_admitted++;
+        return 0;
+    }
+    evictionPoolPushVictim(db,key->ptr);
+    server.stat_admission_rejected++;
+    return 1;
+}
+
+/* ----------------------------------------------------------------------------
+ * Miss ratio curve
+ * --------------------------------------------------------------------------*/
+
+/* The hit ratio the keyspace would have as an LRU cache of a given number of
+ * keys, estimated from the live accesses with SHARDS (see mrc.c) within a
+ * budget of mrc_sample_keys keys: reads and writes of keys are accounted,
+ * most of them only cost the hash of the key. The MRC command reports the
+ * curve, with the memory of every cache size estimated from the average
+ * memory per key, to help sizing maxmemory. */
+
+void mrcInit(void) {
+    server.mrc = NULL;
+    if (!server.mrc_sample_keys) return;
+    server.mrc = mrcCreate(server.mrc_sample_keys);
+}
+
+/* Called by the lookup functions and by setKey() when the MRC is enabled.
+ * The accesses of the commands running in parallel are accounted by the
+ * main thread when the batch is done. */
+void mrcRecordAccess(robj *key) {
+    if (threadexec_parallel) return;
+    mrcAccess(server.mrc,keyHash(key->ptr,sdslen(key->ptr)));
+}
+
+/* MRC CURVE
+ * MRC RESET */
+void mrcCommand(client *c) {
+    if (server.mrc == NULL) {
+        addReplyError(c,"The miss ratio curve is disabled");
+    } else if (c->argc == 2 && !strcasecmp(c->argv[1]->ptr,"curve")) {
+        uint64_t sizes[MRC_BUCKETS];
+        double hits[MRC_BUCKETS], bytesperkey = 0;
+        unsigned long long keys = 0;
+        int points, j;
+
+        for (j = 0; j < server.dbnum; j++) keys += server.db[j].key_count;
+        if (keys) bytesperkey = (double)zmalloc_used_memory()/keys;
+        points = mrcCurve(server.mrc,sizes,hits);
+        addReplyMultiBulkLen(c,points);
+        for (j = 0; j < points; j++) {
+            addReplyMultiBulkLen(c,3);
+            addReplyLongLong(c,sizes[j]);
+            addReplyLongLong(c,(long long)(sizes[j]*bytesperkey));
+            addReplyDouble(c,hits[j]);
+        }
+    } else if (c->argc == 2 && !strcasecmp(c->argv[1]->ptr,"reset")) {
+        mrcReset(server.mrc);
+        addReply(c,shared.ok);
+    } else {
+        addReplyError(c,
+            "Unknown MRC subcommand or wrong # of args. Try CURVE, RESET.");
+    }
+}
+
+/* ----------------------------------------------------------------------------
+ * Eviction
+ * --------------------------------------------------------------------------*/
+
+/* Select the key of 'db' to evict according to the policy. Returns an sds
+ * the caller should free, or NULL if there is nothing to evict in the DB. */
+static sds evictionSelectKey(redisDb *db) {
+    int policy = server.maxmemory_policy;
+    zskiplistNode *ln;
+    dictEntry *de;
+
+    if (policy & (MAXMEMORY_FLAG_LRU|MAXMEMORY_FLAG_LFU)) {
+        sds key;
+
+        /* Refill the pool until it gives a key, the sampled keys may have
+         * been deleted in the meantime. */
+        while (1) {
+            if (policy & MAXMEMORY_FLAG_ALLKEYS) {
+                if (db->key_count == 0) return NULL;
+            } else {
+                if (db->expires_index->length == 0) return NULL;
+            }
+            evictionPoolPopulate(db,db->eviction_pool);
+            if ((key = evictionPoolPop(db,db->eviction_pool)) != NULL)
+                return key;
+        }
+    } else if (policy == MAXMEMORY_ALLKEYS_RANDOM) {
+        if ((de = dbGetRandomEntry(db)) == NULL) return NULL;
+        return sdsdup(dictGetKey(de));
+    } else if (policy == MAXMEMORY_VOLATILE_RANDOM) {
+        unsigned long len = db->expires_index->length;
+
+        if (len == 0) return NULL;
+        ln = zslGetElementByRank(db->expires_index,1+random()%len);
+        return sdsdup(ln->obj->ptr);
+    } else if (policy == MAXMEMORY_VOLATILE_TTL) {
+        /* The nearest timeout is the head of the index. */
+        if ((ln = db->expires_index->header->level[0].forward) == NULL)
+            return NULL;
+        return sdsdup(ln->obj->ptr);
+    }
+    return NULL;
+}
+
+/* This function is periodically called to see if there is memory to free
+ * according to the current "maxmemory" settings. In case we are over the
+ * memory limit, the function will try to free some memory to return back
+ * under the limit.
+ *
+ * The function returns C_OK if we are under the memory limit or if we
+ * were over the limit, but the attempt to free memory was successful.
+ * Otehrwise if we are over the memory limit, but not enough memory
+ * was freed to return back under the limit, the function returns C_ERR. */
+int freeMemoryIfNeeded(void) {
+    size_t mem_used, mem_tofree, mem_freed;
+    int slaves = listLength(server.slaves);
+
+    /* Remove the size of slaves output buffers from the count of used
+     * memory: they grow as keys are deleted and propagated. */
+    mem_used = zmalloc_used_memory();
+    if (slaves) {
+        listIter li;
+        listNode *ln;
+
+        listRewind(server.slaves,&li);
+        while((ln = listNext(&li))) {
+            client *slave = listNodeValue(ln);
+            unsigned long obuf_bytes = getClientOutputBufferMemoryUsage(slave);
+            if (obuf_bytes > mem_used)
+                mem_used = 0;
+            else
+                mem_used -= obuf_bytes;
+        }
+    }
+
+    /* Check if we are over the memory limit. */
+    if (mem_used <= server.maxmemory) return C_OK;
+
+    if (server.maxmemory_policy == MAXMEMORY_NO_EVICTION)
+        return C_ERR; /* We need to free memory, but policy forbids. */
+
+    /* Compute how much memory we need to free. */
+    mem_tofree = mem_used - server.maxmemory;
+    mem_freed = 0;
+    while (mem_freed < mem_tofree) {
+        int j, keys_freed = 0;
+
+        for (j = 0; j < server.dbnum; j++) {
+            redisDb *db = server.db+j;
+            long long delta;
+            robj *keyobj;
+            sds bestkey;
+
+            if ((bestkey = evictionSelectKey(db)) == NULL) continue;
+
+            keyobj = createStringObject(bestkey,sdslen(bestkey));
+            sdsfree(bestkey);
+            propagateExpire(db,keyobj);
+            /* We compute the amount of memory freed by dbDelete() alone.
+             * It is possible that actually the memory needed to propagate
+             * the DEL in AOF and replication link is greater than the one
+             * we are freeing removing the key, but we can't account for
+             * that otherwise we would never exit the loop. */
+            delta = (long long) zmalloc_used_memory();
+            dbDelete(db,keyobj);
+            delta -= (long long) zmalloc_used_memory();
+            mem_freed += delta;
+            server.stat_evictedkeys++;
+            notifyKeyspaceEvent(NOTIFY_EVICTED, "evicted",
+                keyobj, db->id);
+            decrRefCount(keyobj);
+            keys_freed++;
+
+            /* When the memory to free starts to be big enough, we may
+             * start spending so much time here that is impossible to
+             * deliver data to the slaves fast enough, so we force the
+             * transmission here inside the loop. */
+            if (slaves) flushSlavesOutputBuffers();
+        }
+        if (!keys_freed) return C_ERR; /* nothing to free... */
+    }
+    return C_OK;
+}
@@ -0,0 +1,351 @@
+/* evictsim -- compare the hit ratio of the eviction policies.
+ *
+ * Usage: evictsim [-keys N] [-cache N] [-requests N] [-alpha A]
+ *                 [-shift N] [-scan-ratio R] [-rate N] [-samples N]
+ *                 [-log-factor N] [-decay-time N] [-sketch-width N]
+ *                 [-seed N]
+ *
+ * A cache of 'cache' keys is fed with 'requests' GETs of keys taken from a
+ * Zipfian distribution of parameter 'alpha' over 'keys' keys, and a miss
+ * is followed by a SET of the key, that evicts a key when the cache is
+ * full. Every 'shift' requests (0 = never) the popularity ranks move to
+ * other keys, to model hot sets that change over time. A fraction
+ * 'scan-ratio' of the requests instead reads the next key of a sequential
+ * scan over 10 times 'keys' other keys, that pollutes the cache with keys
+ * used once. The hit ratio is the one of the Zipfian requests. The clock
+ * advances by 1/'rate' seconds per request, since the LRU clock has a
+ * resolution of one second and the LFU decay works in minutes.
+ *
+ * The simulated policies mirror evict.c: the approximated LRU and LFU
+ * sample 'samples' keys per eviction and keep the best candidates in an
+ * eviction pool, LFU uses the same logarithmic counter with decay. The
+ * "+tinylfu" variants add the admission filter, with the same frequency
+ * sketch (freqsketch.c): on a miss with the cache full the key is cached
+ * only if it is more frequent than the eviction candidate. Exact LRU and
+ * random eviction are reported as references. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "freqsketch.h"
+
+#define POOL_SIZE 16
+#define LFU_INIT_VAL 5
+
+enum { SIM_LRU_EXACT, SIM_LRU, SIM_LFU, SIM_RANDOM, SIM_LRU_TINYLFU,
+       SIM_LFU_TINYLFU, SIM_POLICIES };
+static const char *policy_names[SIM_POLICIES] = {
+    "lru (exact)", "allkeys-lru", "allkeys-lfu", "allkeys-random",
+    "allkeys-lru+tinylfu", "allkeys-lfu+tinylfu"
+};
+
+static long numkeys = 100000, cachesize = 10000, requests = 10000000;
+static long shift = 0, rate = 100000, samples = 5;
+static long log_factor = 10, decay_time = 1, seed = 1234;
+static long sketch_width = 0;   /* Default: the cache size. */
+static double alpha = 1.0, scan_ratio = 0;
+static long totalkeys;          /* Zipfian keys plus scanned keys. */
+
+static double *cdf;             /* Zipf cumulative distribution by rank. */
+static long *rank2key;          /* Key at every popularity rank. */
+
+/* Simulated cache. */
+static long *cached;            /* Keys in the cache, for random sampling. */
+static long *pos;               /* Index of every key in cached[], or -1. */
+static long numcached;
+static unsigned long *lru;      /* LRU clock (seconds) or LFU ldt<<8|counter. */
+static long *prev, *next, head, tail;  /* Exact LRU list, most recent first. */
+static struct { long key; unsigned long long score; } pool[POOL_SIZE];
+
+static double now;              /* Simulated time in seconds. */
+static freqSketch *sketch;      /* Access frequency for admission. */
+
+static void die(const char *msg) {
+    fprintf(stderr,"evictsim: %s\n",msg);
+    exit(1);
+}
+
+static double uniform(void) {
+    return (double)rand()/((double)RAND_MAX+1);
+}
+
+static void zipfInit(void) {
+    double sum = 0;
+    long j;
+
+    cdf = malloc(sizeof(double)*numkeys);
+    rank2key = malloc(sizeof(long)*numkeys);
+    for (j = 0; j < numkeys; j++) {
+        sum += 1.0/pow(j+1,alpha);
+        cdf[j] = sum;
+        rank2key[j] = j;
+    }
+    for (j = 0; j < numkeys; j++) cdf[j] /= sum;
+}
+
+/* Move the popularity ranks to other keys. */
+static void zipfShift(void) {
+    long j;
+
+    for (j = numkeys-1; j > 0; j--) {
+        long k = rand() % (j+1), t = rank2key[j];
+
+        rank2key[j] = rank2key[k];
+        rank2key[k] = t;
+    }
+}
+
+static long zipfNext(void) {
+    double r = uniform();
+    long lo = 0, hi = numkeys-1;
+
+    while (lo < hi) {
+        long mid = (lo+hi)/2;
+
+        if (cdf[mid] < r) lo = mid+1; else hi = mid;
+    }
+    return rank2key[lo];
+}
+
+/* ----------------------------------------------------------------------------
+ * Policies, see evict.c
+ * --------------------------------------------------------------------------*/
+
+static unsigned long lfuTimeInMinutes(void) {
+    return ((unsigned long)now/60) & 65535;
+}
+
+static unsigned long lfuDecrAndReturn(unsigned long v) {
+    unsigned long ldt = v >> 8, counter = v & 255, cur = lfuTimeInMinutes();
+    unsigned long elapsed = cur >= ldt ? cur-ldt : 65535-ldt+cur;
+    unsigned long periods = decay_time ? elapsed/decay_time : 0;
+
+    if (periods) counter = periods > counter ? 0 : counter-periods;
+    return counter;
+}
+
+static unsigned long lfuLogIncr(unsigned long counter) {
+    double baseval = (double)counter-LFU_INIT_VAL;
+
+    if (counter == 255) return 255;
+    if (baseval < 0) baseval = 0;
+    if (uniform() < 1.0/(baseval*log_factor+1)) counter++;
+    return counter;
+}
+
+static unsigned long long score(int policy, long key) {
+    if (policy == SIM_LFU) return 255-lfuDecrAndReturn(lru[key]);
+    return (unsigned long)now - lru[key];
+}
+
+static void touch(int policy, long key, int created) {
+    if (policy == SIM_LFU) {
+        unsigned long counter = created ? LFU_INIT_VAL :
+            lfuLogIncr(lfuDecrAndReturn(lru[key]));
+        lru[key] = (lfuTimeInMinutes()<<8) | counter;
+    } else {
+        lru[key] = (unsigned long)now;
+    }
+    if (policy == SIM_LRU_EXACT) {
+        if (!created) {
+            if (prev[key] != -1) next[prev[key]] = next[key];
+            else head = next[key];
+            if (next[key] != -1) prev[next[key]] = prev[key];
+            else tail = prev[key];
+        }
+        prev[key] = -1;
+        next[key] = head;
+        if (head != -1) prev[head] = key;
+        head = key;
+        if (tail == -1) tail = key;
+    }
+}
+
+/* Same insertion as evictionPoolPopulate(). */
+static void poolPopulate(int policy) {
+    long j;
+    int k;
+
+    for (j = 0; j < samples; j++) {
+        long key = cached[rand() % numcached];
+        unsigned long long s = score(policy,key);
+
+        k = 0;
+        while (k < POOL_SIZE && pool[k].key != -1 && pool[k].score < s) k++;
+        if (k == 0 && pool[POOL_SIZE-1].key != -1) {
+            continue;
+        } else if (k < POOL_SIZE && pool[k].key == -1) {
+            /* Empty bucket. */
+        } else if (pool[POOL_SIZE-1].key == -1) {
+            memmove(pool+k+1,pool+k,sizeof(pool[0])*(POOL_SIZE-k-1));
+        } else {
+            k--;
+            memmove(pool,pool+1,sizeof(pool[0])*k);
+        }
+        pool[k].key = key;
+        pool[k].score = s;
+    }
+}
+
+/* The key poolPop() would return, without removing it. */
+static long poolCandidate(int policy) {
+    int k;
+
+    if (pool[0].key == -1) poolPopulate(policy);
+    for (k = POOL_SIZE-1; k >= 0; k--)
+        if (pool[k].key != -1 && pos[pool[k].key] != -1) return pool[k].key;
+    return -1;
+}
+
+static uint64_t keyHash(long key) {
+    uint64_t h = key;
+
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+    return h;
+}
+
+/* Return 1 if the key should be cached, evicting the candidate. */
+static int admit(int policy, long key) {
+    long victim = poolCandidate(policy);
+
+    if (victim == -1) return 1;
+    return freqSketchEstimate(sketch,keyHash(key)) >
+           freqSketchEstimate(sketch,keyHash(victim));
+}
+
+static long poolPop(void) {
+    int k;
+
+    for (k = POOL_SIZE-1; k >= 0; k--) {
+        long key = pool[k].key;
+
+        if (key == -1) continue;
+        memmove(pool+k,pool+k+1,sizeof(pool[0])*(POOL_SIZE-k-1));
+        pool[POOL_SIZE-1].key = -1;
+        if (pos[key] != -1) return key;
+    }
+    return -1;
+}
+
+static void evict(int policy) {
+    long key = -1;
+
+    if (policy == SIM_LRU_EXACT) {
+        key = tail;
+        tail = prev[key];
+        if (tail != -1) next[tail] = -1; else head = -1;
+    } else if (policy == SIM_RANDOM) {
+        key = cached[rand() % numcached];
+    } else {
+        while (key == -1) {
+            poolPopulate(policy);
+            key = poolPop();
+        }
+    }
+    cached[pos[key]] = cached[--numcached];
+    pos[cached[pos[key]]] = pos[key];
+    pos[key] = -1;
+}
+
+static double simulate(int policy) {
+    long j, hits = 0, lookups = 0, scanned = 0;
+    int admission = 0;
+
+    if (policy == SIM_LRU_TINYLFU || policy == SIM_LFU_TINYLFU) {
+        admission = 1;
+        policy = policy == SIM_LRU_TINYLFU ? SIM_LRU : SIM_LFU;
+        sketch = freqSketchCreate(sketch_width ? sketch_width : cachesize);
+    }
+    srand(seed);
+    zipfInit();
+    numcached = 0;
+    head = tail = -1;
+    now = 0;
+    for (j = 0; j < totalkeys; j++) pos[j] = -1;
+    for (j = 0; j < POOL_SIZE; j++) pool[j].key = -1;
+
+    for (j = 0; j < requests; j++) {
+        long key;
+        int scan = scan_ratio > 0 && uniform() < scan_ratio;
+
+        if (shift && j && j % shift == 0) zipfShift();
+        if (scan) {
+            key = numkeys + scanned++ % (totalkeys-numkeys);
+        } else {
+            key = zipfNext();
+            lookups++;
+        }
+        now += 1.0/rate;
+        if (admission) {
+            freqSketchAdd(sketch,keyHash(key));
+            if (freqSketchNeedsReset(sketch)) freqSketchReset(sketch);
+        }
+        if (pos[key] != -1) {
+            if (!scan) hits++;
+            touch(policy,key,0);
+            continue;
+        }
+        if (numcached == cachesize) {
+            if (admission && !admit(policy,key)) continue;
+            evict(policy);
+        }
+        pos[key] = numcached;
+        cached[numcached++] = key;
+        touch(policy,key,1);
+    }
+    free(cdf);
+    free(rank2key);
+    if (admission) freqSketchFree(sketch);
+    return lookups ? (double)hits/lookups : 0;
+}
+
+int main(int argc, char **argv) {
+    int j;
+
+    for (j = 1; j < argc; j++) {
+        char *opt = argv[j];
+        double val;
+
+        if (j+1 == argc) die("missing option value");
+        val = atof(argv[++j]);
+        if (!strcmp(opt,"-keys")) numkeys = val;
+        else if (!strcmp(opt,"-cache")) cachesize = val;
+        else if (!strcmp(opt,"-requests")) requests = val;
+        else if (!strcmp(opt,"-alpha")) alpha = val;
+        else if (!strcmp(opt,"-shift")) shift = val;
+        else if (!strcmp(opt,"-scan-ratio")) scan_ratio = val;
+        else if (!strcmp(opt,"-sketch-width")) sketch_width = val;
+        else if (!strcmp(opt,"-rate")) rate = val;
+        else if (!strcmp(opt,"-samples")) samples = val;
+        else if (!strcmp(opt,"-log-factor")) log_factor = val;
+        else if (!strcmp(opt,"-decay-time")) decay_time = val;
+        else if (!strcmp(opt,"-seed")) seed = val;
+        else die("unknown option");
+    }
+    if (numkeys <= 0 || cachesize <= 0 || cachesize > numkeys ||
+        requests <= 0 || rate <= 0 || samples <= 0 ||
+        scan_ratio < 0 || scan_ratio >= 1)
+        die("invalid options");
+
+    totalkeys = numkeys*11;
+    pos = malloc(sizeof(long)*totalkeys);
+    cached = malloc(sizeof(long)*cachesize);
+    lru = malloc(sizeof(unsigned long)*totalkeys);
+    prev = malloc(sizeof(long)*totalkeys);
+    next = malloc(sizeof(long)*totalkeys);
+
+    printf("keys=%ld cache=%ld requests=%ld alpha=%.2f shift=%ld "
+           "scan-ratio=%.2f rate=%ld samples=%ld log-factor=%ld "
+           "decay-time=%ld\n",
+           numkeys, cachesize, requests, alpha, shift, scan_ratio, rate,
+           samples, log_factor, decay_time);
+    for (j = 0; j < SIM_POLICIES; j++)
+        printf("%-20s hit ratio %.4f\n", policy_names[j], simulate(j));
+    return 0;
+}
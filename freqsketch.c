@@ -0,0 +1,127 @@
+/* Approximate access frequency of keys, as used by TinyLFU.
+ *
+ * A count-min sketch of FREQSKETCH_DEPTH rows of 4 bit counters, two per
+ * byte, estimates how many times a key was added: the estimate is the
+ * minimum of the counters the key hashes to, that can only overestimate.
+ * In front of it a doorkeeper Bloom filter absorbs the first occurrence of
+ * every key, so the many keys seen only once (scans, one hit wonders) don't
+ * use counters: a key is counted by the sketch only from its second
+ * occurrence, and the doorkeeper adds one to the estimate of the keys it
+ * contains.
+ *
+ * The sketch tracks recent history only: after sample_size additions (ten
+ * times the width) every counter is halved and the doorkeeper is cleared.
+ *
+ * The caller passes a 64 bit hash of the key. Additions and estimates can
+ * run concurrently from multiple threads (counters are updated atomically,
+ * an increment may be lost under contention), but freqSketchReset() must
+ * run alone. */
+
+#include <string.h>
+#include "freqsketch.h"
+#include "zmalloc.h"
+
+/* Index of the counter of the key in row 'i', by double hashing. */
+static inline uint64_t counterIndex(freqSketch *fs, uint64_t hash, int i) {
+    uint64_t h1 = hash & 0xffffffff, h2 = (hash >> 32) | 1;
+
+    return (uint64_t)i*fs->width + ((h1 + i*h2) & (fs->width-1));
+}
+
+static inline uint64_t doorkeeperIndex(freqSketch *fs, uint64_t hash, int i) {
+    uint64_t h1 = hash >> 32, h2 = (hash & 0xffffffff) | 1;
+
+    return (h1 + i*h2) & (fs->dkbits-1);
+}
+
+static inline unsigned int counterGet(freqSketch *fs, uint64_t idx) {
+    unsigned char byte = __atomic_load_n(fs->counters+idx/2,__ATOMIC_RELAXED);
+
+    return (idx & 1) ? byte >> 4 : byte & 0xf;
+}
+
+/* Increment the counter unless saturated. */
+static inline void counterIncr(freqSketch *fs, uint64_t idx) {
+    unsigned char *p = fs->counters+idx/2;
+    unsigned char old = __atomic_load_n(p,__ATOMIC_RELAXED), new;
+    int shift = (idx & 1) ? 4 : 0;
+
+    do {
+        if (((old >> shift) & 0xf) == FREQSKETCH_MAX) return;
+        new = old + (1 << shift);
+    } while (!__atomic_compare_exchange_n(p,&old,new,1,
+                 __ATOMIC_RELAXED,__ATOMIC_RELAXED));
+}
+
+/* Create a sketch of 'width' counters per row, rounded to a power of two.
+ * The doorkeeper has 8 bits per counter of a row. */
+freqSketch *freqSketchCreate(uint64_t width) {
+    freqSketch *fs = zmalloc(sizeof(*fs));
+    uint64_t w = 16;
+
+    while (w < width) w <<= 1;
+    fs->width = w;
+    fs->dkbits = w*8;
+    fs->counters = zcalloc(FREQSKETCH_DEPTH*w/2);
+    fs->doorkeeper = zcalloc(fs->dkbits/8);
+    fs->samples = 0;
+    fs->sample_size = w*10;
+    fs->resets = 0;
+    return fs;
+}
+
+void freqSketchFree(freqSketch *fs) {
+    zfree(fs->counters);
+    zfree(fs->doorkeeper);
+    zfree(fs);
+}
+
+/* Record an occurrence of the key. */
+void freqSketchAdd(freqSketch *fs, uint64_t hash) {
+    uint64_t b0 = doorkeeperIndex(fs,hash,0), b1 = doorkeeperIndex(fs,hash,1);
+    unsigned char m0 = 1 << (b0 & 7), m1 = 1 << (b1 & 7);
+    int i, seen;
+
+    __atomic_add_fetch(&fs->samples,1,__ATOMIC_RELAXED);
+    seen = (__atomic_fetch_or(fs->doorkeeper+b0/8,m0,__ATOMIC_RELAXED) & m0) &&
+           (__atomic_fetch_or(fs->doorkeeper+b1/8,m1,__ATOMIC_RELAXED) & m1);
+    if (!seen) return;
+    for (i = 0; i < FREQSKETCH_DEPTH; i++)
+        counterIncr(fs,counterIndex(fs,hash,i));
+}
+
+/* Estimate the occurrences of the key since the last reset, up to
+ * FREQSKETCH_MAX+1. */
+unsigned int freqSketchEstimate(freqSketch *fs, uint64_t hash) {
+    uint64_t b0 = doorkeeperIndex(fs,hash,0), b1 = doorkeeperIndex(fs,hash,1);
+    unsigned int min = FREQSKETCH_MAX;
+    int i;
+
+    if (!(__atomic_load_n(fs->doorkeeper+b0/8,__ATOMIC_RELAXED) & (1<<(b0&7))) ||
+        !(__atomic_load_n(fs->doorkeeper+b1/8,__ATOMIC_RELAXED) & (1<<(b1&7))))
+        return 0;
+    for (i = 0; i < FREQSKETCH_DEPTH; i++) {
+        unsigned int c = counterGet(fs,counterIndex(fs,hash,i));
+        if (c < min) min = c;
+    }
+    return min+1;
+}
+
+int freqSketchNeedsReset(freqSketch *fs) {
+    return __atomic_load_n(&fs->samples,__ATOMIC_RELAXED) >= fs->sample_size;
+}
+
+/* Age the sketch: halve all the counters and clear the doorkeeper. */
+void freqSketchReset(freqSketch *fs) {
+    size_t j, len = FREQSKETCH_DEPTH*fs->width/2;
+
+    for (j = 0; j < len; j++)
+        fs->counters[j] = (fs->counters[j] >> 1) & 0x77;
+    memset(fs->doorkeeper,0,fs->dkbits/8);
+    fs->samples /= 2;
+    fs->resets++;
+}
+
+size_t freqSketchMemory(freqSketch *fs) {
+    return sizeof(*fs) + FREQSKETCH_DEPTH*fs->width/2 + fs->dkbits/8;
+}
@@ -0,0 +1,27 @@
+#ifndef __FREQSKETCH_H
+#define __FREQSKETCH_H
+#include <stdint.h>
+#include <stddef.h>
+
+#define FREQSKETCH_DEPTH 4      /* Rows of the count-min sketch. */
+#define FREQSKETCH_MAX 15       /* Counters are 4 bits. */
+
+typedef struct freqSketch {
+    unsigned char *counters;    /* DEPTH rows of 'width' 4 bit counters. */
+    unsigned char *doorkeeper;  /* Bloom filter of the keys seen once. */
+    uint64_t width;             /* Counters per row, power of two. */
+    uint64_t dkbits;            /* Doorkeeper bits, power of two. */
+    uint64_t samples;           /* Additions since the last reset. */
+    uint64_t sample_size;       /* Additions between two resets. */
+    unsigned long long resets;  /* Number of resets done. */
+} freqSketch;
+
+freqSketch *freqSketchCreate(uint64_t width);
+void freqSketchFree(freqSketch *fs);
+void freqSketchAdd(freqSketch *fs, uint64_t hash);
+unsigned int freqSketchEstimate(freqSketch *fs, uint64_t hash);
+int freqSketchNeedsReset(freqSketch *fs);
+void freqSketchReset(freqSketch *fs);
+size_t freqSketchMemory(freqSketch *fs);
+
+#endif
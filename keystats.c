@@ -0,0 +1,413 @@
+/* Hot keys and big keys.
+ *
+ * Hot keys are found with the space saving algorithm: a fixed number of
+ * keys is tracked with a counter. An access to a tracked key increments its
+ * counter, otherwise the key replaces the tracked key with the smallest
+ * counter, inheriting it plus one, and remembers the inherited part as the
+ * maximum overestimation of its count. A key accessed more than 1/capacity
+ * of the times is always tracked. Lookups are sampled: one every
+ * hotkeys_sample_rate (on average, the interval is randomized) is counted,
+ * so the counts are scaled back by the rate when reported. Every
+ * KEYSTATS_DECAY_SAMPLES samples the counts are halved, so that keys that
+ * were hot a long time ago fade out.
+ *
+ * Big keys are the largest keys of every type, a min-heap per type of
+ * bigkeys_capacity keys, measured when a value is stored with dbAdd() or
+ * dbOverwrite(): the length of strings, the number of elements of the other
+ * types. A key leaves the heap when deleted, or when its DB is emptied.
+ *
+ * Both structures are a min-heap of entries, so that the smallest one,
+ * candidate for replacement, is found in O(1), plus a dict from the
+ * (db,key) pair to the entry. */
+
+#include "server.h"
+
+#define KEYSTATS_TYPES (OBJ_HASH+1)
+#define KEYSTATS_DECAY_SAMPLES 100000
+
+typedef struct keystatsEntry {
+    sds key;
+    int dbid;
+    int pos;                    /* Position in the heap. */
+    int type;                   /* Big keys: type of the value. */
+    unsigned long long weight;  /* Sampled accesses, or size. */
+    unsigned long long error;   /* Maximum overestimation of the accesses. */
+} keystatsEntry;
+
+typedef struct keystatsHeap {
+    keystatsEntry **entries;    /* Min-heap by weight. */
+    int len, capacity;
+    dict *index;                /* keystatsEntry -> NULL, by (dbid,key). */
+} keystatsHeap;
+
+static keystatsHeap *hotkeys;
+static keystatsHeap *bigkeys[KEYSTATS_TYPES];
+static long hotkeys_countdown;
+static long hotkeys_samples;
+
+static const char *keystatsTypeNames[KEYSTATS_TYPES] = {
+    "string", "list", "set", "zset", "hash"
+};
+
+static unsigned int keystatsEntryHash(const void *key) {
+    const keystatsEntry *e = key;
+
+    return dictGenHashFunction(e->key,sdslen(e->key)) ^ (e->dbid*0x9e3779b1);
+}
+
+static int keystatsEntryCompare(void *privdata, const void *key1,
+                                const void *key2)
+{
+    const keystatsEntry *e1 = key1, *e2 = key2;
+
+    DICT_NOTUSED(privdata);
+    return e1->dbid == e2->dbid && sdslen(e1->key) == sdslen(e2->key) &&
+           memcmp(e1->key,e2->key,sdslen(e1->key)) == 0;
+}
+
+/* The entries are owned by the heap, the dict only indexes them. */
+static dictType keystatsDictType = {
+    keystatsEntryHash,          /* hash function */
+    NULL,                       /* key dup */
+    NULL,                       /* val dup */
+    keystatsEntryCompare,       /* key compare */
+    NULL,                       /* key destructor */
+    NULL                        /* val destructor */
+};
+
+/*-----------------------------------------------------------------------------
+ * Heap of entries
+ *----------------------------------------------------------------------------*/
+
+static keystatsHeap *keystatsHeapCreate(int capacity) {
+    keystatsHeap *h = zmalloc(sizeof(*h));
+
+    h->entries = zmalloc(sizeof(keystatsEntry*)*capacity);
+    h->len = 0;
+    h->capacity = capacity;
+    h->index = dictCreate(&keystatsDictType,NULL);
+    return h;
+}
+
+static void keystatsHeapSet(keystatsHeap *h, int pos, keystatsEntry *e) {
+    h->entries[pos] = e;
+    e->pos = pos;
+}
+
+static void keystatsHeapUp(keystatsHeap *h, int pos) {
+    keystatsEntry *e = h->entries[pos];
+
+    while (pos > 0) {
+        int parent = (pos-1)/2;
+
+        if (h->entries[parent]->weight <= e->weight) break;
+        keystatsHeapSet(h,pos,h->entries[parent]);
+        pos = parent;
+    }
+    keystatsHeapSet(h,pos,e);
+}
+
+static void keystatsHeapDown(keystatsHeap *h, int pos) {
+    keystatsEntry *e = h->entries[pos];
+
+    while (1) {
+        int child = pos*2+1;
+
+        if (child >= h->len) break;
+        if (child+1 < h->len &&
+            h->entries[child+1]->weight < h->entries[child]->weight)
+            child++;
+        if (e->weight <= h->entries[child]->weight) break;
+        keystatsHeapSet(h,pos,h->entries[child]);
+        pos = child;
+    }
+    keystatsHeapSet(h,pos,e);
+}
+
+/* Return the entry of the key, or NULL if it is not tracked. */
+static keystatsEntry *keystatsHeapFind(keystatsHeap *h, int dbid, sds key) {
+    keystatsEntry probe;
+    dictEntry *de;
+
+    if (h->len == 0) return NULL;
+    probe.key = key;
+    probe.dbid = dbid;
+    de = dictFind(h->index,&probe);
+    return de ? dictGetKey(de) : NULL;
+}
+
+static keystatsEntry *keystatsHeapAdd(keystatsHeap *h, int dbid, sds key,
+                                      unsigned long long weight,
+                                      unsigned long long error)
+{
+    keystatsEntry *e = zmalloc(sizeof(*e));
+
+    e->key = sdsdup(key);
+    e->dbid = dbid;
+    e->weight = weight;
+    e->error = error;
+    e->type = -1;
+    dictAdd(h->index,e,NULL);
+    keystatsHeapSet(h,h->len++,e);
+    keystatsHeapUp(h,e->pos);
+    return e;
+}
+
+/* Give the minimum entry to another key, which is then moved to its
+ * place in the heap by its new weight. */
+static keystatsEntry *keystatsHeapReplaceMin(keystatsHeap *h, int dbid,
+                                             sds key,
+                                             unsigned long long weight,
+                                             unsigned long long error)
+{
+    keystatsEntry *e = h->entries[0];
+
+    dictDelete(h->index,e);
+    sdsfree(e->key);
+    e->key = sdsdup(key);
+    e->dbid = dbid;
+    e->weight = weight;
+    e->error = error;
+    dictAdd(h->index,e,NULL);
+    keystatsHeapDown(h,0);
+    return e;
+}
+
+static void keystatsHeapDelete(keystatsHeap *h, keystatsEntry *e) {
+    int pos = e->pos;
+
+    dictDelete(h->index,e);
+    h->len--;
+    if (pos != h->len) {
+        keystatsEntry *last = h->entries[h->len];
+
+        keystatsHeapSet(h,pos,last);
+        keystatsHeapUp(h,pos);
+        keystatsHeapDown(h,last->pos);
+    }
+    sdsfree(e->key);
+    zfree(e);
+}
+
+/* Delete the entries of 'dbid', or all of them if -1, then rebuild the
+ * heap with the others. */
+static void keystatsHeapEmpty(keystatsHeap *h, int dbid) {
+    int j, kept = 0;
+
+    for (j = 0; j < h->len; j++) {
+        keystatsEntry *e = h->entries[j];
+
+        if (dbid != -1 && e->dbid != dbid) {
+            keystatsHeapSet(h,kept++,e);
+            continue;
+        }
+        dictDelete(h->index,e);
+        sdsfree(e->key);
+        zfree(e);
+    }
+    h->len = kept;
+    for (j = h->len/2-1; j >= 0; j--) keystatsHeapDown(h,j);
+}
+
+static int keystatsEntryCompareWeight(const void *a, const void *b) {
+    const keystatsEntry *e1 = *(keystatsEntry**)a, *e2 = *(keystatsEntry**)b;
+
+    if (e1->weight == e2->weight) return 0;
+    return e1->weight > e2->weight ? -1 : 1;
+}
+
+/* Fill 'out' with the entries sorted by decreasing weight, returning
+ * their number. */
+static int keystatsHeapSorted(keystatsHeap *h, keystatsEntry **out) {
+    memcpy(out,h->entries,sizeof(keystatsEntry*)*h->len);
+    qsort(out,h->len,sizeof(keystatsEntry*),keystatsEntryCompareWeight);
+    return h->len;
+}
+
+/*-----------------------------------------------------------------------------
+ * Tracking
+ *----------------------------------------------------------------------------*/
+
+void keystatsInit(void) {
+    int j;
+
+    hotkeys = keystatsHeapCreate(server.hotkeys_capacity);
+    for (j = 0; j < KEYSTATS_TYPES; j++)
+        bigkeys[j] = keystatsHeapCreate(server.bigkeys_capacity);
+    hotkeys_countdown = 0;
+    hotkeys_samples = 0;
+}
+
+/* Called by the key lookups when server.hotkeys_sample_rate is not zero.
+ * Only the main thread samples: the commands executed by the threads are
+ * counted by threadexec.c once the batch is done. */
+void keystatsRecordAccess(redisDb *db, robj *key) {
+    keystatsEntry *e;
+    int j;
+
+    if (threadexec_parallel || --hotkeys_countdown > 0) return;
+    /* The next sample is in [1,2*rate-1] lookups, averaging the rate. */
+    hotkeys_countdown = 1 + random() % (2*server.hotkeys_sample_rate-1);
+
+    if ((e = keystatsHeapFind(hotkeys,db->id,key->ptr)) != NULL) {
+        e->weight++;
+        keystatsHeapDown(hotkeys,e->pos);
+    } else if (hotkeys->len < hotkeys->capacity) {
+        keystatsHeapAdd(hotkeys,db->id,key->ptr,1,0);
+    } else {
+        unsigned long long min = hotkeys->entries[0]->weight;
+        keystatsHeapReplaceMin(hotkeys,db->id,key->ptr,min+1,min);
+    }
+
+    if (++hotkeys_samples >= KEYSTATS_DECAY_SAMPLES) {
+        /* Halving every weight keeps the heap order. */
+        for (j = 0; j < hotkeys->len; j++) {
+            hotkeys->entries[j]->weight /= 2;
+            hotkeys->entries[j]->error /= 2;
+        }
+        hotkeys_samples = 0;
+    }
+}
+
+static unsigned long long keystatsValueSize(robj *val) {
+    switch(val->type) {
+    case OBJ_STRING: return stringObjectLen(val);
+    case OBJ_LIST: return listTypeLength(val);
+    case OBJ_SET: return setTypeSize(val);
+    case OBJ_ZSET: return zsetLength(val);
+    case OBJ_HASH: return hashTypeLength(val);
+    default: return 0;
+    }
+}
+
+/* Called when the value of a key is stored. 'oldtype' is the type of the
+ * value replaced, or -1 for a new key. */
+void keystatsTrackSize(redisDb *db, robj *key, robj *val, int oldtype) {
+    keystatsHeap *h = bigkeys[val->type];
+    unsigned long long size = keystatsValueSize(val);
+    keystatsEntry *e;
+
+    if (oldtype != -1 && oldtype != val->type)
+        keystatsUntrackKey(db,key,oldtype);
+
+    if ((e = keystatsHeapFind(h,db->id,key->ptr)) != NULL) {
+        e->weight = size;
+        keystatsHeapUp(h,e->pos);
+        keystatsHeapDown(h,e->pos);
+    } else if (h->len < h->capacity) {
+        e = keystatsHeapAdd(h,db->id,key->ptr,size,0);
+        e->type = val->type;
+    } else if (size > h->entries[0]->weight) {
+        e = keystatsHeapReplaceMin(h,db->id,key->ptr,size,0);
+        e->type = val->type;
+    }
+}
+
+/* Called when a key of the specified type is deleted. */
+void keystatsUntrackKey(redisDb *db, robj *key, int type) {
+    keystatsEntry *e = keystatsHeapFind(bigkeys[type],db->id,key->ptr);
+
+    if (e) keystatsHeapDelete(bigkeys[type],e);
+}
+
+/* Called by emptyDb(): the big keys of the DB are gone. The hot keys are
+ * history, and are kept. */
+void keystatsEmptyDb(int dbid) {
+    int j;
+
+    for (j = 0; j < KEYSTATS_TYPES; j++) keystatsHeapEmpty(bigkeys[j],dbid);
+}
+
+/*-----------------------------------------------------------------------------
+ * KEYSTATS command
+ *----------------------------------------------------------------------------*/
+
+/* KEYSTATS HOT [count]
+ * KEYSTATS BIG [type] [count]
+ * KEYSTATS RESET */
+void keystatsCommand(client *c) {
+    if ((c->argc == 2 || c->argc == 3) &&
+        !strcasecmp(c->argv[1]->ptr,"hot"))
+    {
+        keystatsEntry **sorted;
+        long count = 10, rate = server.hotkeys_sample_rate, j;
+
+        if (c->argc == 3 &&
+            getLongFromObjectOrReply(c,c->argv[2],&count,NULL) != C_OK)
+            return;
+        sorted = zmalloc(sizeof(keystatsEntry*)*(hotkeys->len+1));
+        keystatsHeapSorted(hotkeys,sorted);
+        if (count < 0 || count > hotkeys->len) count = hotkeys->len;
+        addReplyMultiBulkLen(c,count);
+        for (j = 0; j < count; j++) {
+            addReplyMultiBulkLen(c,4);
+            addReplyBulkCBuffer(c,sorted[j]->key,sdslen(sorted[j]->key));
+            addReplyLongLong(c,sorted[j]->dbid);
+            addReplyLongLong(c,sorted[j]->weight*rate);
+            addReplyLongLong(c,sorted[j]->error*rate);
+        }
+        zfree(sorted);
+    } else if (c->argc >= 2 && c->argc <= 4 &&
+               !strcasecmp(c->argv[1]->ptr,"big"))
+    {
+        keystatsEntry **sorted;
+        long count = 10, total = 0, j;
+        long long ll;
+        int type = -1, t, argj = 2;
+
+        if (c->argc > 2) {
+            for (t = 0; t < KEYSTATS_TYPES; t++) {
+                if (!strcasecmp(c->argv[2]->ptr,keystatsTypeNames[t])) {
+                    type = t;
+                    argj++;
+                    break;
+                }
+            }
+        }
+        /* A first argument that is neither a type nor a count, or that is
+         * followed by the count, is a misspelled type. */
+        if (c->argc > 2 && type == -1 &&
+            (c->argc == 4 || getLongLongFromObject(c->argv[2],&ll) != C_OK))
+        {
+            addReplyError(c,"Unknown type. Try STRING, LIST, SET, ZSET, HASH.");
+            return;
+        }
+        if (argj < c->argc &&
+            getLongFromObjectOrReply(c,c->argv[argj],&count,NULL) != C_OK)
+            return;
+
+        /* Without a type the keys of every type are sorted together. */
+        for (t = 0; t < KEYSTATS_TYPES; t++) total += bigkeys[t]->len;
+        sorted = zmalloc(sizeof(keystatsEntry*)*(total+1));
+        total = 0;
+        for (t = 0; t < KEYSTATS_TYPES; t++) {
+            if (type != -1 && type != t) continue;
+            total += keystatsHeapSorted(bigkeys[t],sorted+total);
+        }
+        if (type == -1)
+            qsort(sorted,total,sizeof(keystatsEntry*),
+                  keystatsEntryCompareWeight);
+        if (count < 0 || count > total) count = total;
+        addReplyMultiBulkLen(c,count);
+        for (j = 0; j < count; j++) {
+            keystatsEntry *e = sorted[j];
+
+            addReplyMultiBulkLen(c,4);
+            addReplyBulkCBuffer(c,e->key,sdslen(e->key));
+            addReplyLongLong(c,e->dbid);
+            addReplyBulkCString(c,(char*)keystatsTypeNames[e->type]);
+            addReplyLongLong(c,e->weight);
+        }
+        zfree(sorted);
+    } else if (c->argc == 2 && !strcasecmp(c->argv[1]->ptr,"reset")) {
+        int t;
+
+        keystatsHeapEmpty(hotkeys,-1);
+        for (t = 0; t < KEYSTATS_TYPES; t++) keystatsHeapEmpty(bigkeys[t],-1);
+        hotkeys_samples = 0;
+        addReply(c,shared.ok);
+    } else {
+        addReplyError(c,
+            "Unknown KEYSTATS subcommand or wrong # of args. Try HOT, BIG, RESET.");
+    }
+}
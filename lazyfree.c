@@ -0,0 +1,125 @@
+#include "server.h"
+#include "bio.h"
+
+/* Lazy free: instead of releasing a big value, or a whole database, in the
+ * main thread, the keyspace entry is unlinked in O(1) and the memory is
+ * reclaimed by the BIO_LAZY_FREE background thread. */
+
+static size_t lazyfree_objects = 0;
+
+/* Return the number of currently pending objects to free. */
+size_t lazyfreeGetPendingObjectsCount(void) {
+    return __atomic_load_n(&lazyfree_objects,__ATOMIC_RELAXED);
+}
+
+/* Return the amount of work needed in order to free an object.
+ * The return value is not always the actual number of allocations the
+ * object is composed of, but a number proportional to it.
+ *
+ * For strings the function always returns 1.
+ *
+ * For aggregated objects represented by hash tables or other data structures
+ * the function just returns the number of elements the object is composed of.
+ *
+ * Objects composed of single allocations are always reported as having a
+ * single item even if they are actually logical composed of multiple
+ * elements.
+ *
+ * For lists the function returns the number of elements in the quicklist
+ * representing the list. */
+static size_t lazyfreeGetFreeEffort(robj *obj) {
+    if (obj->type == OBJ_LIST) {
+        quicklist *ql = obj->ptr;
+        return ql->len;
+    } else if (obj->type == OBJ_SET && obj->encoding == OBJ_ENCODING_HT) {
+        dict *ht = obj->ptr;
+        return dictSize(ht);
+    } else if (obj->type == OBJ_ZSET && obj->encoding == OBJ_ENCODING_SKIPLIST){
+        zset *zs = obj->ptr;
+        return zs->zsl->length;
+    } else if (obj->type == OBJ_HASH && obj->encoding == OBJ_ENCODING_HT) {
+        dict *ht = obj->ptr;
+        return dictSize(ht);
+    } else {
+        return 1; /* Everything else is a single allocation. */
+    }
+}
+
+/* Delete a key, value, and associated expiration entry if any, from the DB.
+ * If there are enough allocations to free the value object may be put into
+ * a lazy free list instead of being freed synchronously. The lazy free list
+ * will be reclaimed in a different bio.c thread. */
+int dbAsyncDelete(redisDb *db, robj *key) {
+    dictEntry *de;
+    robj *val;
+
+    de = dbFind(db,key->ptr);
+    if (de == NULL) return 0;
+    val = dictGetVal(de);
+
+    /* The expire is stored in the key, only the index needs an update. */
+    if (db->expires_index->length > 0) removeExpire(db,key);
+    if (server.bigkeys_capacity) keystatsUntrackKey(db,key,val->type);
+
+    /* If releasing the object is too much work, let's put it into the
+     * lazy free list: the entry is then deleted with a NULL value, that
+     * the dict value destructor ignores. A shared value is released
+     * synchronously, it only costs a refcount decrement. */
+    if (lazyfreeGetFreeEffort(val) > LAZYFREE_THRESHOLD &&
+        val->refcount == 1)
+    {
+        __atomic_add_fetch(&lazyfree_objects,1,__ATOMIC_RELAXED);
+        bioCreateBackgroundJob(BIO_LAZY_FREE,val,NULL,NULL);
+        dictSetVal(dbKeyDict(db,key->ptr),de,NULL);
+    }
+
+    return dbDictDelete(db,key->ptr);
+}
+
+/* Empty a Redis DB asynchronously. What the function does actually is to
+ * create a new empty set of hash tables and scheduling the old ones for
+ * lazy freeing. */
+void emptyDbAsync(redisDb *db) {
+    dict **olddicts = db->dict;
+    zskiplist *oldzsl = db->expires_index;
+    radixTree *oldindex = db->prefix_index;
+
+    __atomic_add_fetch(&lazyfree_objects,db->key_count,__ATOMIC_RELAXED);
+    listRelease(db->rehashing);
+    zfree(db->slot_key_index);
+    dbInitKeyspace(db);
+    db->expires_index = zslCreate();
+    bioCreateBackgroundJob(BIO_LAZY_FREE,NULL,olddicts,oldzsl);
+    if (oldindex) bioCreateBackgroundJob(BIO_LAZY_FREE,NULL,NULL,oldindex);
+}
+
+/* Release objects from the lazyfree thread. It's just decrRefCount()
+ * updating the count of objects to release. */
+void lazyfreeFreeObjectFromBioThread(robj *o) {
+    decrRefCount(o);
+    __atomic_sub_fetch(&lazyfree_objects,1,__ATOMIC_RELAXED);
+}
+
+/* Release a database from the lazyfree thread. The 'dicts' and 'zsl' are
+ * the keyspace and the expires index of a Redis DB that were replaced by
+ * emptyDbAsync(). The index elements are copies of the keys, so the two
+ * structures are released independently. All the DBs have the same number
+ * of dicts, that never changes after startup. */
+void lazyfreeFreeDatabaseFromBioThread(dict **dicts, zskiplist *zsl) {
+    size_t numkeys = 0;
+    int j;
+
+    for (j = 0; j < server.db[0].dict_count; j++) {
+        if (dicts[j] == NULL) continue;
+        numkeys += dictSize(dicts[j]);
+        dictRelease(dicts[j]);
+    }
+    zfree(dicts);
+    zslFree(zsl);
+    __atomic_sub_fetch(&lazyfree_objects,numkeys,__ATOMIC_RELAXED);
+}
+
+/* Release the prefix index of a Redis DB replaced by emptyDbAsync(). */
+void lazyfreeFreePrefixIndexFromBioThread(radixTree *rt) {
+    radixFree(rt);
+}
@@ -0,0 +1,219 @@
+/* Event loop profiler.
+ *
+ * Every event loop iteration is split into phases: waiting in the poll,
+ * running file event handlers, executing commands, running time events and
+ * the work done in beforeSleep(). The time spent in every phase is
+ * aggregated into power of two histograms, and iterations that kept the
+ * loop busy for more than loop-slow-threshold microseconds are remembered
+ * together with their phase breakdown, so that it is possible to tell what
+ * the server was doing when latency spiked.
+ *
+ * The cost is a handful of ustime() calls per iteration: ae.c accumulates
+ * the poll, file and time events phases, beforeSleep() marks its own
+ * phases, and call() reports the duration of commands it already measures.
+ * An iteration is closed at the start of beforeSleep(), so it covers the
+ * previous beforeSleep() plus the poll and the handlers that followed. */
+
+#include "looprofile.h"
+
+static char *loopPhaseNames[LOOP_PHASES] = {
+    "poll", "events", "commands", "timers", "expire", "pending-input",
+    "threads", "slow-lane", "resume", "writes"
+};
+
+/* Aggregated statistics, one row per phase plus one for whole iterations. */
+static struct {
+    long long iterations;
+    long long usec[LOOP_PHASES+1];
+    long long max[LOOP_PHASES+1];
+    long long hist[LOOP_PHASES+1][LOOP_HIST_BUCKETS];
+} loopStats;
+
+/* Iteration in progress. */
+static loopIteration cur;
+static long long cmd_usec;          /* Commands usec in the iteration. */
+static long long cmd_usec_mark;     /* cmd_usec at the end of beforeSleep(). */
+static long long phase_start;       /* ustime() when the phase began. */
+static long long phase_cmd_start;   /* cmd_usec when the phase began. */
+
+/* Circular buffer of the slow iterations. */
+static loopIteration slowlog[LOOP_SLOW_LOG_LEN];
+static int slowlog_idx;             /* Where the next entry is stored. */
+static int slowlog_len;             /* Entries stored, up to the max. */
+static long long slowlog_id;        /* Next slow iteration id. */
+
+static void loopProfileReset(void) {
+    memset(&loopStats,0,sizeof(loopStats));
+    slowlog_idx = 0;
+    slowlog_len = 0;
+}
+
+void loopProfileInit(void) {
+    loopProfileReset();
+    memset(&cur,0,sizeof(cur));
+    cmd_usec = cmd_usec_mark = 0;
+    slowlog_id = 0;
+}
+
+/* Return the histogram bucket for a duration: bucket N counts durations
+ * from 2^N to 2^(N+1)-1 usec, bucket 0 also counts zero. */
+static int loopHistBucket(long long usec) {
+    int bucket = 0;
+
+    while (usec > 1 && bucket < LOOP_HIST_BUCKETS-1) {
+        usec >>= 1;
+        bucket++;
+    }
+    return bucket;
+}
+
+static void loopStatsAdd(int row, long long usec) {
+    loopStats.usec[row] += usec;
+    if (usec > loopStats.max[row]) loopStats.max[row] = usec;
+    loopStats.hist[row][loopHistBucket(usec)]++;
+}
+
+/* Called by call() for every executed command. */
+void loopProfileCommand(struct redisCommand *cmd, long long duration) {
+    cmd_usec += duration;
+    cur.commands++;
+    if (cur.slowest_cmd == NULL || duration > cur.slowest_cmd_usec) {
+        cur.slowest_cmd = cmd;
+        cur.slowest_cmd_usec = duration;
+    }
+}
+
+/* Mark the start and the end of a phase of beforeSleep(). The time spent
+ * executing commands inside the phase is not accounted to it. */
+void loopProfileBeginPhase(void) {
+    phase_start = ustime();
+    phase_cmd_start = cmd_usec;
+}
+
+void loopProfileEndPhase(int phase) {
+    long long usec = ustime()-phase_start-(cmd_usec-phase_cmd_start);
+
+    if (usec > 0) cur.phase[phase] += usec;
+    cmd_usec_mark = cmd_usec;
+}
+
+/* Close the current iteration, collecting the phases accumulated by the
+ * event loop, and start a new one. */
+void loopProfileEndIteration(aeEventLoop *el) {
+    long long events_cmd_usec = cmd_usec-cmd_usec_mark;
+    int j;
+
+    cur.phase[LOOP_PHASE_POLL] += el->poll_usec;
+    cur.phase[LOOP_PHASE_EVENTS] += el->file_usec > events_cmd_usec ?
+                                    el->file_usec-events_cmd_usec : 0;
+    cur.phase[LOOP_PHASE_TIMERS] += el->time_usec;
+    cur.phase[LOOP_PHASE_COMMANDS] = cmd_usec;
+    cur.fired = el->fired_count;
+    el->poll_usec = el->file_usec = el->time_usec = el->fired_count = 0;
+
+    cur.usec = 0;
+    for (j = 0; j < LOOP_PHASES; j++) {
+        loopStatsAdd(j,cur.phase[j]);
+        if (j != LOOP_PHASE_POLL) cur.usec += cur.phase[j];
+    }
+    loopStatsAdd(LOOP_PHASES,cur.usec);
+    loopStats.iterations++;
+
+    if (server.loop_slow_threshold > 0 &&
+        cur.usec >= server.loop_slow_threshold)
+    {
+        cur.id = slowlog_id++;
+        cur.time = time(NULL);
+        slowlog[slowlog_idx] = cur;
+        slowlog_idx = (slowlog_idx+1) % LOOP_SLOW_LOG_LEN;
+        if (slowlog_len < LOOP_SLOW_LOG_LEN) slowlog_len++;
+    }
+
+    memset(&cur,0,sizeof(cur));
+    cmd_usec = cmd_usec_mark = 0;
+}
+
+/* Reply with the histogram of a row of the stats, as a flat array of
+ * bucket upper bound (usec) and count pairs, empty buckets omitted. */
+static void addReplyLoopHistogram(client *c, int row) {
+    int j, buckets = 0;
+
+    for (j = 0; j < LOOP_HIST_BUCKETS; j++)
+        if (loopStats.hist[row][j]) buckets++;
+    addReplyMultiBulkLen(c,buckets*2);
+    for (j = 0; j < LOOP_HIST_BUCKETS; j++) {
+        if (loopStats.hist[row][j] == 0) continue;
+        addReplyLongLong(c,(2LL<<j)-1);
+        addReplyLongLong(c,loopStats.hist[row][j]);
+    }
+}
+
+static void addReplyLoopStatsRow(client *c, char *name, int row) {
+    addReplyMultiBulkLen(c,4);
+    addReplyBulkCString(c,name);
+    addReplyLongLong(c,loopStats.usec[row]);
+    addReplyLongLong(c,loopStats.max[row]);
+    addReplyLoopHistogram(c,row);
+}
+
+static void addReplyLoopIteration(client *c, loopIteration *it) {
+    int j;
+
+    addReplyMultiBulkLen(c,7);
+    addReplyLongLong(c,it->id);
+    addReplyLongLong(c,it->time);
+    addReplyLongLong(c,it->usec);
+    addReplyMultiBulkLen(c,LOOP_PHASES*2);
+    for (j = 0; j < LOOP_PHASES; j++) {
+        addReplyBulkCString(c,loopPhaseNames[j]);
+        addReplyLongLong(c,it->phase[j]);
+    }
+    addReplyLongLong(c,it->fired);
+    addReplyLongLong(c,it->commands);
+    if (it->slowest_cmd) {
+        addReplyMultiBulkLen(c,2);
+        addReplyBulkCString(c,it->slowest_cmd->name);
+        addReplyLongLong(c,it->slowest_cmd_usec);
+    } else {
+        addReply(c,shared.nullmultibulk);
+    }
+}
+
+/* LOOPPROFILE STATS                -- phases stats and histograms.
+ * LOOPPROFILE SLOW [count]         -- latest slow iterations.
+ * LOOPPROFILE LEN                  -- number of slow iterations stored.
+ * LOOPPROFILE RESET                -- clear stats and slow iterations. */
+void loopprofileCommand(client *c) {
+    if (c->argc == 2 && !strcasecmp(c->argv[1]->ptr,"stats")) {
+        int j;
+
+        addReplyMultiBulkLen(c,LOOP_PHASES+2);
+        addReplyLongLong(c,loopStats.iterations);
+        addReplyLoopStatsRow(c,"iteration",LOOP_PHASES);
+        for (j = 0; j < LOOP_PHASES; j++)
+            addReplyLoopStatsRow(c,loopPhaseNames[j],j);
+    } else if ((c->argc == 2 || c->argc == 3) &&
+               !strcasecmp(c->argv[1]->ptr,"slow"))
+    {
+        long count = 10, j;
+
+        if (c->argc == 3 &&
+            getLongFromObjectOrReply(c,c->argv[2],&count,NULL) != C_OK)
+            return;
+        if (count < 0 || count > slowlog_len) count = slowlog_len;
+        addReplyMultiBulkLen(c,count);
+        /* Newest first. */
+        for (j = 0; j < count; j++) {
+            int idx = (slowlog_idx-1-j+LOOP_SLOW_LOG_LEN) % LOOP_SLOW_LOG_LEN;
+            addReplyLoopIteration(c,&slowlog[idx]);
+        }
+    } else if (c->argc == 2 && !strcasecmp(c->argv[1]->ptr,"len")) {
+        addReplyLongLong(c,slowlog_len);
+    } else if (c->argc == 2 && !strcasecmp(c->argv[1]->ptr,"reset")) {
+        loopProfileReset();
+        addReply(c,shared.ok);
+    } else {
+        addReplyError(c,
+            "Unknown LOOPPROFILE subcommand or wrong # of args. Try STATS, SLOW, LEN, RESET.");
+    }
+}
@@ -0,0 +1,45 @@
+#ifndef __LOOPROFILE_H
+#define __LOOPROFILE_H
+
+#include "server.h"
+
+/* Phases an event loop iteration is split into. Command execution is
+ * accounted on its own, and not in the phase that ran the command. */
+#define LOOP_PHASE_POLL 0           /* Waiting in aeApiPoll(). */
+#define LOOP_PHASE_EVENTS 1         /* File event handlers (reads, writes). */
+#define LOOP_PHASE_COMMANDS 2       /* Command execution, in call(). */
+#define LOOP_PHASE_TIMERS 3         /* Time events (serverCron). */
+#define LOOP_PHASE_EXPIRE 4         /* Fast expire cycle in beforeSleep(). */
+#define LOOP_PHASE_PENDING_INPUT 5  /* Clients left over by the budget. */
+#define LOOP_PHASE_THREADS 6        /* threadexecRunPending(). */
+#define LOOP_PHASE_SLOW_LANE 7      /* handleClientsInSlowLane(). */
+#define LOOP_PHASE_RESUME 8         /* handleResumableCommands(). */
+#define LOOP_PHASE_WRITES 9         /* handleClientsWithPendingWrites(). */
+#define LOOP_PHASES 10
+
+#define LOOP_HIST_BUCKETS 24        /* Power of two usec buckets, up to ~8s. */
+#define LOOP_SLOW_LOG_LEN 64        /* Slow iterations remembered. */
+
+/* Time spent by a whole iteration, and by each of its phases. */
+typedef struct loopIteration {
+    long long id;               /* Unique slow iteration identifier. */
+    time_t time;                /* Unix time at which the iteration ended. */
+    long long usec;             /* Total duration, poll wait excluded. */
+    long long phase[LOOP_PHASES]; /* Usec spent in every phase. */
+    long long fired;            /* File events processed. */
+    long long commands;         /* Commands executed. */
+    struct redisCommand *slowest_cmd; /* Slowest command executed, if any. */
+    long long slowest_cmd_usec; /* Its duration. */
+} loopIteration;
+
+/* Exported API */
+void loopProfileInit(void);
+void loopProfileCommand(struct redisCommand *cmd, long long duration);
+void loopProfileBeginPhase(void);
+void loopProfileEndPhase(int phase);
+void loopProfileEndIteration(aeEventLoop *el);
+
+/* Exported commands */
+void loopprofileCommand(client *c);
+
+#endif
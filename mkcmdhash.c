@@ -0,0 +1,173 @@
+/* mkcmdhash -- build the perfect hash of the command table.
+ *
+ * Usage: mkcmdhash server.c > cmdhash_table.h
+ *
+ * The command names are taken from the redisCommandTable definition in the
+ * given source file (entries commented out are skipped), in table order, so
+ * that cmdhash_table.h can refer to the commands by their table index. See
+ * cmdhash.h for the layout of the generated table. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+#include "cmdhash.h"
+
+#define MAX_COMMANDS 1024
+#define MAX_SEED 10000000
+
+static char *names[MAX_COMMANDS];
+static size_t lens[MAX_COMMANDS];
+static int numcommands;
+
+static void die(const char *msg, const char *arg) {
+    fprintf(stderr,"mkcmdhash: %s%s\n", msg, arg ? arg : "");
+    exit(1);
+}
+
+/* Collect the names of the table entries, that are the lines starting with
+ * {"name", between "redisCommandTable[] = {" and "};". */
+static void loadCommandNames(const char *filename) {
+    FILE *fp = fopen(filename,"r");
+    char line[1024];
+    int intable = 0;
+
+    if (!fp) die("can't open ",filename);
+    while (fgets(line,sizeof(line),fp)) {
+        char *p = line, *end;
+
+        while (isspace((unsigned char)*p)) p++;
+        if (!intable) {
+            if (strstr(line,"redisCommandTable[] = {")) intable = 1;
+            continue;
+        }
+        if (!strncmp(p,"};",2)) break;
+        if (strncmp(p,"{\"",2)) continue;
+        p += 2;
+        if ((end = strchr(p,'"')) == NULL) die("bad table entry: ",line);
+        if (end-p == 0 || end-p > CMDHASH_MAXLEN)
+            die("bad command name length: ",line);
+        if (numcommands == MAX_COMMANDS) die("too many commands",NULL);
+        names[numcommands] = strndup(p,end-p);
+        lens[numcommands] = end-p;
+        numcommands++;
+    }
+    fclose(fp);
+    if (!intable || numcommands == 0) die("no commands found in ",filename);
+}
+
+/* Hash and displace: the keys are grouped in buckets by their unseeded
+ * hash. Starting from the biggest bucket, every bucket gets the first seed
+ * sending all its keys to free slots, stored in disp[] as seed. Buckets of
+ * a single key are placed in any free slot, stored as -slot-1. */
+static void buildPerfectHash(int *disp, int *slots) {
+    int n = numcommands, b, j, k;
+    int *bucket = malloc(sizeof(int)*n), *bsize = calloc(n,sizeof(int));
+    int *order = malloc(sizeof(int)*n), *try = malloc(sizeof(int)*n);
+
+    for (j = 0; j < n; j++) {
+        bucket[j] = cmdhashFunction(0,names[j],lens[j]) % n;
+        bsize[bucket[j]]++;
+        slots[j] = -1;
+        disp[j] = 0;
+        order[j] = j;
+    }
+    /* Biggest buckets first. */
+    for (j = 0; j < n; j++) {
+        for (k = j+1; k < n; k++) {
+            if (bsize[order[k]] > bsize[order[j]]) {
+                int t = order[j]; order[j] = order[k]; order[k] = t;
+            }
+        }
+    }
+
+    for (b = 0; b < n && bsize[order[b]] > 1; b++) {
+        int seed, found = 0;
+
+        for (seed = 1; seed < MAX_SEED && !found; seed++) {
+            int count = 0;
+
+            found = 1;
+            for (j = 0; j < n && found; j++) {
+                int s;
+
+                if (bucket[j] != order[b]) continue;
+                s = cmdhashFunction(seed,names[j],lens[j]) % n;
+                for (k = 0; k < count; k++) if (try[k] == s) found = 0;
+                for (k = 0; k < n; k++) if (slots[k] == s) found = 0;
+                try[count++] = s;
+            }
+            if (found) {
+                count = 0;
+                for (j = 0; j < n; j++)
+                    if (bucket[j] == order[b]) slots[j] = try[count++];
+                disp[order[b]] = seed;
+            }
+        }
+        if (!found) die("can't find a perfect hash",NULL);
+    }
+
+    /* Single key buckets take the free slots. */
+    for (j = 0; j < n; j++) {
+        int s, used;
+
+        if (bsize[bucket[j]] != 1) continue;
+        for (s = 0; s < n; s++) {
+            used = 0;
+            for (k = 0; k < n; k++) if (slots[k] == s) used = 1;
+            if (!used) break;
+        }
+        slots[j] = s;
+        disp[bucket[j]] = -s-1;
+    }
+    free(bucket);
+    free(bsize);
+    free(order);
+    free(try);
+}
+
+static void printEscaped(const char *s, size_t len) {
+    size_t j;
+
+    putchar('"');
+    for (j = 0; j < len; j++) printf("\\x%02x",(unsigned char)s[j]);
+    putchar('"');
+}
+
+int main(int argc, char **argv) {
+    int disp[MAX_COMMANDS], slots[MAX_COMMANDS], bytable[MAX_COMMANDS];
+    int j;
+
+    if (argc != 2) die("usage: mkcmdhash server.c",NULL);
+    loadCommandNames(argv[1]);
+    buildPerfectHash(disp,slots);
+    for (j = 0; j < numcommands; j++) bytable[slots[j]] = j;
+
+    printf("/* Automatically generated by mkcmdhash from %s, don't edit. */\n\n",
+        argv[1]);
+    printf("#define CMDHASH_SIZE %d\n\n", numcommands);
+    printf("static const int cmdhashDisp[CMDHASH_SIZE] = {\n");
+    for (j = 0; j < numcommands; j++) printf("    %d,\n", disp[j]);
+    printf("};\n\n");
+    printf("static const cmdhashEntry cmdhashTable[CMDHASH_SIZE] = {\n");
+    for (j = 0; j < numcommands; j++) {
+        int idx = bytable[j];
+        char lower[CMDHASH_MAXLEN], mask[CMDHASH_MAXLEN];
+        size_t k;
+
+        for (k = 0; k < lens[idx]; k++) {
+            unsigned char c = names[idx][k];
+
+            lower[k] = tolower(c);
+            mask[k] = isalpha(c) ? 0x20 : 0;
+        }
+        printf("    {{");
+        printEscaped(lower,lens[idx]);
+        printf("}, {");
+        printEscaped(mask,lens[idx]);
+        printf("}, %zu, %d}, /* %s */\n", lens[idx], idx, names[idx]);
+    }
+    printf("};\n");
+    return 0;
+}
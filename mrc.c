@@ -0,0 +1,256 @@
+/* Miss ratio curve of an LRU cache, estimated with SHARDS.
+ *
+ * The hit ratio of an LRU cache of C keys is the fraction of accesses whose
+ * reuse distance, the number of distinct keys accessed since the previous
+ * access to the same key, is less than C. Computing the distances of every
+ * access needs to remember every key, so only a spatially hashed sample of
+ * the keys is tracked: a key is sampled if its hash is below a threshold,
+ * that is with probability R, and then all its accesses are. The distance
+ * between two accesses to a sampled key, counted among the sampled keys,
+ * is about R times the real one, so it is scaled by 1/R.
+ *
+ * The sample has a fixed budget of keys: when it's exceeded the threshold
+ * is lowered so that 1/8 of the sampled keys, those with the highest hash,
+ * are dropped, and the histogram, that counted accesses sampled with the
+ * old rate, is rescaled to the new one.
+ *
+ * The distance of an access is the number of sampled keys accessed after
+ * the previous access to the same key: every key is stored with the time
+ * of its last access, and a Fenwick tree counts the keys per access time.
+ * Times are renumbered from zero when they reach the window size.
+ *
+ * The caller passes a 64 bit hash of the key: the top 24 bits decide the
+ * sampling, the low ones address the table of sampled keys. The structure
+ * is not thread safe. */
+
+#include <stdlib.h>
+#include <string.h>
+#include "mrc.h"
+#include "zmalloc.h"
+
+/* Cache size of every bucket: about 2^(i/4). */
+static uint64_t bucketSize[MRC_BUCKETS];
+
+static void bucketSizesInit(void) {
+    double size = 1;
+    int j;
+
+    if (bucketSize[0]) return;
+    for (j = 0; j < MRC_BUCKETS; j++) {
+        bucketSize[j] = (uint64_t)(size+0.5);
+        size *= 1.189207115002721; /* 2^(1/4) */
+    }
+}
+
+/* Bucket of the accesses that hit in caches of at least 'size' keys. */
+static int bucketIndex(uint64_t size) {
+    int j;
+
+    if (size <= 1) return 0;
+    j = 4*(63-__builtin_clzll(size))-2;
+    if (j < 0) j = 0;
+    while (j < MRC_BUCKETS-1 && bucketSize[j] < size) j++;
+    return j;
+}
+
+/* Fenwick tree over the access times. */
+static void treeAdd(missRatioCurve *mrc, uint32_t t, int delta) {
+    for (t++; t <= mrc->window; t += t & -t) mrc->tree[t] += delta;
+}
+
+/* Keys with a last access time <= 't'. */
+static uint64_t treeCount(missRatioCurve *mrc, uint32_t t) {
+    uint64_t count = 0;
+
+    for (t++; t > 0; t -= t & -t) count += mrc->tree[t];
+    return count;
+}
+
+static uint64_t *tableFind(missRatioCurve *mrc, uint64_t hash) {
+    uint64_t mask = mrc->tsize-1, idx = hash & mask;
+
+    while (mrc->hashes[idx] != 0 && mrc->hashes[idx] != hash)
+        idx = (idx+1) & mask;
+    return mrc->hashes+idx;
+}
+
+missRatioCurve *mrcCreate(uint64_t maxkeys) {
+    missRatioCurve *mrc = zmalloc(sizeof(*mrc));
+    uint64_t tsize = 16;
+
+    bucketSizesInit();
+    if (maxkeys < 16) maxkeys = 16;
+    /* One more key than the budget is inserted before dropping keys. */
+    while (tsize < maxkeys*2) tsize *= 2;
+    mrc->tsize = tsize;
+    mrc->hashes = zmalloc(sizeof(uint64_t)*tsize);
+    mrc->times = zmalloc(sizeof(uint32_t)*tsize);
+    mrc->window = maxkeys*4;
+    mrc->tree = zmalloc(sizeof(uint32_t)*(mrc->window+1));
+    mrc->maxkeys = maxkeys;
+    mrcReset(mrc);
+    return mrc;
+}
+
+void mrcFree(missRatioCurve *mrc) {
+    zfree(mrc->hashes);
+    zfree(mrc->times);
+    zfree(mrc->tree);
+    zfree(mrc);
+}
+
+/* Forget every access, sampling every key again. */
+void mrcReset(missRatioCurve *mrc) {
+    memset(mrc->hashes,0,sizeof(uint64_t)*mrc->tsize);
+    memset(mrc->tree,0,sizeof(uint32_t)*(mrc->window+1));
+    memset(mrc->hist,0,sizeof(mrc->hist));
+    mrc->clock = 0;
+    mrc->count = 0;
+    mrc->threshold = MRC_MODULUS;
+    mrc->references = 0;
+    mrc->sampled = 0;
+    mrc->cold = 0;
+}
+
+double mrcSampleRate(missRatioCurve *mrc) {
+    return (double)mrc->threshold/MRC_MODULUS;
+}
+
+typedef struct { uint64_t hash; uint32_t time; } mrcKey;
+
+static int compareTime(const void *a, const void *b) {
+    const mrcKey *k1 = a, *k2 = b;
+
+    return k1->time < k2->time ? -1 : k1->time > k2->time;
+}
+
+static int compareSample(const void *a, const void *b) {
+    uint64_t s1 = ((const mrcKey*)a)->hash >> 40;
+    uint64_t s2 = ((const mrcKey*)b)->hash >> 40;
+
+    return s1 < s2 ? -1 : s1 > s2;
+}
+
+/* Rebuild the table with the keys below 'threshold', renumbering their
+ * access times from zero in the same order. */
+static void mrcRebuild(missRatioCurve *mrc, uint64_t threshold) {
+    mrcKey *keys = zmalloc(sizeof(mrcKey)*(mrc->count+1));
+    uint64_t j, n = 0;
+
+    for (j = 0; j < mrc->tsize; j++) {
+        uint64_t hash = mrc->hashes[j];
+
+        if (hash == 0 || (hash >> 40) >= threshold) continue;
+        keys[n].hash = hash;
+        keys[n].time = mrc->times[j];
+        n++;
+    }
+    qsort(keys,n,sizeof(mrcKey),compareTime);
+
+    memset(mrc->hashes,0,sizeof(uint64_t)*mrc->tsize);
+    memset(mrc->tree,0,sizeof(uint32_t)*(mrc->window+1));
+    for (j = 0; j < n; j++) {
+        uint64_t *slot = tableFind(mrc,keys[j].hash);
+
+        *slot = keys[j].hash;
+        mrc->times[slot-mrc->hashes] = j;
+        treeAdd(mrc,j,1);
+    }
+    mrc->clock = n;
+    mrc->count = n;
+    zfree(keys);
+}
+
+/* The sample exceeds the budget: lower the threshold to drop the 1/8 of the
+ * keys with the highest hash, and rescale the histogram to the new rate. */
+static void mrcLowerThreshold(missRatioCurve *mrc) {
+    mrcKey *keys = zmalloc(sizeof(mrcKey)*mrc->count);
+    uint64_t j, n = 0, threshold;
+    double scale;
+
+    for (j = 0; j < mrc->tsize; j++) {
+        if (mrc->hashes[j] == 0) continue;
+        keys[n++].hash = mrc->hashes[j];
+    }
+    qsort(keys,n,sizeof(mrcKey),compareSample);
+    threshold = keys[mrc->maxkeys*7/8].hash >> 40;
+    if (threshold == 0) threshold = 1;
+    zfree(keys);
+
+    scale = (double)threshold/mrc->threshold;
+    for (j = 0; j < MRC_BUCKETS; j++) mrc->hist[j] *= scale;
+    mrc->sampled *= scale;
+    mrc->cold *= scale;
+    mrc->threshold = threshold;
+    mrcRebuild(mrc,threshold);
+}
+
+/* Account an access to the key with the specified hash. */
+void mrcAccess(missRatioCurve *mrc, uint64_t hash) {
+    uint64_t *slot;
+    uint32_t *time;
+
+    mrc->references++;
+    if ((hash >> 40) >= mrc->threshold) return;
+    if (hash == 0) hash = 1; /* 0 marks free slots. */
+
+    slot = tableFind(mrc,hash);
+    time = mrc->times+(slot-mrc->hashes);
+    if (*slot != 0) {
+        uint64_t distance = mrc->count-treeCount(mrc,*time);
+
+        /* The d sampled keys accessed in between are separated by d+1 gaps
+         * of (1-R)/R keys on average, so the access hits in caches of
+         * (d+1)/R keys. */
+        mrc->hist[bucketIndex((distance+1)/mrcSampleRate(mrc))]++;
+        treeAdd(mrc,*time,-1);
+    } else {
+        *slot = hash;
+        mrc->count++;
+        mrc->cold++;
+    }
+    *time = mrc->clock;
+    treeAdd(mrc,mrc->clock++,1);
+    mrc->sampled++;
+
+    if (mrc->count > mrc->maxkeys)
+        mrcLowerThreshold(mrc);
+    else if (mrc->clock == mrc->window)
+        mrcRebuild(mrc,mrc->threshold);
+}
+
+/* Fill 'sizes' and 'hits' with the estimated hit ratio of LRU caches of
+ * increasing size, up to the one where every access but the first ones
+ * hits. The arrays must have room for MRC_BUCKETS points, the number of
+ * points is returned.
+ *
+ * The sampled keys may get more or less than R times the accesses, a big
+ * error with skewed traffic, where a few keys get most of the accesses.
+ * As in SHARDS_adj, the difference with the expected number of sampled
+ * accesses is assumed to come from the hottest keys, and it is added to
+ * (or removed from) the smallest distances. */
+int mrcCurve(missRatioCurve *mrc, uint64_t *sizes, double *hits) {
+    double expected = mrc->references*mrcSampleRate(mrc);
+    double cumulative = expected-mrc->sampled;
+    int j, last = -1, points = 0;
+
+    for (j = 0; j < MRC_BUCKETS; j++) if (mrc->hist[j] > 0) last = j;
+    if (mrc->sampled == 0) return 0;
+    for (j = 0; j <= last; j++) {
+        double hit;
+
+        cumulative += mrc->hist[j];
+        /* The smallest sizes are rounded to the same number of keys. */
+        if (j+1 <= last && bucketSize[j+1] == bucketSize[j]) continue;
+        hit = cumulative/expected;
+        sizes[points] = bucketSize[j];
+        hits[points] = hit < 0 ? 0 : (hit > 1 ? 1 : hit);
+        points++;
+    }
+    return points;
+}
+
+size_t mrcMemory(missRatioCurve *mrc) {
+    return sizeof(*mrc) + mrc->tsize*(sizeof(uint64_t)+sizeof(uint32_t)) +
+           sizeof(uint32_t)*(mrc->window+1);
+}
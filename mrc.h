@@ -0,0 +1,33 @@
+#ifndef __MRC_H
+#define __MRC_H
+#include <stdint.h>
+#include <stddef.h>
+
+#define MRC_BUCKETS 192         /* Cache sizes 2^(i/4), up to 2^48 keys. */
+#define MRC_MODULUS (1<<24)     /* Sampling threshold resolution. */
+
+typedef struct missRatioCurve {
+    uint64_t *hashes;           /* Sampled keys, open addressing, 0 = free. */
+    uint32_t *times;            /* Last access of every sampled key. */
+    uint64_t tsize;             /* Slots of the table, power of two. */
+    uint32_t *tree;             /* Fenwick tree of the live access times. */
+    uint32_t window;            /* Access times before a compaction. */
+    uint32_t clock;             /* Next access time. */
+    uint64_t count;             /* Sampled keys. */
+    uint64_t maxkeys;           /* Sampled keys budget. */
+    uint64_t threshold;         /* A key is sampled if hash>>40 < threshold. */
+    uint64_t references;        /* Accesses, sampled or not. */
+    double sampled;             /* Sampled accesses, rescaled as 'hist'. */
+    double cold;                /* Sampled first accesses. */
+    double hist[MRC_BUCKETS];   /* Sampled accesses by reuse distance. */
+} missRatioCurve;
+
+missRatioCurve *mrcCreate(uint64_t maxkeys);
+void mrcFree(missRatioCurve *mrc);
+void mrcAccess(missRatioCurve *mrc, uint64_t hash);
+int mrcCurve(missRatioCurve *mrc, uint64_t *sizes, double *hits);
+double mrcSampleRate(missRatioCurve *mrc);
+void mrcReset(missRatioCurve *mrc);
+size_t mrcMemory(missRatioCurve *mrc);
+
+#endif
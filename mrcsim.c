@@ -0,0 +1,227 @@
+/* mrcsim -- validate the miss ratio curve estimated by mrc.c.
+ *
+ * Usage: mrcsim [-keys N] [-requests N] [-alpha A] [-shift N]
+ *               [-scan-ratio R] [-sample-keys N] [-max-error E] [-seed N]
+ *
+ * A trace of 'requests' accesses is generated as in evictsim: keys taken
+ * from a Zipfian distribution of parameter 'alpha' over 'keys' keys, whose
+ * popularity ranks move to other keys every 'shift' requests (0 = never),
+ * and a fraction 'scan-ratio' of accesses to the next key of a sequential
+ * scan over 10 times 'keys' other keys. The trace is fed to the SHARDS
+ * estimator with a budget of 'sample-keys' sampled keys, as the server
+ * does, then replayed against exact LRU caches of every power of two size
+ * from 64 keys to the number of distinct keys. The hit ratios are printed
+ * side by side, and the program exits with an error if the mean absolute
+ * error over these sizes, the metric of the SHARDS paper, is more than
+ * 'max-error'. The error is higher for the smallest caches, whose hit
+ * ratio depends on the few hottest keys, that may or may not be sampled. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "mrc.h"
+
+static long numkeys = 100000, requests = 5000000, shift = 0, seed = 1234;
+static long sample_keys = 16384;
+static double alpha = 1.0, scan_ratio = 0, max_error = 0.02;
+static long totalkeys;          /* Zipfian keys plus scanned keys. */
+
+static double *cdf;             /* Zipf cumulative distribution by rank. */
+static long *rank2key;          /* Key at every popularity rank. */
+static long *trace;
+
+static void die(const char *msg) {
+    fprintf(stderr,"mrcsim: %s\n",msg);
+    exit(1);
+}
+
+static double uniform(void) {
+    return (double)rand()/((double)RAND_MAX+1);
+}
+
+static void zipfInit(void) {
+    double sum = 0;
+    long j;
+
+    cdf = malloc(sizeof(double)*numkeys);
+    rank2key = malloc(sizeof(long)*numkeys);
+    for (j = 0; j < numkeys; j++) {
+        sum += 1.0/pow(j+1,alpha);
+        cdf[j] = sum;
+        rank2key[j] = j;
+    }
+    for (j = 0; j < numkeys; j++) cdf[j] /= sum;
+}
+
+/* Move the popularity ranks to other keys. */
+static void zipfShift(void) {
+    long j;
+
+    for (j = numkeys-1; j > 0; j--) {
+        long k = rand() % (j+1), t = rank2key[j];
+
+        rank2key[j] = rank2key[k];
+        rank2key[k] = t;
+    }
+}
+
+static long zipfNext(void) {
+    double r = uniform();
+    long lo = 0, hi = numkeys-1;
+
+    while (lo < hi) {
+        long mid = (lo+hi)/2;
+
+        if (cdf[mid] < r) lo = mid+1; else hi = mid;
+    }
+    return rank2key[lo];
+}
+
+/* 64 bit hash of the key, the MurmurHash3 finalizer. */
+static uint64_t keyHash(long key) {
+    uint64_t h = (uint64_t)(key+1)*0x9e3779b97f4a7c15ULL;
+
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+    return h;
+}
+
+/* Return the number of distinct keys of the trace. */
+static long generateTrace(void) {
+    char *seen = calloc(totalkeys,1);
+    long j, scanned = 0, distinct = 0;
+
+    srand(seed);
+    zipfInit();
+    trace = malloc(sizeof(long)*requests);
+    for (j = 0; j < requests; j++) {
+        if (shift && j && j % shift == 0) zipfShift();
+        if (scan_ratio > 0 && uniform() < scan_ratio)
+            trace[j] = numkeys + scanned++ % (totalkeys-numkeys);
+        else
+            trace[j] = zipfNext();
+        if (!seen[trace[j]]) {
+            seen[trace[j]] = 1;
+            distinct++;
+        }
+    }
+    free(seen);
+    free(cdf);
+    free(rank2key);
+    return distinct;
+}
+
+/* Hit ratio of an exact LRU cache of 'size' keys. */
+static double simulateLRU(long size) {
+    long *prev = malloc(sizeof(long)*totalkeys);
+    long *next = malloc(sizeof(long)*totalkeys);
+    char *cached = calloc(totalkeys,1);
+    long j, head = -1, tail = -1, count = 0, hits = 0;
+
+    for (j = 0; j < requests; j++) {
+        long key = trace[j];
+
+        if (cached[key]) {
+            hits++;
+            if (key == head) continue;
+            /* Unlink, to be moved to the head. */
+            next[prev[key]] = next[key];
+            if (key == tail) tail = prev[key]; else prev[next[key]] = prev[key];
+        } else {
+            if (count == size) {
+                long victim = tail;
+
+                tail = prev[victim];
+                if (tail == -1) head = -1; else next[tail] = -1;
+                cached[victim] = 0;
+                count--;
+            }
+            cached[key] = 1;
+            count++;
+        }
+        prev[key] = -1;
+        next[key] = head;
+        if (head != -1) prev[head] = key;
+        head = key;
+        if (tail == -1) tail = key;
+    }
+    free(prev);
+    free(next);
+    free(cached);
+    return (double)hits/requests;
+}
+
+/* Estimated hit ratio of a cache of 'size' keys: the one of the largest
+ * curve point not above it. */
+static double estimate(uint64_t *sizes, double *hits, int points, long size) {
+    double hit = 0;
+    int j;
+
+    for (j = 0; j < points && sizes[j] <= (uint64_t)size; j++) hit = hits[j];
+    return hit;
+}
+
+int main(int argc, char **argv) {
+    uint64_t sizes[MRC_BUCKETS];
+    double hits[MRC_BUCKETS], maxerr = 0, sumerr = 0;
+    missRatioCurve *mrc;
+    long j, size, distinct, checked = 0;
+    int points;
+
+    for (j = 1; j < argc; j++) {
+        char *opt = argv[j];
+        double val;
+
+        if (j+1 == argc) die("missing option value");
+        val = atof(argv[++j]);
+        if (!strcmp(opt,"-keys")) numkeys = val;
+        else if (!strcmp(opt,"-requests")) requests = val;
+        else if (!strcmp(opt,"-alpha")) alpha = val;
+        else if (!strcmp(opt,"-shift")) shift = val;
+        else if (!strcmp(opt,"-scan-ratio")) scan_ratio = val;
+        else if (!strcmp(opt,"-sample-keys")) sample_keys = val;
+        else if (!strcmp(opt,"-max-error")) max_error = val;
+        else if (!strcmp(opt,"-seed")) seed = val;
+        else die("unknown option");
+    }
+    if (numkeys <= 0 || requests <= 0 || sample_keys <= 0 ||
+        scan_ratio < 0 || scan_ratio >= 1)
+        die("invalid options");
+
+    totalkeys = numkeys*11;
+    distinct = generateTrace();
+    mrc = mrcCreate(sample_keys);
+    for (j = 0; j < requests; j++) mrcAccess(mrc,keyHash(trace[j]));
+    points = mrcCurve(mrc,sizes,hits);
+
+    printf("keys=%ld requests=%ld alpha=%.2f shift=%ld scan-ratio=%.2f "
+           "sample-keys=%ld\n",
+           numkeys, requests, alpha, shift, scan_ratio, sample_keys);
+    printf("distinct keys %ld, sample rate %.6f, estimator memory %zu bytes\n",
+           distinct, mrcSampleRate(mrc), mrcMemory(mrc));
+    printf("%12s %10s %10s %10s\n", "cache keys", "exact", "shards", "error");
+    for (size = 64; size <= distinct; size *= 2) {
+        double exact = simulateLRU(size);
+        double est = estimate(sizes,hits,points,size);
+        double err = fabs(est-exact);
+
+        printf("%12ld %10.4f %10.4f %10.4f\n", size, exact, est, err);
+        if (err > maxerr) maxerr = err;
+        sumerr += err;
+        checked++;
+    }
+    mrcFree(mrc);
+    free(trace);
+    sumerr = checked ? sumerr/checked : 0;
+    printf("mean absolute error %.4f, max %.4f\n", sumerr, maxerr);
+    if (sumerr > max_error) {
+        printf("FAIL: error above %.4f\n", max_error);
+        return 1;
+    }
+    return 0;
+}
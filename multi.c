@@ -177,6 +177,9 @@ void watchForKey(client *c, robj *key) {
     listNode *ln;
     watchedKey *wk;
 
+    /* The list of watched keys is created on the first WATCH. */
+    if (c->watched_keys == NULL) c->watched_keys = listCreate();
+
     /* Check if we are already watching for this key */
     listRewind(c->watched_keys,&li);
     while((ln = listNext(&li))) {
@@ -206,7 +209,7 @@ void unwatchAllKeys(client *c) {
     listIter li;
     listNode *ln;
 
-    if (listLength(c->watched_keys) == 0) return;
+    if (c->watched_keys == NULL || listLength(c->watched_keys) == 0) return;
     listRewind(c->watched_keys,&li);
     while((ln = listNext(&li))) {
         list *clients;
@@ -261,6 +264,7 @@ void touchWatchedKeysOnFlush(int dbid) {
     listRewind(server.clients,&li1);
     while((ln = listNext(&li1))) {
         client *c = listNodeValue(ln);
+        if (c->watched_keys == NULL) continue;
         listRewind(c->watched_keys,&li2);
         while((ln = listNext(&li2))) {
             watchedKey *wk = listNodeValue(ln);
@@ -269,7 +273,7 @@ void touchWatchedKeysOnFlush(int dbid) {
              * key exists, mark the client as dirty, as the key will be
              * removed. */
             if (dbid == -1 || wk->db->id == dbid) {
-                if (dictFind(wk->db->dict, wk->key->ptr) != NULL)
+                if (dbFind(wk->db, wk->key->ptr) != NULL)
                     c->flags |= CLIENT_DIRTY_CAS;
             }
         }
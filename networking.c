@@ -4,6 +4,15 @@
 #include "hiredis.h"
 static void setProtocolError(client *c, int pos);
 
+/* Clients read from the socket into shared_querybuf, a single buffer
+ * reused by all the clients, whenever they have no pending partial command.
+ * The complete commands are processed directly from it and only the
+ * trailing incomplete command, if any, is copied into a private per-client
+ * query buffer that the next reads append to. Once a private buffer is
+ * drained it is released, so idle clients don't hold any query buffer
+ * memory at all (c->querybuf is NULL). */
+static sds shared_querybuf = NULL;
+
 /* Return the size consumed from the allocator, for the specified SDS string,
  * including internal fragmentation. This function is used in order to compute
  * the client output buffer size. */
@@ -12,20 +21,13 @@ size_t sdsZmallocSize(sds s) {
     return zmalloc_size(sh);
 }
 
-/* Return the amount of memory used by the sds string at object->ptr
- * for a string object. */
-size_t getStringObjectSdsUsedMemory(robj *o) {
-    serverAssertWithInfo(NULL,o,o->type == OBJ_STRING);
-    switch(o->encoding) {
-    case OBJ_ENCODING_RAW: return sdsZmallocSize(o->ptr);
-    case OBJ_ENCODING_EMBSTR: return zmalloc_size(o)-sizeof(robj);
-    default: return 0; /* Just integer encoding for now. */
-    }
-}
-
+/* Reply list blocks are plain allocations: duplicating one means copying
+ * it, including the part not yet used. */
 void *dupClientReplyValue(void *o) {
-    incrRefCount((robj*)o);
-    return o;
+    clientReplyBlock *old = o;
+    clientReplyBlock *new = zmalloc(sizeof(clientReplyBlock)+old->size);
+    memcpy(new,old,sizeof(clientReplyBlock)+old->used);
+    return new;
 }
 
 int listMatchObjects(void *a, void *b) {
@@ -40,10 +42,18 @@ client *createClient(int fd) {
      * in the context of a client. When commands are executed in other
      * contexts (for instance a Lua script) we need a non connected client. */
     if (fd != -1) {
+#ifndef HAVE_ACCEPT4
+        /* With accept4() accepted sockets are already non blocking, like
+         * the ones created by the replication non blocking connect. */
         anetNonBlock(NULL,fd);
+#endif
         anetEnableTcpNoDelay(NULL,fd);
         if (server.tcpkeepalive)
             anetKeepAlive(NULL,fd,server.tcpkeepalive);
+        if (server.so_busy_poll &&
+            anetSetBusyPoll(server.neterr,fd,server.so_busy_poll) == ANET_ERR)
+            serverLog(LL_VERBOSE,"Unable to set SO_BUSY_POLL: %s",
+                server.neterr);
         if (aeCreateFileEvent(server.el,fd,AE_READABLE,
             readQueryFromClient, c) == AE_ERR)
         {
@@ -58,11 +68,20 @@ client *createClient(int fd) {
     c->fd = fd;
     c->name = NULL;
     c->bufpos = 0;
-    c->querybuf = sdsempty();
+    c->buf = NULL;
+    c->buf_usable_size = 0;
+    c->buf_peak = 0;
+    c->querybuf = NULL;
+    c->qb_pos = 0;
     c->querybuf_peak = 0;
     c->reqtype = 0;
     c->argc = 0;
+    c->argv_len = 0;
     c->argv = NULL;
+    c->argv_pool_len = 0;
+    c->lane_since = 0;
+    c->priority = CLIENT_PRIORITY_NORMAL;
+    c->resume = NULL;
     c->cmd = c->lastcmd = NULL;
     c->multibulklen = 0;
     c->bulklen = -1;
@@ -78,25 +97,30 @@ client *createClient(int fd) {
     c->slave_listening_port = 0;
     c->slave_ip[0] = '\0';
     c->slave_capa = SLAVE_CAPA_NONE;
-    c->reply = listCreate();
+    /* The reply list, the blocking keys, the watched keys and the Pub/Sub
+     * structures are only needed by a small fraction of the clients, so
+     * they are created the first time they are used. */
+    c->reply = NULL;
     c->reply_bytes = 0;
+    c->reply_deferred = NULL;
     c->obuf_soft_limit_reached_time = 0;
-    listSetFreeMethod(c->reply,decrRefCountVoid);
-    listSetDupMethod(c->reply,dupClientReplyValue);
     c->btype = BLOCKED_NONE;
     c->bpop.timeout = 0;
-    c->bpop.keys = dictCreate(&setDictType,NULL);
+    c->bpop.keys = NULL;
     c->bpop.target = NULL;
     c->bpop.numreplicas = 0;
     c->bpop.reploffset = 0;
     c->woff = 0;
-    c->watched_keys = listCreate();
-    c->pubsub_channels = dictCreate(&setDictType,NULL);
-    c->pubsub_patterns = listCreate();
+    c->watched_keys = NULL;
+    c->pubsub_channels = NULL;
+    c->pubsub_patterns = NULL;
     c->peerid = NULL;
-    listSetFreeMethod(c->pubsub_patterns,decrRefCountVoid);
-    listSetMatchMethod(c->pubsub_patterns,listMatchObjects);
-    if (fd != -1) listAddNodeTail(server.clients,c);
+    if (fd != -1) {
+        listAddNodeTail(server.clients,c);
+        c->client_list_node = listLast(server.clients);
+    } else {
+        c->client_list_node = NULL;
+    }
     // initClientMultiState(c);
     return c;
 }
@@ -139,11 +163,21 @@ int prepareClientToWrite(client *c) {
     if (c->fd <= 0) return C_ERR; /* Fake client for AOF loading. */
 
     /* Schedule the client to write the output buffers to the socket only
-     * if not already done (there were no pending writes already and the client
-     * was yet not flagged), and, for slaves, if the slave can actually
-     * receive writes at this stage. */
-    if (!clientHasPendingReplies(c) &&
-        !(c->flags & CLIENT_PENDING_WRITE) &&
+     * if not already done (there were no pending writes already).
+     * Commands running in parallel can't touch the global list of clients
+     * to write: the main thread does it for them once they are done. */
+    if (!clientHasPendingReplies(c) && !threadexec_parallel)
+        clientInstallWriteHandler(c);
+
+    /* Authorize the caller to queue in the output buffer of this client. */
+    return C_OK;
+}
+
+/* Schedule the client to write its output buffers to the socket, if the
+ * client was yet not flagged, and, for slaves, if the slave can actually
+ * receive writes at this stage. */
+void clientInstallWriteHandler(client *c) {
+    if (!(c->flags & CLIENT_PENDING_WRITE) &&
         (c->replstate == REPL_STATE_NONE ||
          (c->replstate == SLAVE_STATE_ONLINE && !c->repl_put_online_on_ack)))
     {
@@ -156,25 +190,48 @@ int prepareClientToWrite(client *c) {
         c->flags |= CLIENT_PENDING_WRITE;
         listAddNodeHead(server.clients_pending_write,c);
     }
+}
+
+/* Return the client reply list, creating it if this is the first time
+ * the reply does not fit the client reply buffer. */
+static list *clientReplyList(client *c) {
+    if (c->reply == NULL) {
+        c->reply = listCreate();
+        listSetFreeMethod(c->reply,zfree);
+        listSetDupMethod(c->reply,dupClientReplyValue);
+    }
+    return c->reply;
+}
 
-    /* Authorize the caller to queue in the output buffer of this client. */
+/* Make sure the client reply buffer can hold 'needed' bytes, growing it
+ * up to PROTO_REPLY_CHUNK_BYTES. Returns C_ERR if the request can't be
+ * satisfied, so that the caller will use the reply list instead. */
+static int clientReplyBufferReserve(client *c, size_t needed) {
+    size_t newsize;
+
+    if (needed <= c->buf_usable_size) return C_OK;
+    if (needed > PROTO_REPLY_CHUNK_BYTES) return C_ERR;
+
+    newsize = c->buf_usable_size ? c->buf_usable_size*2 : PROTO_REPLY_MIN_BYTES;
+    while (newsize < needed) newsize *= 2;
+    if (newsize > PROTO_REPLY_CHUNK_BYTES) newsize = PROTO_REPLY_CHUNK_BYTES;
+    c->buf = zrealloc(c->buf,newsize);
+    c->buf_usable_size = newsize;
     return C_OK;
 }
 
-/* Create a duplicate of the last object in the reply list when
- * it is not exclusively owned by the reply list. */
-robj *dupLastObjectIfNeeded(list *reply) {
-    robj *new, *cur;
-    listNode *ln;
-    serverAssert(listLength(reply) > 0);
-    ln = listLast(reply);
-    cur = listNodeValue(ln);
-    if (cur->refcount > 1) {
-        new = dupStringObject(cur);
-        decrRefCount(cur);
-        listNodeValue(ln) = new;
+/* Called when the whole output of the client was transmitted. If since the
+ * last time the buffer was drained less than half of it was used, halve it,
+ * so that a client that received a big reply and went back to small replies
+ * (or became idle) slowly returns to PROTO_REPLY_MIN_BYTES. */
+static void clientReplyBufferShrink(client *c) {
+    if (c->buf_usable_size > PROTO_REPLY_MIN_BYTES &&
+        c->buf_peak < c->buf_usable_size/2)
+    {
+        c->buf_usable_size /= 2;
+        c->buf = zrealloc(c->buf,c->buf_usable_size);
     }
-    return listNodeValue(ln);
+    c->buf_peak = 0;
 }
 
 /* -----------------------------------------------------------------------------
@@ -182,112 +239,61 @@ robj *dupLastObjectIfNeeded(list *reply) {
  * -------------------------------------------------------------------------- */
 
 int _addReplyToBuffer(client *c, const char *s, size_t len) {
-    size_t available = sizeof(c->buf)-c->bufpos;
     if (c->flags & CLIENT_CLOSE_AFTER_REPLY) return C_OK;
 
     /* If there already are entries in the reply list, we cannot
      * add anything more to the static buffer. */
-    if (listLength(c->reply) > 0) return C_ERR;
+    if (clientReplyListLength(c) > 0) return C_ERR;
 
-    /* Check that the buffer has enough space available for this string. */
-    if (len > available) return C_ERR;
+    /* Check that the buffer has enough space available for this string,
+     * growing it if needed. */
+    if (clientReplyBufferReserve(c,c->bufpos+len) == C_ERR) return C_ERR;
 
     memcpy(c->buf+c->bufpos,s,len);
     c->bufpos+=len;
+    if ((size_t)c->bufpos > c->buf_peak) c->buf_peak = c->bufpos;
     return C_OK;
 }
 
-void _addReplyObjectToList(client *c, robj *o) {
-    robj *tail;
-
-    if (c->flags & CLIENT_CLOSE_AFTER_REPLY) return;
-
-    if (listLength(c->reply) == 0) {
-        incrRefCount(o);
-        listAddNodeTail(c->reply,o);
-        c->reply_bytes += getStringObjectSdsUsedMemory(o);
-    } else {
-        tail = listNodeValue(listLast(c->reply));
-
-        /* Append to this object when possible. */
-        if (tail->ptr != NULL &&
-            tail->encoding == OBJ_ENCODING_RAW &&
-            sdslen(tail->ptr)+sdslen(o->ptr) <= PROTO_REPLY_CHUNK_BYTES)
-        {
-            c->reply_bytes -= sdsZmallocSize(tail->ptr);
+/* Create a new reply block able to hold at least 'len' bytes, with the
+ * first 'reserved' bytes set aside for a header written later, and append
+ * it to the client reply list. */
+static clientReplyBlock *_addReplyBlock(client *c, size_t len, size_t reserved) {
+    size_t size = len+reserved;
+    clientReplyBlock *block;
 
-            tail = dupLastObjectIfNeeded(c->reply);
-            tail->ptr = sdscatlen(tail->ptr,o->ptr,sdslen(o->ptr));
-            c->reply_bytes += sdsZmallocSize(tail->ptr);
-        } else {
-            incrRefCount(o);
-            listAddNodeTail(c->reply,o);
-            c->reply_bytes += getStringObjectSdsUsedMemory(o);
-        }
-    }
-    asyncCloseClientOnOutputBufferLimitReached(c);
+    if (size < PROTO_REPLY_CHUNK_BYTES) size = PROTO_REPLY_CHUNK_BYTES;
+    block = zmalloc(sizeof(clientReplyBlock)+size);
+    block->size = size;
+    block->used = block->start = reserved;
+    listAddNodeTail(clientReplyList(c),block);
+    c->reply_bytes += size;
+    return block;
 }
 
-/* This method takes responsibility over the sds. When it is no longer
- * needed it will be free'd, otherwise it ends up in a robj. */
-void _addReplySdsToList(client *c, sds s) {
-    robj *tail;
-
-    if (c->flags & CLIENT_CLOSE_AFTER_REPLY) {
-        sdsfree(s);
-        return;
-    }
-
-    if (listLength(c->reply) == 0) {
-        listAddNodeTail(c->reply,createObject(OBJ_STRING,s));
-        c->reply_bytes += sdsZmallocSize(s);
-    } else {
-        tail = listNodeValue(listLast(c->reply));
-
-        /* Append to this object when possible. */
-        if (tail->ptr != NULL && tail->encoding == OBJ_ENCODING_RAW &&
-            sdslen(tail->ptr)+sdslen(s) <= PROTO_REPLY_CHUNK_BYTES)
-        {
-            c->reply_bytes -= sdsZmallocSize(tail->ptr);
-            tail = dupLastObjectIfNeeded(c->reply);
-            tail->ptr = sdscatlen(tail->ptr,s,sdslen(s));
-            c->reply_bytes += sdsZmallocSize(tail->ptr);
-            sdsfree(s);
-        } else {
-            listAddNodeTail(c->reply,createObject(OBJ_STRING,s));
-            c->reply_bytes += sdsZmallocSize(s);
-        }
-    }
-    asyncCloseClientOnOutputBufferLimitReached(c);
-}
-
-void _addReplyStringToList(client *c, const char *s, size_t len) {
-    robj *tail;
+/* Append the protocol in 's' to the reply list: the tail block is filled
+ * first, and what does not fit goes into a new block. */
+void _addReplyProtoToList(client *c, const char *s, size_t len) {
+    clientReplyBlock *tail = NULL;
 
     if (c->flags & CLIENT_CLOSE_AFTER_REPLY) return;
 
-    if (listLength(c->reply) == 0) {
-        robj *o = createStringObject(s,len);
-
-        listAddNodeTail(c->reply,o);
-        c->reply_bytes += getStringObjectSdsUsedMemory(o);
-    } else {
+    if (clientReplyListLength(c))
         tail = listNodeValue(listLast(c->reply));
 
-        /* Append to this object when possible. */
-        if (tail->ptr != NULL && tail->encoding == OBJ_ENCODING_RAW &&
-            sdslen(tail->ptr)+len <= PROTO_REPLY_CHUNK_BYTES)
-        {
-            c->reply_bytes -= sdsZmallocSize(tail->ptr);
-            tail = dupLastObjectIfNeeded(c->reply);
-            tail->ptr = sdscatlen(tail->ptr,s,len);
-            c->reply_bytes += sdsZmallocSize(tail->ptr);
-        } else {
-            robj *o = createStringObject(s,len);
+    if (tail) {
+        size_t avail = tail->size - tail->used;
+        size_t copy = avail >= len ? len : avail;
 
-            listAddNodeTail(c->reply,o);
-            c->reply_bytes += getStringObjectSdsUsedMemory(o);
-        }
+        memcpy(tail->buf+tail->used,s,copy);
+        tail->used += copy;
+        s += copy;
+        len -= copy;
+    }
+    if (len) {
+        tail = _addReplyBlock(c,len,0);
+        memcpy(tail->buf,s,len);
+        tail->used += len;
     }
     asyncCloseClientOnOutputBufferLimitReached(c);
 }
@@ -312,15 +318,14 @@ void addReply(client *c, robj *obj) {
      * messing with its page. */
     if (sdsEncodedObject(obj)) {
         if (_addReplyToBuffer(c,obj->ptr,sdslen(obj->ptr)) != C_OK)
-        {
-            _addReplyObjectToList(c,obj);
-        }
-            
+            _addReplyProtoToList(c,obj->ptr,sdslen(obj->ptr));
     } else if (obj->encoding == OBJ_ENCODING_INT) {
         /* Optimization: if there is room in the static buffer for 32 bytes
          * (more than the max chars a 64 bit integer can take as string) we
          * avoid decoding the object and go for the lower level approach. */
-        if (listLength(c->reply) == 0 && (sizeof(c->buf) - c->bufpos) >= 32) {
+        if (clientReplyListLength(c) == 0 &&
+            clientReplyBufferReserve(c,c->bufpos+32) == C_OK)
+        {
             char buf[32];
             int len;
 
@@ -332,7 +337,7 @@ void addReply(client *c, robj *obj) {
         }
         obj = getDecodedObject(obj);
         if (_addReplyToBuffer(c,obj->ptr,sdslen(obj->ptr)) != C_OK)
-            _addReplyObjectToList(c,obj);
+            _addReplyProtoToList(c,obj->ptr,sdslen(obj->ptr));
         decrRefCount(obj);
     } else {
         serverPanic("Wrong obj->encoding in addReply()");
@@ -345,18 +350,15 @@ void addReplySds(client *c, sds s) {
         sdsfree(s);
         return;
     }
-    if (_addReplyToBuffer(c,s,sdslen(s)) == C_OK) {
-        sdsfree(s);
-    } else {
-        /* This method free's the sds when it is no longer needed. */
-        _addReplySdsToList(c,s);
-    }
+    if (_addReplyToBuffer(c,s,sdslen(s)) != C_OK)
+        _addReplyProtoToList(c,s,sdslen(s));
+    sdsfree(s);
 }
 
 void addReplyString(client *c, const char *s, size_t len) {
     if (prepareClientToWrite(c) != C_OK) return;
     if (_addReplyToBuffer(c,s,len) != C_OK)
-        _addReplyStringToList(c,s,len);
+        _addReplyProtoToList(c,s,len);
 }
 
 void addReplyErrorLength(client *c, const char *s, size_t len) {
@@ -404,41 +406,40 @@ void addReplyStatusFormat(client *c, const char *fmt, ...) {
     sdsfree(s);
 }
 
-/* Adds an empty object to the reply list that will contain the multi bulk
- * length, which is not known when this function is called. */
+/* Starts a new reply block that reserves room at its head for the multi
+ * bulk length, which is not known when this function is called. The
+ * replies that follow are appended after the reserved room, and
+ * setDeferredMultiBulkLength() later writes the length right before them,
+ * so no copy or allocation is needed to fill the header. */
 void *addDeferredMultiBulkLength(client *c) {
     /* Note that we install the write event here even if the object is not
      * ready to be sent, since we are sure that before returning to the
      * event loop setDeferredMultiBulkLength() will be called. */
     if (prepareClientToWrite(c) != C_OK) return NULL;
-    listAddNodeTail(c->reply,createObject(OBJ_STRING,NULL));
+    _addReplyBlock(c,0,PROTO_DEFERRED_HDR_BYTES);
+    if (c->reply_deferred == NULL) c->reply_deferred = listLast(c->reply);
     return listLast(c->reply);
 }
 
-/* Populate the length object and try gluing it to the next chunk. */
+/* Write the length in the room reserved by addDeferredMultiBulkLength(). */
 void setDeferredMultiBulkLength(client *c, void *node, long length) {
     listNode *ln = (listNode*)node;
-    robj *len, *next;
+    clientReplyBlock *block;
+    char hdr[PROTO_DEFERRED_HDR_BYTES];
+    size_t hdrlen;
 
     /* Abort when *node is NULL (see addDeferredMultiBulkLength). */
     if (node == NULL) return;
 
-    len = listNodeValue(ln);
-    len->ptr = sdscatprintf(sdsempty(),"*%ld\r\n",length);
-    len->encoding = OBJ_ENCODING_RAW; /* in case it was an EMBSTR. */
-    c->reply_bytes += sdsZmallocSize(len->ptr);
-    if (ln->next != NULL) {
-        next = listNodeValue(ln->next);
-
-        /* Only glue when the next node is non-NULL (an sds in this case) */
-        if (next->ptr != NULL) {
-            c->reply_bytes -= sdsZmallocSize(len->ptr);
-            c->reply_bytes -= getStringObjectSdsUsedMemory(next);
-            len->ptr = sdscatlen(len->ptr,next->ptr,sdslen(next->ptr));
-            c->reply_bytes += sdsZmallocSize(len->ptr);
-            listDelNode(c->reply,ln->next);
-        }
-    }
+    if (ln == c->reply_deferred) c->reply_deferred = NULL;
+    block = listNodeValue(ln);
+    hdr[0] = '*';
+    hdrlen = 1+ll2string(hdr+1,sizeof(hdr)-3,length);
+    hdr[hdrlen++] = '\r';
+    hdr[hdrlen++] = '\n';
+    serverAssert(block->start == PROTO_DEFERRED_HDR_BYTES && hdrlen <= block->start);
+    block->start -= hdrlen;
+    memcpy(block->buf+block->start,hdr,hdrlen);
     asyncCloseClientOnOutputBufferLimitReached(c);
 }
 
@@ -577,20 +578,48 @@ void addReplyBulkLongLong(client *c, long long ll) {
  * The function takes care of freeing the old output buffers of the
  * destination client. */
 void copyClientOutputBuffer(client *dst, client *src) {
-    listRelease(dst->reply);
-    dst->reply = listDup(src->reply);
+    if (dst->reply) listRelease(dst->reply);
+    dst->reply = src->reply ? listDup(src->reply) : NULL;
+    dst->bufpos = 0;
+    clientReplyBufferReserve(dst,src->bufpos);
     memcpy(dst->buf,src->buf,src->bufpos);
     dst->bufpos = src->bufpos;
     dst->reply_bytes = src->reply_bytes;
+    dst->reply_deferred = NULL;
 }
 
 /* Return true if the specified client has pending reply buffers to write to
- * the socket. */
+ * the socket. The blocks starting from one waiting for its deferred length
+ * can't be sent yet, see resume.c. */
 int clientHasPendingReplies(client *c) {
-    return c->bufpos || listLength(c->reply);
+    if (c->bufpos) return 1;
+    if (clientReplyListLength(c) == 0) return 0;
+    return listFirst(c->reply) != c->reply_deferred;
+}
+
+/* Update the number of connections we are willing to accept in the next
+ * event loop iteration. During a reconnection storm accepting and setting up
+ * thousands of clients in a single iteration would delay the commands of the
+ * already connected clients, so when the last iteration kept the loop busy
+ * for more than server.accept_latency_target microseconds the budget is
+ * halved, otherwise it grows again linearly up to server.max_accepts_per_call.
+ * The connections not accepted stay in the listen backlog and, since the
+ * listening socket is still readable, are picked up in the next iteration.
+ *
+ * Called every time we return from the event loop multiplexing API. */
+void updateAcceptBudget(void) {
+    if (server.el_busy_time > server.accept_latency_target) {
+        server.accept_budget /= 2;
+        if (server.accept_budget < CONFIG_MIN_ACCEPTS_PER_CALL)
+            server.accept_budget = CONFIG_MIN_ACCEPTS_PER_CALL;
+    } else if (server.accept_budget < server.max_accepts_per_call) {
+        server.accept_budget += CONFIG_MIN_ACCEPTS_PER_CALL;
+        if (server.accept_budget > server.max_accepts_per_call)
+            server.accept_budget = server.max_accepts_per_call;
+    }
+    server.accepts_left = server.accept_budget;
 }
 
-#define MAX_ACCEPTS_PER_CALL 1000
 static void acceptCommonHandler(int fd, int flags, char *ip) {
     client *c;
     if ((c = createClient(fd)) == NULL) {
@@ -662,13 +691,13 @@ static void acceptCommonHandler(int fd, int flags, char *ip) {
 }
 
 void acceptTcpHandler(aeEventLoop *el, int fd, void *privdata, int mask) {
-    int cport, cfd, max = MAX_ACCEPTS_PER_CALL;
+    int cport, cfd;
     char cip[NET_IP_STR_LEN];
     UNUSED(el);
     UNUSED(mask);
     UNUSED(privdata);
 
-    while(max--) {
+    while(server.accepts_left > 0) {
         cfd = anetTcpAccept(server.neterr, fd, cip, sizeof(cip), &cport);
         if (cfd == ANET_ERR) {
             if (errno != EWOULDBLOCK)
@@ -676,18 +705,20 @@ void acceptTcpHandler(aeEventLoop *el, int fd, void *privdata, int mask) {
                     "Accepting client connection: %s", server.neterr);
             return;
         }
-        serverLog(LL_WARNING,"Accepted %s:%d id:%d", cip,cport,cfd);
+        server.accepts_left--;
+        serverLog(LL_VERBOSE,"Accepted %s:%d", cip, cport);
         acceptCommonHandler(cfd,0,cip);
     }
+    server.stat_accept_budget_hits++;
 }
 
 void acceptUnixHandler(aeEventLoop *el, int fd, void *privdata, int mask) {
-    int cfd, max = MAX_ACCEPTS_PER_CALL;
+    int cfd;
     UNUSED(el);
     UNUSED(mask);
     UNUSED(privdata);
 
-    while(max--) {
+    while(server.accepts_left > 0) {
         cfd = anetUnixAccept(server.neterr, fd);
         if (cfd == ANET_ERR) {
             if (errno != EWOULDBLOCK)
@@ -695,19 +726,87 @@ void acceptUnixHandler(aeEventLoop *el, int fd, void *privdata, int mask) {
                     "Accepting client connection: %s", server.neterr);
             return;
         }
+        server.accepts_left--;
         serverLog(LL_VERBOSE,"Accepted connection to %s", server.unixsocket);
         acceptCommonHandler(cfd,CLIENT_UNIX_SOCKET,NULL);
     }
+    server.stat_accept_budget_hits++;
+}
+
+/* Argument objects are recycled from one command to the next: when a
+ * command is done, the arguments nobody else took a reference to are moved
+ * to the client argv pool instead of being freed, and the parser fills them
+ * with the arguments of the next command. Objects retained by the keyspace
+ * (or by MULTI, the slow log, ...) have a refcount greater than one at this
+ * point, so they simply leave the pool and live on as normal heap objects.
+ * With a steady stream of commands like GET, parsing a command does no
+ * allocation at all.
+ *
+ * Only string objects whose buffer can be rewritten are recycled: RAW
+ * objects up to PROTO_ARGV_POOL_MAX_ARG bytes, and EMBSTR objects, that are
+ * reused as long as the new argument fits their embedded buffer. */
+static int isRecyclableArgObject(robj *o) {
+    if (o->refcount != 1 || o->type != OBJ_STRING) return 0;
+    if (o->encoding == OBJ_ENCODING_EMBSTR) return 1;
+    return o->encoding == OBJ_ENCODING_RAW &&
+           sdsalloc(o->ptr) <= PROTO_ARGV_POOL_MAX_ARG;
+}
+
+/* Return a string object with a copy of 'ptr', taking it from the client
+ * argv pool when possible. The pool is a stack filled in reverse argument
+ * order, so argument N tends to reuse the object of argument N of the
+ * previous command, that likely has a similar size. */
+static robj *createClientArgObject(client *c, const char *ptr, size_t len) {
+    while (c->argv_pool_len && len <= PROTO_ARGV_POOL_MAX_ARG) {
+        robj *o = c->argv_pool[--c->argv_pool_len];
+        sds s = o->ptr;
+
+        if (sdsalloc(s) < len) {
+            /* Embedded strings can't grow. */
+            if (o->encoding == OBJ_ENCODING_EMBSTR) {
+                decrRefCount(o);
+                continue;
+            }
+            sdsclear(s);
+            s = o->ptr = sdsMakeRoomFor(s,len);
+        }
+        memcpy(s,ptr,len);
+        s[len] = '\0';
+        sdssetlen(s,len);
+        o->lru = objectInitialLRU();
+        return o;
+    }
+    return createStringObject(ptr,len);
+}
+
+/* Make sure the client argv array can hold 'argc' arguments. The array is
+ * kept across commands and only reallocated when it is too small. */
+static void clientArgvReserve(client *c, int argc) {
+    if (argc <= c->argv_len) return;
+    zfree(c->argv);
+    c->argv = zmalloc(sizeof(robj*)*argc);
+    c->argv_len = argc;
 }
 
 static void freeClientArgv(client *c) {
     int j;
-    for (j = 0; j < c->argc; j++)
-        decrRefCount(c->argv[j]);
+    for (j = c->argc-1; j >= 0; j--) {
+        robj *o = c->argv[j];
+
+        if (c->argv_pool_len < PROTO_ARGV_POOL_SIZE && isRecyclableArgObject(o))
+            c->argv_pool[c->argv_pool_len++] = o;
+        else
+            decrRefCount(o);
+    }
     c->argc = 0;
     c->cmd = NULL;
 }
 
+/* Release the argument objects kept for reuse. */
+static void freeClientArgvPool(client *c) {
+    while (c->argv_pool_len) decrRefCount(c->argv_pool[--c->argv_pool_len]);
+}
+
 /* Close all the slaves connections. This is useful in chained replication
  * when we resync with our own master and want to force all our slaves to
  * resync with us as well. */
@@ -732,9 +831,10 @@ void unlinkClient(client *c) {
      * fd is already set to -1. */
     if (c->fd != -1) {
         /* Remove from the list of active clients. */
-        ln = listSearchKey(server.clients,c);
-        serverAssert(ln != NULL);
-        listDelNode(server.clients,ln);
+        if (c->client_list_node) {
+            listDelNode(server.clients,c->client_list_node);
+            c->client_list_node = NULL;
+        }
 
         /* Unregister async I/O handlers and close the socket. */
         aeDeleteFileEvent(server.el,c->fd,AE_READABLE);
@@ -744,6 +844,20 @@ void unlinkClient(client *c) {
     }
 
     /* Remove from the list of pending writes if needed. */
+    if (c->flags & CLIENT_PENDING_COMMAND) threadexecUnqueueClient(c);
+    if (c->flags & CLIENT_PENDING_INPUT) {
+        ln = listSearchKey(server.clients_pending_input,c);
+        serverAssert(ln != NULL);
+        listDelNode(server.clients_pending_input,ln);
+        c->flags &= ~CLIENT_PENDING_INPUT;
+    }
+    if (c->flags & CLIENT_SLOW_LANE) {
+        ln = listSearchKey(server.clients_slow_lane,c);
+        serverAssert(ln != NULL);
+        listDelNode(server.clients_slow_lane,ln);
+        c->flags &= ~CLIENT_SLOW_LANE;
+    }
+    if (c->flags & CLIENT_RESUMING) resumeUnqueueClient(c);
     if (c->flags & CLIENT_PENDING_WRITE) {
         ln = listSearchKey(server.clients_pending_write,c);
         serverAssert(ln != NULL);
@@ -788,26 +902,31 @@ void freeClient(client *c) {
     // }
 
     /* Free the query buffer */
-    sdsfree(c->querybuf);
+    if (c->querybuf == shared_querybuf)
+        sdsclear(shared_querybuf);
+    else
+        sdsfree(c->querybuf);
     c->querybuf = NULL;
 
     /* Deallocate structures used to block on blocking ops. */
     if (c->flags & CLIENT_BLOCKED) unblockClient(c);
-    dictRelease(c->bpop.keys);
+    if (c->bpop.keys) dictRelease(c->bpop.keys);
 
     /* UNWATCH all the keys */
     unwatchAllKeys(c);
-    listRelease(c->watched_keys);
+    if (c->watched_keys) listRelease(c->watched_keys);
 
     /* Unsubscribe from all the pubsub channels */
     // pubsubUnsubscribeAllChannels(c,0);
     // pubsubUnsubscribeAllPatterns(c,0);
-    // dictRelease(c->pubsub_channels);
-    // listRelease(c->pubsub_patterns);
+    if (c->pubsub_channels) dictRelease(c->pubsub_channels);
+    if (c->pubsub_patterns) listRelease(c->pubsub_patterns);
 
     /* Free data structures. */
-    listRelease(c->reply);
+    if (c->reply) listRelease(c->reply);
+    zfree(c->buf);
     freeClientArgv(c);
+    freeClientArgvPool(c);
 
     /* Unlink the client: this will close the socket, remove the I/O
      * handlers, and remove references of the client from different
@@ -875,51 +994,93 @@ void freeClientsInAsyncFreeQueue(void) {
     }
 }
 
+/* Consume 'nwritten' bytes that were transmitted from the head of the
+ * client output buffers: first the reply buffer, then the reply list,
+ * freeing the objects fully sent and updating c->sentlen for the partially
+ * sent one. Empty blocks at the head of the list are released as well. */
+static void clientConsumeOutput(client *c, size_t nwritten) {
+    if (c->bufpos > 0) {
+        size_t left = c->bufpos - c->sentlen;
+
+        if (nwritten < left) {
+            c->sentlen += nwritten;
+            return;
+        }
+        /* If the buffer was sent, set bufpos to zero to continue with
+         * the remainder of the reply. */
+        nwritten -= left;
+        c->bufpos = 0;
+        c->sentlen = 0;
+    }
+
+    while (clientReplyListLength(c)) {
+        listNode *ln = listFirst(c->reply);
+        clientReplyBlock *block = listNodeValue(ln);
+        size_t left = block->used - block->start - c->sentlen;
+
+        if (ln == c->reply_deferred) return;
+
+        if (nwritten < left) {
+            c->sentlen += nwritten;
+            return;
+        }
+        /* We fully sent the block on head, go to the next one. */
+        nwritten -= left;
+        c->reply_bytes -= block->size;
+        listDelNode(c->reply,ln);
+        c->sentlen = 0;
+    }
+}
+
 /* Write data in output buffers to client. Return C_OK if the client
- * is still valid after the call, C_ERR if it was freed. */
+ * is still valid after the call, C_ERR if it was freed.
+ *
+ * The reply buffer and up to IOV_MAX blocks of the reply list are
+ * transmitted with a single writev() call, instead of a write() for each
+ * of them. */
 int writeToClient(int fd, client *c, int handler_installed) {
     ssize_t nwritten = 0, totwritten = 0;
-    size_t objlen;
-    size_t objmem;
-    robj *o;
-    
-    serverLog(LL_WARNING,"writeToClient c->reply length:%zu", 
-            listLength(c->reply));
+    struct iovec iov[IOV_MAX];
+
+    /* Release empty blocks at the head of the list. */
+    clientConsumeOutput(c,0);
     while(clientHasPendingReplies(c)) {
+        int iovcnt = 0;
+        size_t iovbytes = 0, offset = c->sentlen;
+
         if (c->bufpos > 0) {
-            nwritten = write(fd,c->buf+c->sentlen,c->bufpos-c->sentlen);
-            if (nwritten <= 0) break;
-            c->sentlen += nwritten;
-            totwritten += nwritten;
+            iov[iovcnt].iov_base = c->buf+c->sentlen;
+            iov[iovcnt].iov_len = c->bufpos-c->sentlen;
+            iovbytes += iov[iovcnt++].iov_len;
+            offset = 0;
+        }
+        if (clientReplyListLength(c)) {
+            listIter li;
+            listNode *ln;
 
-            /* If the buffer was sent, set bufpos to zero to continue with
-             * the remainder of the reply. */
-            if ((int)c->sentlen == c->bufpos) {
-                c->bufpos = 0;
-                c->sentlen = 0;
+            listRewind(c->reply,&li);
+            while(iovcnt < IOV_MAX && iovbytes < NET_MAX_WRITES_PER_EVENT &&
+                  (ln = listNext(&li)) && ln != c->reply_deferred)
+            {
+                clientReplyBlock *block = listNodeValue(ln);
+                size_t blocklen = block->used - block->start;
+
+                if (blocklen == 0) continue;
+                iov[iovcnt].iov_base = block->buf+block->start+offset;
+                iov[iovcnt].iov_len = blocklen-offset;
+                iovbytes += iov[iovcnt++].iov_len;
+                offset = 0;
             }
-        } else {
-            o = listNodeValue(listFirst(c->reply));
-            objlen = sdslen(o->ptr);
-            objmem = getStringObjectSdsUsedMemory(o);
+        }
 
-            if (objlen == 0) {
-                listDelNode(c->reply,listFirst(c->reply));
-                c->reply_bytes -= objmem;
-                continue;
-            }
-            nwritten = write(fd, ((char*)o->ptr)+c->sentlen,objlen-c->sentlen);
-            if (nwritten <= 0) break;
-            c->sentlen += nwritten;
-            totwritten += nwritten;
+        nwritten = writev(fd,iov,iovcnt);
+        if (nwritten <= 0) break;
+        totwritten += nwritten;
+        clientConsumeOutput(c,nwritten);
+
+        /* A short write means the socket buffer is full. */
+        if ((size_t)nwritten < iovbytes) break;
 
-            /* If we fully sent the object on head go to the next one */
-            if (c->sentlen == objlen) {
-                listDelNode(c->reply,listFirst(c->reply));
-                c->sentlen = 0;
-                c->reply_bytes -= objmem;
-            }
-        }
         /* Note that we avoid to send more than NET_MAX_WRITES_PER_EVENT
          * bytes, in a single threaded server it's a good idea to serve
          * other clients as well, even if a very large request comes from
@@ -952,6 +1113,7 @@ int writeToClient(int fd, client *c, int handler_installed) {
     }
     if (!clientHasPendingReplies(c)) {
         c->sentlen = 0;
+        clientReplyBufferShrink(c);
         if (handler_installed) aeDeleteFileEvent(server.el,c->fd,AE_WRITABLE);
 
         /* Close connection after entire reply has been sent. */
@@ -967,7 +1129,6 @@ int writeToClient(int fd, client *c, int handler_installed) {
 void sendReplyToClient(aeEventLoop *el, int fd, void *privdata, int mask) {
     UNUSED(el);
     UNUSED(mask);
-    printf("sendReplyToClient,fd:%d\n",fd);
     writeToClient(fd,privdata,1);
 }
 
@@ -1025,28 +1186,143 @@ void resetClient(client *c) {
     }
 }
 
+/* Parse the decimal length of a multi bulk or bulk header, that is the
+ * bytes between the type byte and the \r. Lengths sent by clients are almost
+ * always short and positive, so they are handled inline, everything else
+ * is left to string2ll(). Returns 1 on success, 0 on a malformed length. */
+static inline int parseProtoLength(const char *p, size_t len, long long *ll) {
+    long long v = 0;
+    size_t j;
+
+    if (len == 0 || len > 18) return string2ll(p,len,ll);
+    for (j = 0; j < len; j++) {
+        unsigned int d = (unsigned char)p[j] - '0';
+        if (d > 9 || (j == 0 && d == 0 && len > 1)) return string2ll(p,len,ll);
+        v = v*10+d;
+    }
+    *ll = v;
+    return 1;
+}
+
+/* Copy the unprocessed part of the shared query buffer into a private
+ * query buffer for the client, and release the shared one. */
+static void clientDetachSharedQueryBuffer(client *c) {
+    c->querybuf = sdsnewlen(shared_querybuf+c->qb_pos,
+                            sdslen(shared_querybuf)-c->qb_pos);
+    c->qb_pos = 0;
+    sdsclear(shared_querybuf);
+}
+
+/* Called when we are done processing the query buffer of the client:
+ * trim the processed part, keep the residual in a private buffer, and drop
+ * the query buffer entirely when nothing is left in it. */
+static void clientReleaseQueryBuffer(client *c) {
+    if (c->querybuf == shared_querybuf) {
+        if (c->qb_pos < sdslen(c->querybuf)) {
+            clientDetachSharedQueryBuffer(c);
+        } else {
+            sdsclear(shared_querybuf);
+            c->querybuf = NULL;
+            c->qb_pos = 0;
+        }
+        return;
+    }
+    /* A client parked on a command keeps the rest of its pipeline in the
+     * buffer: trim only when the processed part is the bigger one, so that
+     * the commands run one by one don't move the whole rest every time. */
+    if (c->qb_pos &&
+        (!(c->flags & (CLIENT_PENDING_COMMAND|CLIENT_SLOW_LANE|
+                       CLIENT_RESUMING)) ||
+         c->qb_pos*2 >= sdslen(c->querybuf)))
+    {
+        sdsrange(c->querybuf,c->qb_pos,-1);
+        c->qb_pos = 0;
+    }
+    /* Don't free the buffer in the middle of a command: it may be the one
+     * preallocated to receive a big argument. */
+    if (sdslen(c->querybuf) == 0 && !c->reqtype) {
+        sdsfree(c->querybuf);
+        c->querybuf = NULL;
+    }
+}
+
+/* Called by clientsCron(): shrink the private query buffer of the client if
+ * it is much bigger than the recent peak usage, or if the client is idle.
+ * The shared query buffer is never touched. Returns 0, the client is never
+ * freed. */
+int clientsCronResizeQueryBuffer(client *c) {
+    size_t querybuf_size;
+    time_t idletime;
+
+    if (c->querybuf == NULL || c->querybuf == shared_querybuf) {
+        c->querybuf_peak = 0;
+        return 0;
+    }
+    querybuf_size = sdsAllocSize(c->querybuf);
+    idletime = server.unixtime - c->lastinteraction;
+
+    /* Only resize the query buffer if it is actually wasting space. */
+    if (((querybuf_size > PROTO_MBULK_BIG_ARG) &&
+         (querybuf_size/(c->querybuf_peak+1)) > 2) ||
+        (querybuf_size > 1024 && idletime > 2))
+    {
+        if (sdsavail(c->querybuf) > 1024)
+            c->querybuf = sdsRemoveFreeSpace(c->querybuf);
+    }
+    /* Reset the peak again to capture the peak memory usage in the next
+     * cycle. */
+    c->querybuf_peak = 0;
+    return 0;
+}
+
+/* Called by clientsCron(): free the reply buffer of a client that has been
+ * idle for PROTO_REPLY_IDLE_SECS with nothing left to send. The next reply
+ * allocates it again at PROTO_REPLY_MIN_BYTES. A buffer still in use only
+ * shrinks when drained, see clientReplyBufferShrink(). Returns 0, the
+ * client is never freed. */
+int clientsCronResizeReplyBuffer(client *c) {
+    if (c->buf == NULL || c->bufpos != 0 || clientHasPendingReplies(c))
+        return 0;
+    if (server.unixtime - c->lastinteraction < PROTO_REPLY_IDLE_SECS)
+        return 0;
+    zfree(c->buf);
+    c->buf = NULL;
+    c->buf_usable_size = 0;
+    c->buf_peak = 0;
+    return 0;
+}
+
+/* Search the \r ending the header line starting at c->querybuf+pos. Unlike
+ * strchr() the scan is bounded by the buffer length, does not stop at
+ * binary zeros and uses the vectorized memchr() of the C library. */
+static inline char *findProtoLineEnd(client *c, size_t pos) {
+    return memchr(c->querybuf+pos,'\r',sdslen(c->querybuf)-pos);
+}
+
 int processInlineBuffer(client *c) {
-    char *newline;
-    int argc, j;
+    char *newline, *start = c->querybuf+c->qb_pos;
+    int argc, j, linefeed_chars = 1;
     sds *argv, aux;
     size_t querylen;
 
     /* Search for end of line */
-    newline = strchr(c->querybuf,'\n');
+    newline = memchr(start,'\n',sdslen(c->querybuf)-c->qb_pos);
     /* Nothing to do without a \r\n */
     if (newline == NULL) {
-        if (sdslen(c->querybuf) > PROTO_INLINE_MAX_SIZE) {
+        if (sdslen(c->querybuf)-c->qb_pos > PROTO_INLINE_MAX_SIZE) {
             addReplyError(c,"Protocol error: too big inline request");
             setProtocolError(c,0);
         }
         return C_ERR;
     }
     /* Handle the \r\n case. */
-    if (newline && newline != c->querybuf && *(newline-1) == '\r')
+    if (newline != start && *(newline-1) == '\r') {
         newline--;
+        linefeed_chars++;
+    }
     /* Split the input buffer up to the \r\n */
-    querylen = newline-(c->querybuf);
-    aux = sdsnewlen(c->querybuf,querylen);
+    querylen = newline-start;
+    aux = sdsnewlen(start,querylen);
     argv = sdssplitargs(aux,&argc);
     sdsfree(aux);
     if (argv == NULL) {
@@ -1060,14 +1336,11 @@ int processInlineBuffer(client *c) {
     if (querylen == 0 && c->flags & CLIENT_SLAVE)
         c->repl_ack_time = server.unixtime;
 
-    /* Leave data after the first line of the query in the buffer */
-    sdsrange(c->querybuf,querylen+2,-1);
+    /* Move querybuffer position to the next query in the buffer. */
+    c->qb_pos += querylen+linefeed_chars;
 
     /* Setup argv array on client structure */
-    if (argc) {
-        if (c->argv) zfree(c->argv);
-        c->argv = zmalloc(sizeof(robj*)*argc);
-    }
+    if (argc) clientArgvReserve(c,argc);
 
     /* Create redis objects for all arguments. */
     for (c->argc = 0, j = 0; j < argc; j++) {
@@ -1092,22 +1365,29 @@ static void setProtocolError(client *c, int pos) {
         sdsfree(client);
     }
     c->flags |= CLIENT_CLOSE_AFTER_REPLY;
-    sdsrange(c->querybuf,pos,-1);
+    c->qb_pos += pos;
 }
 
+/* Parse the multi bulk request starting at c->querybuf+c->qb_pos. The
+ * parse state (c->multibulklen, c->bulklen and the arguments already
+ * created) survives across calls, so when a request arrives in several
+ * reads we resume from the first argument not yet complete instead of
+ * scanning the request again from its start. c->qb_pos is advanced past
+ * every complete header or argument: the buffer is trimmed only once per
+ * read, by processInputBuffer(). */
 int processMultibulkBuffer(client *c) {
-
     char *newline = NULL;
-    int pos = 0, ok;
+    int ok;
     long long ll;
 
     if (c->multibulklen == 0) {
         /* The client should have been reset */
         serverAssertWithInfo(c,NULL,c->argc == 0);
+
         /* Multi bulk length cannot be read without a \r\n */
-        newline = strchr(c->querybuf,'\r'); 
+        newline = findProtoLineEnd(c,c->qb_pos);
         if (newline == NULL) {
-            if (sdslen(c->querybuf) > PROTO_INLINE_MAX_SIZE) {
+            if (sdslen(c->querybuf)-c->qb_pos > PROTO_INLINE_MAX_SIZE) {
                 addReplyError(c,"Protocol error: too big mbulk count string");
                 setProtocolError(c,0);
             }
@@ -1118,33 +1398,30 @@ int processMultibulkBuffer(client *c) {
             return C_ERR;
         /* We know for sure there is a whole line since newline != NULL,
          * so go ahead and find out the multi bulk length. */
-        serverAssertWithInfo(c,NULL,c->querybuf[0] == '*');
-        ok = string2ll(c->querybuf+1,newline-(c->querybuf+1),&ll);
+        serverAssertWithInfo(c,NULL,c->querybuf[c->qb_pos] == '*');
+        ok = parseProtoLength(c->querybuf+c->qb_pos+1,
+                              newline-(c->querybuf+c->qb_pos+1),&ll);
         if (!ok || ll > 1024*1024) {
             addReplyError(c,"Protocol error: invalid multibulk length");
-            setProtocolError(c,pos);
+            setProtocolError(c,0);
             return C_ERR;
         }
-        
-        pos = (newline-c->querybuf)+2;
-        if (ll <= 0) {
-            sdsrange(c->querybuf,pos,-1);
-            return C_OK;
-        }
+
+        c->qb_pos = (newline-c->querybuf)+2;
+        if (ll <= 0) return C_OK;
+
         c->multibulklen = ll;
         /* Setup argv array on client structure */
-        if (c->argv) zfree(c->argv);
-        c->argv = zmalloc(sizeof(robj*)*c->multibulklen);
+        clientArgvReserve(c,c->multibulklen);
     }
-    serverLog(LL_WARNING,"processMultibulkBuffer c->multibulklen:%d", 
-            c->multibulklen);
+
     serverAssertWithInfo(c,NULL,c->multibulklen > 0);
     while(c->multibulklen) {
-        /* Read bulk length if unknown */ 
+        /* Read bulk length if unknown */
         if (c->bulklen == -1) {
-            newline = strchr(c->querybuf+pos,'\r');
+            newline = findProtoLineEnd(c,c->qb_pos);
             if (newline == NULL) {
-                if (sdslen(c->querybuf) > PROTO_INLINE_MAX_SIZE) {
+                if (sdslen(c->querybuf)-c->qb_pos > PROTO_INLINE_MAX_SIZE) {
                     addReplyError(c,
                         "Protocol error: too big bulk count string");
                     setProtocolError(c,0);
@@ -1155,30 +1432,34 @@ int processMultibulkBuffer(client *c) {
             /* Buffer should also contain \n */
             if (newline-(c->querybuf) > ((signed)sdslen(c->querybuf)-2))
                 break;
-            if (c->querybuf[pos] != '$') {
+            if (c->querybuf[c->qb_pos] != '$') {
                 addReplyErrorFormat(c,
                     "Protocol error: expected '$', got '%c'",
-                    c->querybuf[pos]);
-                setProtocolError(c,pos);
+                    c->querybuf[c->qb_pos]);
+                setProtocolError(c,0);
                 return C_ERR;
             }
 
-            ok = string2ll(c->querybuf+pos+1,newline-(c->querybuf+pos+1),&ll);
+            ok = parseProtoLength(c->querybuf+c->qb_pos+1,
+                                  newline-(c->querybuf+c->qb_pos+1),&ll);
             if (!ok || ll < 0 || ll > 512*1024*1024) {
                 addReplyError(c,"Protocol error: invalid bulk length");
-                setProtocolError(c,pos);
+                setProtocolError(c,0);
                 return C_ERR;
             }
-            
-            pos += newline-(c->querybuf+pos)+2;
+
+            c->qb_pos = newline-c->querybuf+2;
             if (ll >= PROTO_MBULK_BIG_ARG) {
                 size_t qblen;
                 /* If we are going to read a large object from network
                  * try to make it likely that it will start at c->querybuf
                  * boundary so that we can optimize object creation
-                 * avoiding a large copy of data. */
-                sdsrange(c->querybuf,pos,-1);
-                pos = 0;
+                 * avoiding a large copy of data. The shared buffer can't
+                 * be handed over to the object, so move to a private one. */
+                if (c->querybuf == shared_querybuf)
+                    clientDetachSharedQueryBuffer(c);
+                sdsrange(c->querybuf,c->qb_pos,-1);
+                c->qb_pos = 0;
                 qblen = sdslen(c->querybuf);
                 /* Hint the sds library about the amount of bytes this string is
                  * going to contain. */
@@ -1189,17 +1470,16 @@ int processMultibulkBuffer(client *c) {
         }
 
         /* Read bulk argument */
-        if (sdslen(c->querybuf)-pos < (unsigned)(c->bulklen+2)) {
+        if (sdslen(c->querybuf)-c->qb_pos < (size_t)(c->bulklen+2)) {
             /* Not enough data (+2 == trailing \r\n) */
             break;
         } else {
-                
             /* Optimization: if the buffer contains JUST our bulk element
              * instead of creating a new object by *copying* the sds we
              * just use the current sds string. */
-            if (pos == 0 &&
+            if (c->qb_pos == 0 &&
                 c->bulklen >= PROTO_MBULK_BIG_ARG &&
-                (signed) sdslen(c->querybuf) == c->bulklen+2)
+                sdslen(c->querybuf) == (size_t)(c->bulklen+2))
             {
                 c->argv[c->argc++] = createObject(OBJ_STRING,c->querybuf);
                 sdsIncrLen(c->querybuf,-2); /* remove CRLF */
@@ -1207,23 +1487,16 @@ int processMultibulkBuffer(client *c) {
                  * likely... */
                 c->querybuf = sdsnewlen(NULL,c->bulklen+2);
                 sdsclear(c->querybuf);
-                pos = 0;
             } else {
-                c->argv[c->argc++] =
-                    createStringObject(c->querybuf+pos,c->bulklen);
-                pos += c->bulklen+2;
+                c->argv[c->argc++] = createClientArgObject(c,
+                    c->querybuf+c->qb_pos,c->bulklen);
+                c->qb_pos += c->bulklen+2;
             }
             c->bulklen = -1;
             c->multibulklen--;
         }
     }
 
-    /* Trim to pos */
-    // serverLog(LL_WARNING,"processMultibulkBuffer before sdsrange c->querybuf %zu:%zu", 
-            // sdslen(c->querybuf),sdsavail(c->querybuf));
-    if (pos) sdsrange(c->querybuf,pos,-1);
-    // serverLog(LL_WARNING,"processMultibulkBuffer after sdsrange c->querybuf %zu:%zu", 
-    //         sdslen(c->querybuf),sdsavail(c->querybuf));
     /* We're done when c->multibulk == 0 */
     if (c->multibulklen == 0) return C_OK;
 
@@ -1231,17 +1504,58 @@ int processMultibulkBuffer(client *c) {
     return C_ERR;
 }
 
+/* Account a batch of 'count' commands executed back to back for the same
+ * client, that is, the depth of the pipeline we found in its query buffer. */
+static void statPipelineBatch(int count) {
+    int bucket = 0;
+
+    if (count == 0) return;
+    while (count > 1 && bucket < STATS_PIPELINE_DEPTH_BUCKETS-1) {
+        count >>= 1;
+        bucket++;
+    }
+    server.stat_pipeline_depth[bucket]++;
+    server.stat_pipeline_batches++;
+}
+
+/* This function is called every time, in the client structure 'c', there is
+ * more query buffer to process, because we read more data from the socket
+ * or because a client was blocked and later reactivated, so there could be
+ * pending query buffer, already representing a full command, to process.
+ *
+ * At most server.max_commands_per_event commands are executed per call, so
+ * that a client sending a deep pipeline can't starve the others: when the
+ * budget is used the client is queued in server.clients_pending_input and
+ * the rest of its commands run in the next event loop iterations. The
+ * replies of the whole batch accumulate in the client output buffer and are
+ * sent with a single write by handleClientsWithPendingWrites(). */
 void processInputBuffer(client *c) {
+    int processed = 0;
+
     server.current_client = c;
+    if (c->querybuf == NULL) {
+        server.current_client = NULL;
+        return;
+    }
     /* Keep processing while there is something in the input buffer */
-    serverLog(LL_WARNING,"processInputBuffer %zu:%zu,value:%s", 
-            sdslen(c->querybuf),sdsavail(c->querybuf),c->querybuf);
-    while(sdslen(c->querybuf)) {
+    while(c->qb_pos < sdslen(c->querybuf)) {
+        /* Leave the rest for the next iteration if the budget is used. */
+        if (processed == server.max_commands_per_event) {
+            if (!(c->flags & CLIENT_PENDING_INPUT)) {
+                c->flags |= CLIENT_PENDING_INPUT;
+                listAddNodeTail(server.clients_pending_input,c);
+            }
+            server.stat_pipeline_budget_hits++;
+            break;
+        }
+
         /* Return if clients are paused. */
         if (!(c->flags & CLIENT_SLAVE) && clientsArePaused()) break;
 
         /* Immediately abort if the client is in the middle of something. */
-        if (c->flags & CLIENT_BLOCKED) break;
+        if (c->flags & (CLIENT_BLOCKED|CLIENT_PENDING_COMMAND|CLIENT_SLOW_LANE|
+                        CLIENT_RESUMING))
+            break;
 
         /* CLIENT_CLOSE_AFTER_REPLY closes the connection once the reply is
          * written to the client. Make sure to not let the reply grow after
@@ -1252,12 +1566,12 @@ void processInputBuffer(client *c) {
 
         /* Determine request type when unknown. */
         if (!c->reqtype) {
-            if (c->querybuf[0] == '*') {
+            if (c->querybuf[c->qb_pos] == '*') {
                 c->reqtype = PROTO_REQ_MULTIBULK;
             } else {
                 c->reqtype = PROTO_REQ_INLINE;
             }
-        }     
+        }
         if (c->reqtype == PROTO_REQ_INLINE) {
             if (processInlineBuffer(c) != C_OK) break;
         } else if (c->reqtype == PROTO_REQ_MULTIBULK) {
@@ -1270,17 +1584,28 @@ void processInputBuffer(client *c) {
         if (c->argc == 0) {
             resetClient(c);
         } else {
-            /* Only reset the client when the command was executed. */
-            if (processCommand(c) == C_OK)
-            {
+            /* Only reset the client when the command was executed. A
+             * command queued for the threads or in the slow lane is not
+             * executed yet, a resumable one is not completed. */
+            if (processCommand(c) == C_OK &&
+                !(c->flags & (CLIENT_PENDING_COMMAND|CLIENT_SLOW_LANE|
+                              CLIENT_RESUMING)))
                 resetClient(c);
-            }
-                
+            processed++;
+
             /* freeMemoryIfNeeded may flush slave output buffers. This may result
              * into a slave, that may be the active client, to be freed. */
-            if (server.current_client == NULL) break;
+            if (server.current_client == NULL) {
+                statPipelineBatch(processed);
+                return;
+            }
         }
     }
+    statPipelineBatch(processed);
+
+    /* Trim the query buffer once, now that all the complete commands it
+     * contained were processed. */
+    clientReleaseQueryBuffer(c);
     server.current_client = NULL;
 }
 
@@ -1301,18 +1626,32 @@ void readQueryFromClient(aeEventLoop *el, int fd, void *privdata, int mask) {
     if (c->reqtype == PROTO_REQ_MULTIBULK && c->multibulklen && c->bulklen != -1
         && c->bulklen >= PROTO_MBULK_BIG_ARG)
     {
-        int remaining = (unsigned)(c->bulklen+2)-sdslen(c->querybuf);
+        int remaining = (unsigned)(c->bulklen+2)-
+                        (sdslen(c->querybuf)-c->qb_pos);
         if (remaining < readlen) readlen = remaining;
     }
 
+    /* Without a pending partial command read into the shared buffer. Only
+     * the master keeps a private one, since its stream is never idle. */
+    if (c->querybuf == NULL) {
+        if (c->flags & CLIENT_MASTER) {
+            c->querybuf = sdsempty();
+        } else {
+            if (shared_querybuf == NULL) {
+                shared_querybuf = sdsnewlen(NULL,PROTO_IOBUF_LEN);
+                sdsclear(shared_querybuf);
+            }
+            c->querybuf = shared_querybuf;
+        }
+    }
+
     qblen = sdslen(c->querybuf);
     if (c->querybuf_peak < qblen) c->querybuf_peak = qblen;
     c->querybuf = sdsMakeRoomFor(c->querybuf, readlen);
-    serverLog(LL_WARNING,"readQueryFromClient qblen:%zu,readlen:%d,c->querybuf %zu:%zu", 
-            qblen,readlen,sdslen(c->querybuf),sdsavail(c->querybuf));
     nread = read(fd, c->querybuf+qblen, readlen);
     if (nread == -1) {
         if (errno == EAGAIN) {
+            clientReleaseQueryBuffer(c);
             return;
         } else {
             serverLog(LL_VERBOSE, "Reading from client: %s",strerror(errno));
@@ -1331,7 +1670,9 @@ void readQueryFromClient(aeEventLoop *el, int fd, void *privdata, int mask) {
     server.stat_net_input_bytes += nread;
     
     // 单个客户端发送数据总量控制
-    if (sdslen(c->querybuf) > server.client_max_querybuf_len) {
+    if (c->querybuf != shared_querybuf &&
+        sdslen(c->querybuf) > server.client_max_querybuf_len)
+    {
         sds ci = catClientInfoString(sdsempty(),c), bytes = sdsempty();
         bytes = sdscatrepr(bytes,c->querybuf,64);
         serverLog(LL_WARNING,"Closing client that reached max query buffer length: %s (qbuf initial bytes: %s)", ci, bytes);
@@ -1340,9 +1681,152 @@ void readQueryFromClient(aeEventLoop *el, int fd, void *privdata, int mask) {
         freeClient(c);
         return;
     }
+
+    /* Clients with commands left over by the budget are served in order
+     * by handleClientsWithPendingInput(), one batch per iteration. */
+    if (c->flags & CLIENT_PENDING_INPUT) return;
     processInputBuffer(c);
 }
 
+/* This function is called just before entering the event loop, in order to
+ * run the next batch of commands of the clients that used their budget in
+ * processInputBuffer(). Clients still having commands after this batch are
+ * queued again. Returns the number of clients served. */
+int handleClientsWithPendingInput(void) {
+    int processed = 0, count = listLength(server.clients_pending_input);
+
+    while (count--) {
+        listNode *ln = listFirst(server.clients_pending_input);
+        client *c;
+
+        /* Processing a client may free other clients in the list. */
+        if (ln == NULL) break;
+        c = listNodeValue(ln);
+        c->flags &= ~CLIENT_PENDING_INPUT;
+        listDelNode(server.clients_pending_input,ln);
+        processInputBuffer(c);
+        processed++;
+    }
+    return processed;
+}
+
+/* Account the latency of a command executed by the given lane: the usec
+ * from 'since', the moment the event loop woke up to serve it, to now. So
+ * the time a command waited for the ones executed before it in the same
+ * iteration is included, which is what the lanes are meant to reduce. */
+void statLaneLatency(client *c, int lane, long long since) {
+    long long usec;
+    int bucket = 0;
+
+    if (c->fd <= 0 || since == 0) return;
+    usec = ustime()-since;
+    while (usec > 1 && bucket < STATS_LANE_LATENCY_BUCKETS-1) {
+        usec >>= 1;
+        bucket++;
+    }
+    server.stat_lane_latency[lane][bucket]++;
+    server.stat_lane_calls[lane]++;
+}
+
+/* Called by processCommand() when a command is ready to be executed. If it
+ * is not flagged CMD_FAST, the client is queued in the slow lane, flagged
+ * CLIENT_SLOW_LANE, and C_OK is returned: the command runs later in
+ * handleClientsInSlowLane(), after the fast commands of the clients served
+ * in the same iteration. Otherwise C_ERR is returned and the caller
+ * executes the command right away, as it does for the slow commands that
+ * follow in the pipeline of the client handleClientsInSlowLane() is serving,
+ * while the lane budget lasts. */
+int clientQueueSlowLane(client *c) {
+    if (!server.slow_lane || c->cmd->flags & CMD_FAST) return C_ERR;
+    if (c->flags & (CLIENT_MASTER|CLIENT_LUA) || c->fd <= 0) return C_ERR;
+    if (c == server.slow_lane_client && server.slow_lane_left > 0) {
+        server.slow_lane_left--;
+        return C_ERR;
+    }
+
+    c->flags |= CLIENT_SLOW_LANE;
+    c->lane_since = server.el_wakeup_time;
+    listAddNodeTail(server.clients_slow_lane,c);
+    server.stat_slow_lane_deferred++;
+    return C_OK;
+}
+
+/* This function is called just before entering the event loop, after the
+ * fast commands were served, in order to run the slow lane. Clients are
+ * served round robin, each one running the commands it has in its query
+ * buffer, and at most server.slow_lane_budget slow commands are executed
+ * in total, so that the fast commands
+ * read in the next iteration don't wait for a long list of slow ones.
+ * Returns the number of commands executed. */
+int handleClientsInSlowLane(void) {
+    int processed = 0;
+
+    while (listLength(server.clients_slow_lane)) {
+        listNode *ln = listFirst(server.clients_slow_lane);
+        client *c;
+
+        if (processed == server.slow_lane_budget) {
+            server.stat_slow_lane_budget_hits++;
+            break;
+        }
+        c = listNodeValue(ln);
+        c->flags &= ~CLIENT_SLOW_LANE;
+        listDelNode(server.clients_slow_lane,ln);
+
+        /* A DB may have been locked since the write was queued. */
+        if (resumeQueueWrite(c) == C_OK) continue;
+
+        server.current_client = c;
+        call(c,CMD_CALL_FULL);
+        c->woff = server.master_repl_offset;
+        statLaneLatency(c,LANE_SLOW,c->lane_since);
+        server.current_client = NULL;
+        processed++;
+
+        /* A resumable command goes on in handleResumableCommands(). */
+        if (c->flags & CLIENT_RESUMING) continue;
+
+        /* Go on with the commands the client already sent in a single
+         * processInputBuffer() call: its slow commands run inline until the
+         * lane budget is used, then the next one is queued at the tail. */
+        resetClient(c);
+        if (!(c->flags & CLIENT_PENDING_INPUT)) {
+            server.slow_lane_client = c;
+            server.slow_lane_left = server.slow_lane_budget-processed;
+            processInputBuffer(c);
+            processed = server.slow_lane_budget-server.slow_lane_left;
+            server.slow_lane_client = NULL;
+        }
+    }
+    return processed;
+}
+
+/* Return the memory used by the clients idle for PROTO_REPLY_IDLE_SECS or
+ * more with nothing to send, that is the client structure and its query and
+ * reply buffers, and set 'idle_clients' to their number. */
+size_t getClientsIdleMemory(unsigned long *idle_clients) {
+    client *c;
+    listNode *ln;
+    listIter li;
+    unsigned long idle = 0;
+    size_t mem = 0;
+
+    listRewind(server.clients,&li);
+    while ((ln = listNext(&li)) != NULL) {
+        c = listNodeValue(ln);
+
+        if (clientHasPendingReplies(c) ||
+            server.unixtime - c->lastinteraction < PROTO_REPLY_IDLE_SECS)
+            continue;
+        idle++;
+        mem += sizeof(client) + c->buf_usable_size;
+        if (c->querybuf && c->querybuf != shared_querybuf)
+            mem += sdsAllocSize(c->querybuf);
+    }
+    *idle_clients = idle;
+    return mem;
+}
+
 void getClientsMaxBuffers(unsigned long *longest_output_list,
                           unsigned long *biggest_input_buffer) {
     client *c;
@@ -1354,8 +1838,9 @@ void getClientsMaxBuffers(unsigned long *longest_output_list,
     while ((ln = listNext(&li)) != NULL) {
         c = listNodeValue(ln);
 
-        if (listLength(c->reply) > lol) lol = listLength(c->reply);
-        if (sdslen(c->querybuf) > bib) bib = sdslen(c->querybuf);
+        if (clientReplyListLength(c) > lol) lol = clientReplyListLength(c);
+        if (c->querybuf && sdslen(c->querybuf) > bib)
+            bib = sdslen(c->querybuf);
     }
     *longest_output_list = lol;
     *biggest_input_buffer = bib;
@@ -1428,7 +1913,7 @@ sds catClientInfoString(sds s, client *client) {
     if (emask & AE_WRITABLE) *p++ = 'w';
     *p = '\0';
     return sdscatfmt(s,
-        "id=%U addr=%s fd=%i name=%s age=%I idle=%I flags=%s db=%i sub=%i psub=%i multi=%i qbuf=%U qbuf-free=%U obl=%U oll=%U omem=%U events=%s cmd=%s",
+        "id=%U addr=%s fd=%i name=%s age=%I idle=%I flags=%s db=%i sub=%i psub=%i multi=%i qbuf=%U qbuf-free=%U obl=%U oll=%U omem=%U events=%s cmd=%s prio=%s",
         (unsigned long long) client->id,
         getClientPeerId(client),
         client->fd,
@@ -1437,16 +1922,17 @@ sds catClientInfoString(sds s, client *client) {
         (long long)(server.unixtime - client->lastinteraction),
         flags,
         client->db->id,
-        (int) dictSize(client->pubsub_channels),
-        (int) listLength(client->pubsub_patterns),
+        client->pubsub_channels ? (int) dictSize(client->pubsub_channels) : 0,
+        client->pubsub_patterns ? (int) listLength(client->pubsub_patterns) : 0,
         (client->flags & CLIENT_MULTI) ? client->mstate.count : -1,
-        (unsigned long long) sdslen(client->querybuf),
-        (unsigned long long) sdsavail(client->querybuf),
+        (unsigned long long) (client->querybuf ? sdslen(client->querybuf) : 0),
+        (unsigned long long) (client->querybuf ? sdsavail(client->querybuf) : 0),
         (unsigned long long) client->bufpos,
-        (unsigned long long) listLength(client->reply),
+        (unsigned long long) clientReplyListLength(client),
         (unsigned long long) getClientOutputBufferMemoryUsage(client),
         events,
-        client->lastcmd ? client->lastcmd->name : "NULL");
+        client->lastcmd ? client->lastcmd->name : "NULL",
+        getClientPriorityName(client->priority));
 }
 
 sds getAllClientsInfoString(void) {
@@ -1464,6 +1950,21 @@ sds getAllClientsInfoString(void) {
     return o;
 }
 
+int getClientPriorityByName(char *name) {
+    if (!strcasecmp(name,"low")) return CLIENT_PRIORITY_LOW;
+    else if (!strcasecmp(name,"normal")) return CLIENT_PRIORITY_NORMAL;
+    else if (!strcasecmp(name,"high")) return CLIENT_PRIORITY_HIGH;
+    else return -1;
+}
+
+char *getClientPriorityName(int priority) {
+    switch(priority) {
+    case CLIENT_PRIORITY_LOW: return "low";
+    case CLIENT_PRIORITY_HIGH: return "high";
+    default: return "normal";
+    }
+}
+
 void clientCommand(client *c) {
     listNode *ln;
     listIter li;
@@ -1511,8 +2012,8 @@ void clientCommand(client *c) {
                 if (!strcasecmp(c->argv[i]->ptr,"id") && moreargs) {
                     long long tmp;
 
-                    // if (getLongLongFromObjectOrReply(c,c->argv[i+1],&tmp,NULL)
-                    //     != C_OK) return;
+                    if (getLongLongFromObjectOrReply(c,c->argv[i+1],&tmp,NULL)
+                        != C_OK) return;
                     id = tmp;
                 } else if (!strcasecmp(c->argv[i]->ptr,"type") && moreargs) {
                     type = getClientTypeByName(c->argv[i+1]->ptr);
@@ -1608,14 +2109,27 @@ void clientCommand(client *c) {
         else
             addReply(c,shared.nullbulk);
     } else if (!strcasecmp(c->argv[1]->ptr,"pause") && c->argc == 3) {
-        // long long duration;
+        /* Paused clients are resumed by processUnblockedClients(), that
+         * this server doesn't run yet: refuse instead of pausing forever. */
+        addReplyError(c,"CLIENT PAUSE is not supported");
+    } else if (!strcasecmp(c->argv[1]->ptr,"priority") &&
+               (c->argc == 2 || c->argc == 3))
+    {
+        /* CLIENT PRIORITY [LOW|NORMAL|HIGH] */
+        if (c->argc == 3) {
+            int priority = getClientPriorityByName(c->argv[2]->ptr);
 
-        // if (getTimeoutFromObjectOrReply(c,c->argv[2],&duration,UNIT_MILLISECONDS)
-        //                                 != C_OK) return;
-        // pauseClients(duration);
-        // addReply(c,shared.ok);
+            if (priority == -1) {
+                addReply(c,shared.syntaxerr);
+                return;
+            }
+            c->priority = priority;
+            addReply(c,shared.ok);
+        } else {
+            addReplyBulkCString(c,getClientPriorityName(c->priority));
+        }
     } else {
-        addReplyError(c, "Syntax error, try CLIENT (LIST | KILL | GETNAME | SETNAME | PAUSE | REPLY)");
+        addReplyError(c, "Syntax error, try CLIENT (LIST | KILL | GETNAME | SETNAME | PAUSE | REPLY | PRIORITY)");
     }
 }
 
@@ -1663,6 +2177,7 @@ void rewriteClientCommandVector(client *c, int argc, ...) {
     zfree(c->argv);
     /* Replace argv and argc with our new versions. */
     c->argv = argv;
+    c->argv_len = argc;
     c->argc = argc;
     c->cmd = lookupCommandOrOriginal(c->argv[0]->ptr);
     serverAssertWithInfo(c,NULL,c->cmd != NULL);
@@ -1674,6 +2189,7 @@ void replaceClientCommandVector(client *c, int argc, robj **argv) {
     freeClientArgv(c);
     zfree(c->argv);
     c->argv = argv;
+    c->argv_len = argc;
     c->argc = argc;
     c->cmd = lookupCommandOrOriginal(c->argv[0]->ptr);
     serverAssertWithInfo(c,NULL,c->cmd != NULL);
@@ -1693,8 +2209,11 @@ void replaceClientCommandVector(client *c, int argc, robj **argv) {
 void rewriteClientCommandArgument(client *c, int i, robj *newval) {
     robj *oldval;
 
-    if (i >= c->argc) {
+    if (i >= c->argv_len) {
         c->argv = zrealloc(c->argv,sizeof(robj*)*(i+1));
+        c->argv_len = i+1;
+    }
+    if (i >= c->argc) {
         c->argc = i+1;
         c->argv[i] = NULL;
     }
@@ -1712,21 +2231,18 @@ void rewriteClientCommandArgument(client *c, int i, robj *newval) {
 
 /* This function returns the number of bytes that Redis is virtually
  * using to store the reply still not read by the client.
- * It is "virtual" since the reply output list may contain objects that
- * are shared and are not really using additional memory.
- *
- * The function returns the total sum of the length of all the objects
- * stored in the output list, plus the memory used to allocate every
- * list node. The static reply buffer is not taken into account since it
- * is allocated anyway.
+ * The function returns the total size of the blocks stored in the output
+ * list, plus the memory used to allocate every list node and block header.
+ * The reply buffer is not taken into account since it is small and bounded
+ * to PROTO_REPLY_CHUNK_BYTES.
  *
  * Note: this function is very fast so can be called as many time as
  * the caller wishes. The main usage of this function currently is
  * enforcing the client output length limits. */
 unsigned long getClientOutputBufferMemoryUsage(client *c) {
-    unsigned long list_item_size = sizeof(listNode)+sizeof(robj);
+    unsigned long list_item_size = sizeof(listNode)+sizeof(clientReplyBlock);
 
-    return c->reply_bytes + (list_item_size*listLength(c->reply));
+    return c->reply_bytes + (list_item_size*clientReplyListLength(c));
 }
 
 /* Get the class of a client, used in order to enforce limits to different
@@ -1816,6 +2332,8 @@ int checkClientOutputBufferLimits(client *c) {
  * called from contexts where the client can't be freed safely, i.e. from the
  * lower level functions pushing data inside the client output buffers. */
 void asyncCloseClientOnOutputBufferLimitReached(client *c) {
+    /* Checked by the main thread for commands running in parallel. */
+    if (threadexec_parallel) return;
     serverAssert(c->reply_bytes < SIZE_MAX-(1024*64));
     if (c->reply_bytes == 0 || c->flags & CLIENT_CLOSE_ASAP) return;
     if (checkClientOutputBufferLimits(c)) {
@@ -0,0 +1,352 @@
+/* Radix tree with compressed edges, used as a set of byte strings.
+ *
+ * The head has an empty label. A node that is not the head and is not a key
+ * always has at least two children: when a removal leaves such a node with
+ * a single child the two are merged, so the tree has at most two nodes per
+ * string. Children are kept in an array sorted by the first byte of their
+ * label, resized at every change to use no more memory than needed.
+ *
+ * The functions never recurse, so very long strings with many branches don't
+ * need a deep stack. */
+
+#include <string.h>
+#include "radix.h"
+#include "zmalloc.h"
+
+/* Create a node for a label of 'len' bytes, that the caller fills. */
+static radixNode *radixNewNode(radixTree *rt, size_t len) {
+    radixNode *n = zmalloc(sizeof(*n)+len);
+
+    n->children = NULL;
+    n->numchildren = 0;
+    n->iskey = 0;
+    n->len = len;
+    rt->numnodes++;
+    rt->bytes += sizeof(*n)+len;
+    return n;
+}
+
+/* Free the node and its children array, not the children. */
+static void radixFreeNode(radixTree *rt, radixNode *n) {
+    rt->numnodes--;
+    rt->bytes -= sizeof(*n)+n->len+sizeof(radixNode*)*n->numchildren;
+    zfree(n->children);
+    zfree(n);
+}
+
+/* Return the index of the child of 'n' whose label starts with 'c', setting
+ * *found, or the index where such a child should be inserted. */
+static uint32_t radixChildIndex(radixNode *n, unsigned char c, int *found) {
+    uint32_t lo = 0, hi = n->numchildren;
+
+    while (lo < hi) {
+        uint32_t mid = (lo+hi)/2;
+        unsigned char m = n->children[mid]->label[0];
+
+        if (m == c) {
+            *found = 1;
+            return mid;
+        }
+        if (m < c) lo = mid+1; else hi = mid;
+    }
+    *found = 0;
+    return lo;
+}
+
+static void radixAddChild(radixTree *rt, radixNode *n, uint32_t idx,
+                          radixNode *child)
+{
+    n->children = zrealloc(n->children,
+                           sizeof(radixNode*)*(n->numchildren+1));
+    memmove(n->children+idx+1,n->children+idx,
+            sizeof(radixNode*)*(n->numchildren-idx));
+    n->children[idx] = child;
+    n->numchildren++;
+    rt->bytes += sizeof(radixNode*);
+}
+
+static void radixDelChild(radixTree *rt, radixNode *n, uint32_t idx) {
+    memmove(n->children+idx,n->children+idx+1,
+            sizeof(radixNode*)*(n->numchildren-idx-1));
+    n->numchildren--;
+    rt->bytes -= sizeof(radixNode*);
+    if (n->numchildren == 0) {
+        zfree(n->children);
+        n->children = NULL;
+    } else {
+        n->children = zrealloc(n->children,
+                               sizeof(radixNode*)*n->numchildren);
+    }
+}
+
+/* Merge the node with its only child, returning the new node that takes the
+ * place of both. */
+static radixNode *radixMerge(radixTree *rt, radixNode *n) {
+    radixNode *c = n->children[0];
+    radixNode *m = radixNewNode(rt,n->len+c->len);
+
+    memcpy(m->label,n->label,n->len);
+    memcpy(m->label+n->len,c->label,c->len);
+    m->iskey = c->iskey;
+    m->children = c->children;
+    m->numchildren = c->numchildren;
+    c->children = NULL;
+    c->numchildren = 0;
+    radixFreeNode(rt,c);
+    radixFreeNode(rt,n);
+    return m;
+}
+
+radixTree *radixNew(void) {
+    radixTree *rt = zmalloc(sizeof(*rt));
+
+    rt->numele = 0;
+    rt->numnodes = 0;
+    rt->bytes = 0;
+    rt->head = radixNewNode(rt,0);
+    return rt;
+}
+
+void radixFree(radixTree *rt) {
+    radixNode **stack = zmalloc(sizeof(radixNode*)*16);
+    size_t depth = 0, size = 16;
+
+    stack[depth++] = rt->head;
+    while (depth) {
+        radixNode *n = stack[--depth];
+        uint32_t j;
+
+        if (depth+n->numchildren > size) {
+            size = (depth+n->numchildren)*2;
+            stack = zrealloc(stack,sizeof(radixNode*)*size);
+        }
+        for (j = 0; j < n->numchildren; j++) stack[depth++] = n->children[j];
+        radixFreeNode(rt,n);
+    }
+    zfree(stack);
+    zfree(rt);
+}
+
+/* Add the string to the set. Returns 1 if it was added, 0 if it was already
+ * in the set. */
+int radixInsert(radixTree *rt, unsigned char *s, size_t len) {
+    radixNode *n = rt->head;
+    size_t i = 0;
+
+    while (i < len) {
+        radixNode *c, *mid, *tail;
+        uint32_t idx;
+        size_t j;
+        int found;
+
+        idx = radixChildIndex(n,s[i],&found);
+        if (!found) {
+            c = radixNewNode(rt,len-i);
+            memcpy(c->label,s+i,len-i);
+            c->iskey = 1;
+            radixAddChild(rt,n,idx,c);
+            rt->numele++;
+            return 1;
+        }
+
+        c = n->children[idx];
+        for (j = 0; j < c->len && i+j < len && c->label[j] == s[i+j]; j++);
+        if (j == c->len) {
+            n = c;
+            i += j;
+            continue;
+        }
+
+        /* The string diverges, or ends, in the middle of the label of the
+         * child: split it, the common part becomes a new node. */
+        mid = radixNewNode(rt,j);
+        memcpy(mid->label,c->label,j);
+        tail = radixNewNode(rt,c->len-j);
+        memcpy(tail->label,c->label+j,c->len-j);
+        tail->iskey = c->iskey;
+        tail->children = c->children;
+        tail->numchildren = c->numchildren;
+        c->children = NULL;
+        c->numchildren = 0;
+        radixFreeNode(rt,c);
+        radixAddChild(rt,mid,0,tail);
+        n->children[idx] = mid;
+        n = mid;
+        i += j;
+    }
+
+    if (n->iskey) return 0;
+    n->iskey = 1;
+    rt->numele++;
+    return 1;
+}
+
+/* Remove the string from the set. Returns 1 if it was removed, 0 if it was
+ * not in the set. */
+int radixRemove(radixTree *rt, unsigned char *s, size_t len) {
+    radixNode *n = rt->head, *parent = NULL, *grandparent = NULL;
+    uint32_t idx = 0, parentidx = 0;
+    size_t i = 0;
+
+    while (i < len) {
+        uint32_t j;
+        int found;
+        radixNode *c;
+
+        j = radixChildIndex(n,s[i],&found);
+        if (!found) return 0;
+        c = n->children[j];
+        if (c->len > len-i || memcmp(c->label,s+i,c->len) != 0) return 0;
+        grandparent = parent;
+        parentidx = idx;
+        parent = n;
+        idx = j;
+        n = c;
+        i += c->len;
+    }
+    if (!n->iskey) return 0;
+    n->iskey = 0;
+    rt->numele--;
+    if (n == rt->head) return 1;
+
+    if (n->numchildren == 0) {
+        radixDelChild(rt,parent,idx);
+        radixFreeNode(rt,n);
+        /* The parent may be left as a plain node with a single child. */
+        if (parent != rt->head && !parent->iskey && parent->numchildren == 1)
+            grandparent->children[parentidx] = radixMerge(rt,parent);
+    } else if (n->numchildren == 1) {
+        parent->children[idx] = radixMerge(rt,n);
+    }
+    return 1;
+}
+
+/* Returns 1 if the string is in the set. */
+int radixFind(radixTree *rt, unsigned char *s, size_t len) {
+    radixNode *n = rt->head;
+    size_t i = 0;
+
+    while (i < len) {
+        uint32_t j;
+        int found;
+
+        j = radixChildIndex(n,s[i],&found);
+        if (!found) return 0;
+        n = n->children[j];
+        if (n->len > len-i || memcmp(n->label,s+i,n->len) != 0) return 0;
+        i += n->len;
+    }
+    return n->iskey;
+}
+
+/* Compare the path 'buf' of a node with 'after': returns -1 if all the
+ * strings of the subtree of the node are lower than 'after', 1 if they are
+ * all greater, and 0 if the path is a prefix of 'after' (or the same
+ * string), so the node itself is not greater but its subtree may be. */
+static int radixSeekCompare(unsigned char *buf, size_t len,
+                            unsigned char *after, size_t afterlen)
+{
+    int cmp = memcmp(buf,after,len < afterlen ? len : afterlen);
+
+    if (cmp) return cmp < 0 ? -1 : 1;
+    return len <= afterlen ? 0 : 1;
+}
+
+/* Call 'fn' for every string of the set starting with 'prefix', in
+ * lexicographic order, until it returns 0. Only the subtree of the prefix
+ * is visited. The string passed to 'fn' is only valid during the call.
+ *
+ * If 'after' is not NULL only the strings greater than it are reported,
+ * so a walk stopped by 'fn' can be continued from the last string seen,
+ * even if the tree was modified in the meantime: the subtrees lower than
+ * 'after' are skipped without visiting them. */
+void radixWalkPrefix(radixTree *rt, unsigned char *prefix, size_t len,
+                     unsigned char *after, size_t afterlen,
+                     radixWalkCallback fn, void *privdata)
+{
+    struct {
+        radixNode *n;
+        uint32_t next;          /* Next child to visit. */
+        int seek;               /* On the path of 'after'. */
+        size_t keylen;          /* Length of the path to the node. */
+    } *stack;
+    size_t depth = 0, size = 16, keylen = 0, bufsize = 64;
+    unsigned char *buf = zmalloc(bufsize);
+    radixNode *n = rt->head;
+    int cmp;
+
+    /* Find the node whose path has the prefix, the prefix may end in the
+     * middle of its label. */
+    while (keylen < len) {
+        uint32_t j;
+        size_t cmplen;
+        int found;
+
+        j = radixChildIndex(n,prefix[keylen],&found);
+        if (!found) {
+            zfree(buf);
+            return;
+        }
+        n = n->children[j];
+        cmplen = n->len < len-keylen ? n->len : len-keylen;
+        if (memcmp(n->label,prefix+keylen,cmplen) != 0) {
+            zfree(buf);
+            return;
+        }
+        if (keylen+n->len > bufsize) {
+            bufsize = (keylen+n->len)*2;
+            buf = zrealloc(buf,bufsize);
+        }
+        memcpy(buf+keylen,n->label,n->len);
+        keylen += n->len;
+    }
+
+    /* Depth first visit of the subtree. */
+    cmp = after ? radixSeekCompare(buf,keylen,after,afterlen) : 1;
+    if (cmp < 0 || (n->iskey && cmp > 0 && !fn(privdata,buf,keylen))) {
+        zfree(buf);
+        return;
+    }
+    stack = zmalloc(sizeof(*stack)*size);
+    stack[depth].n = n;
+    stack[depth].next = 0;
+    stack[depth].seek = cmp == 0;
+    stack[depth].keylen = keylen;
+    depth++;
+    while (depth) {
+        radixNode *top = stack[depth-1].n, *c;
+
+        if (stack[depth-1].next == top->numchildren) {
+            depth--;
+            continue;
+        }
+        c = top->children[stack[depth-1].next++];
+        keylen = stack[depth-1].keylen;
+        if (keylen+c->len > bufsize) {
+            bufsize = (keylen+c->len)*2;
+            buf = zrealloc(buf,bufsize);
+        }
+        memcpy(buf+keylen,c->label,c->len);
+        keylen += c->len;
+        cmp = stack[depth-1].seek ?
+              radixSeekCompare(buf,keylen,after,afterlen) : 1;
+        if (cmp < 0) continue;
+        if (c->iskey && cmp > 0 && !fn(privdata,buf,keylen)) break;
+        if (depth == size) {
+            size *= 2;
+            stack = zrealloc(stack,sizeof(*stack)*size);
+        }
+        stack[depth].n = c;
+        stack[depth].next = 0;
+        stack[depth].seek = cmp == 0;
+        stack[depth].keylen = keylen;
+        depth++;
+    }
+    zfree(stack);
+    zfree(buf);
+}
+
+/* Memory used by the tree. */
+size_t radixMemory(radixTree *rt) {
+    return sizeof(*rt)+rt->bytes;
+}
@@ -0,0 +1,39 @@
+#ifndef __RADIX_H
+#define __RADIX_H
+#include <stdint.h>
+#include <stddef.h>
+
+/* A set of byte strings stored in a radix tree with compressed edges: every
+ * node holds the label of the edge from its parent, and its children sorted
+ * by the first byte of their label. The strings sharing a prefix are in the
+ * same subtree, so they are enumerated in lexicographic order visiting only
+ * that subtree. */
+typedef struct radixNode {
+    struct radixNode **children; /* Sorted by the first byte of the label. */
+    uint32_t numchildren;
+    uint32_t iskey:1;           /* The path to this node is in the set. */
+    uint32_t len:31;            /* Length of the label. */
+    unsigned char label[];      /* Edge from the parent, empty for the head. */
+} radixNode;
+
+typedef struct radixTree {
+    radixNode *head;
+    uint64_t numele;            /* Strings in the set. */
+    uint64_t numnodes;
+    size_t bytes;               /* Memory used by nodes and children arrays. */
+} radixTree;
+
+/* Called for every string by radixWalkPrefix(), returns 0 to stop. */
+typedef int (*radixWalkCallback)(void *privdata, unsigned char *s, size_t len);
+
+radixTree *radixNew(void);
+void radixFree(radixTree *rt);
+int radixInsert(radixTree *rt, unsigned char *s, size_t len);
+int radixRemove(radixTree *rt, unsigned char *s, size_t len);
+int radixFind(radixTree *rt, unsigned char *s, size_t len);
+void radixWalkPrefix(radixTree *rt, unsigned char *prefix, size_t len,
+                     unsigned char *after, size_t afterlen,
+                     radixWalkCallback fn, void *privdata);
+size_t radixMemory(radixTree *rt);
+
+#endif
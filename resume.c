@@ -0,0 +1,206 @@
+/* Resumable commands.
+ *
+ * A command visiting a big part of the dataset, like KEYS, would block every
+ * other client for the whole time it runs. Instead it can process a bounded
+ * batch of elements and, if it's not done, call resumeCommand() with a
+ * function that continues from a cursor saved in the command state. The
+ * client is flagged CLIENT_RESUMING and the function is called again, one
+ * batch per event loop iteration, until it returns 1, while the other
+ * clients are served between the batches. The arguments of the command are
+ * kept until then, and no other command of the client is processed.
+ *
+ * The replies are appended to the output buffers as the batches run. All
+ * the output preceding a deferred length not yet set is sent while the
+ * command runs (see writeToClient()), so a command that knows the length of
+ * its reply upfront streams it, while KEYS releases it with the last batch.
+ *
+ * Only read only commands can be resumed. While one runs, the DB it visits
+ * is locked: the write commands against it wait, flagged CLIENT_RESUMING as
+ * well, in server.clients_resume_waiting, and are executed once no resumable
+ * command visits the DB anymore. Write commands without key arguments, like
+ * FLUSHALL, wait for any locked DB. The hash tables of a locked DB are not
+ * resized nor rehashed, so that a dictScan() cursor returns every key once.
+ * Keys can still be removed by the expire cycle and by the eviction, so the
+ * cursors must survive deletions, as the dictScan() ones do. */
+
+#include "server.h"
+
+struct resumeState {
+    resumeProc *proc;           /* Runs the next batch. */
+    resumeFreeProc *freeproc;   /* Releases 'state'. */
+    void *state;                /* Private state of the command. */
+    dict **paused;              /* Dicts of the DB whose rehashing was */
+    int numpaused;              /* paused while locked. */
+};
+
+/* Return true if the command of the client can be executed in batches
+ * across event loop iterations, otherwise it must run to completion.
+ * New resumable commands don't start while writes are waiting, so that a
+ * stream of them can't delay the writes forever. */
+int resumeCanYield(client *c) {
+    if (server.resume_batch <= 0) return 0;
+    if (c->cmd->flags & CMD_WRITE) return 0;
+    if (c->flags & (CLIENT_MULTI|CLIENT_MASTER|CLIENT_LUA) || c->fd <= 0)
+        return 0;
+    return listLength(server.clients_resume_waiting) == 0;
+}
+
+static void resumeLockDb(struct resumeState *rs, redisDb *db) {
+    listIter li;
+    listNode *ln;
+
+    db->resume_locks++;
+    server.resume_locks++;
+    rs->paused = zmalloc(sizeof(dict*)*(listLength(db->rehashing)+1));
+    rs->numpaused = 0;
+    listRewind(db->rehashing,&li);
+    while ((ln = listNext(&li)) != NULL) {
+        dict *d = listNodeValue(ln);
+
+        if (!dictIsRehashing(d)) continue;
+        dictPauseRehashing(d);
+        rs->paused[rs->numpaused++] = d;
+    }
+}
+
+static void resumeUnlockDb(struct resumeState *rs, redisDb *db) {
+    int j;
+
+    for (j = 0; j < rs->numpaused; j++) dictResumeRehashing(rs->paused[j]);
+    zfree(rs->paused);
+    db->resume_locks--;
+    server.resume_locks--;
+}
+
+/* Called by a command that executed its first batch and is not done: 'proc'
+ * will be called with 'state' to run the next batches, until it returns 1.
+ * 'freeproc' releases the state, after the last batch or if the client is
+ * freed before. */
+void resumeCommand(client *c, resumeProc *proc, resumeFreeProc *freeproc,
+                   void *state)
+{
+    struct resumeState *rs = zmalloc(sizeof(*rs));
+
+    rs->proc = proc;
+    rs->freeproc = freeproc;
+    rs->state = state;
+    resumeLockDb(rs,c->db);
+    c->resume = rs;
+    c->flags |= CLIENT_RESUMING;
+    listAddNodeTail(server.clients_resuming,c);
+    server.stat_resumed_commands++;
+}
+
+static void resumeFreeState(client *c) {
+    struct resumeState *rs = c->resume;
+
+    resumeUnlockDb(rs,c->db);
+    rs->freeproc(rs->state);
+    zfree(rs);
+    c->resume = NULL;
+    c->flags &= ~CLIENT_RESUMING;
+}
+
+/* Called by processCommand() before executing a command. If it is a write
+ * against a locked DB the client is queued, flagged CLIENT_RESUMING, and
+ * C_OK is returned: the command is executed when the DB is unlocked.
+ * Otherwise C_ERR is returned and the command can be executed. */
+int resumeQueueWrite(client *c) {
+    if (server.resume_locks == 0 || !(c->cmd->flags & CMD_WRITE))
+        return C_ERR;
+    if (c->cmd->firstkey != 0 && c->db->resume_locks == 0) return C_ERR;
+
+    c->flags |= CLIENT_RESUMING;
+    listAddNodeTail(server.clients_resume_waiting,c);
+    server.stat_resume_delayed_writes++;
+    return C_OK;
+}
+
+/* Remove the client from the resumable commands lists, releasing the state
+ * of its command, that won't be completed. */
+void resumeUnqueueClient(client *c) {
+    listNode *ln;
+
+    if (c->resume) {
+        ln = listSearchKey(server.clients_resuming,c);
+        serverAssert(ln != NULL);
+        listDelNode(server.clients_resuming,ln);
+        resumeFreeState(c);
+    } else {
+        ln = listSearchKey(server.clients_resume_waiting,c);
+        serverAssert(ln != NULL);
+        listDelNode(server.clients_resume_waiting,ln);
+        c->flags &= ~CLIENT_RESUMING;
+    }
+}
+
+/* The command of the client completed: go on with the next ones. */
+static void resumeClientDone(client *c) {
+    /* The reply may have been held by a deferred length. */
+    if (clientHasPendingReplies(c)) clientInstallWriteHandler(c);
+    resetClient(c);
+    if (!(c->flags & CLIENT_PENDING_INPUT)) processInputBuffer(c);
+}
+
+/* This function is called just before entering the event loop. Every
+ * resumable command runs its next batch, then the writes waiting for a DB
+ * that is no longer locked are executed. Returns the number of batches and
+ * commands executed. */
+int handleResumableCommands(void) {
+    int processed = 0, count = listLength(server.clients_resuming);
+
+    while (count--) {
+        listNode *ln = listFirst(server.clients_resuming);
+        long long start;
+        client *c;
+        int done;
+
+        if (ln == NULL) break;
+        c = listNodeValue(ln);
+        listDelNode(server.clients_resuming,ln);
+
+        server.current_client = c;
+        start = ustime();
+        done = c->resume->proc(c,c->resume->state);
+        c->cmd->microseconds += ustime()-start;
+        server.stat_resume_batches++;
+        server.current_client = NULL;
+        processed++;
+
+        if (done) {
+            resumeFreeState(c);
+            resumeClientDone(c);
+        } else {
+            listAddNodeTail(server.clients_resuming,c);
+        }
+    }
+
+    count = listLength(server.clients_resume_waiting);
+    while (count--) {
+        listNode *ln = listFirst(server.clients_resume_waiting);
+        client *c;
+
+        /* Executing a command may free other clients in the list. */
+        if (ln == NULL) break;
+        c = listNodeValue(ln);
+        listDelNode(server.clients_resume_waiting,ln);
+        if (c->db->resume_locks ||
+            (c->cmd->firstkey == 0 && server.resume_locks))
+        {
+            listAddNodeTail(server.clients_resume_waiting,c);
+            continue;
+        }
+        c->flags &= ~CLIENT_RESUMING;
+
+        /* As in processInputBuffer(), the client may have been freed if
+         * server.current_client was cleared. */
+        server.current_client = c;
+        processed++;
+        if (processCommand(c) == C_OK && server.current_client != NULL &&
+            !(c->flags & (CLIENT_PENDING_COMMAND|CLIENT_SLOW_LANE|
+                          CLIENT_RESUMING)))
+            resumeClientDone(c);
+        server.current_client = NULL;
+    }
+    return processed;
+}
@@ -18,6 +18,7 @@
 #include <sys/resource.h>
 #include <sys/utsname.h>
 #include <locale.h>
+#include <stddef.h>
 #include <sys/socket.h>
 
 #include "config.h"
@@ -27,6 +28,11 @@
 #include "server.h"
 #include "cluster.h"
 #include "slowlog.h"
+#include "bio.h"
+#include "looprofile.h"
+#include "cron.h"
+#include "cmdhash.h"
+#include "cmdhash_table.h"
 
 /* Our shared "common" objects */
 struct sharedObjectsStruct shared;
@@ -168,6 +174,7 @@ struct redisCommand redisCommandTable[] = {
     // {"append",appendCommand,3,"wm",0,NULL,1,1,1,0,0},
     // {"strlen",strlenCommand,2,"rF",0,NULL,1,1,1,0,0},
     {"del",delCommand,-2,"w",0,NULL,1,-1,1,0,0},
+    {"unlink",unlinkCommand,-2,"wF",0,NULL,1,-1,1,0,0},
     // {"exists",existsCommand,-2,"rF",0,NULL,1,-1,1,0,0},
     // {"setbit",setbitCommand,4,"wm",0,NULL,1,1,1,0,0},
     // {"getbit",getbitCommand,3,"rF",0,NULL,1,1,1,0,0},
@@ -261,7 +268,7 @@ struct redisCommand redisCommandTable[] = {
     // {"expireat",expireatCommand,3,"wF",0,NULL,1,1,1,0,0},
     // {"pexpire",pexpireCommand,3,"wF",0,NULL,1,1,1,0,0},
     // {"pexpireat",pexpireatCommand,3,"wF",0,NULL,1,1,1,0,0},
-    // {"keys",keysCommand,2,"rS",0,NULL,0,0,0,0,0},
+    {"keys",keysCommand,2,"rS",0,NULL,0,0,0,0,0},
     // {"scan",scanCommand,-2,"rR",0,NULL,0,0,0,0,0},
     // {"dbsize",dbsizeCommand,1,"rF",0,NULL,0,0,0,0,0},
     // {"auth",authCommand,2,"sltF",0,NULL,0,0,0,0,0},
@@ -279,10 +286,13 @@ struct redisCommand redisCommandTable[] = {
     // {"sync",syncCommand,1,"ars",0,NULL,0,0,0,0,0},
     // {"psync",syncCommand,3,"ars",0,NULL,0,0,0,0,0},
     // {"replconf",replconfCommand,-1,"aslt",0,NULL,0,0,0,0,0},
-    // {"flushdb",flushdbCommand,1,"w",0,NULL,0,0,0,0,0},
-    // {"flushall",flushallCommand,1,"w",0,NULL,0,0,0,0,0},
+    {"flushdb",flushdbCommand,-1,"w",0,NULL,0,0,0,0,0},
+    {"flushall",flushallCommand,-1,"w",0,NULL,0,0,0,0,0},
     // {"sort",sortCommand,-2,"wm",0,sortGetKeys,1,1,1,0,0},
-    // {"info",infoCommand,-1,"lt",0,NULL,0,0,0,0,0},
+    {"info",infoCommand,-1,"lt",0,NULL,0,0,0,0,0},
+    {"loopprofile",loopprofileCommand,-2,"a",0,NULL,0,0,0,0,0},
+    {"keystats",keystatsCommand,-2,"a",0,NULL,0,0,0,0,0},
+    {"mrc",mrcCommand,-2,"a",0,NULL,0,0,0,0,0},
     // {"monitor",monitorCommand,1,"as",0,NULL,0,0,0,0,0},
     // {"ttl",ttlCommand,2,"rF",0,NULL,1,1,1,0,0},
     // {"touch",touchCommand,-2,"rF",0,NULL,1,1,1,0,0},
@@ -308,8 +318,8 @@ struct redisCommand redisCommandTable[] = {
     // {"readonly",readonlyCommand,1,"F",0,NULL,0,0,0,0,0},
     // {"readwrite",readwriteCommand,1,"F",0,NULL,0,0,0,0,0},
     // {"dump",dumpCommand,2,"r",0,NULL,1,1,1,0,0},
-    // {"object",objectCommand,3,"r",0,NULL,2,2,2,0,0},
-    // {"client",clientCommand,-2,"as",0,NULL,0,0,0,0,0},
+    {"object",objectCommand,3,"r",0,NULL,2,2,2,0,0},
+    {"client",clientCommand,-2,"as",0,NULL,0,0,0,0,0},
     // {"eval",evalCommand,-3,"s",0,evalGetKeys,0,0,0,0,0},
     // {"evalsha",evalShaCommand,-3,"s",0,evalGetKeys,0,0,0,0,0},
     // {"slowlog",slowlogCommand,-2,"a",0,NULL,0,0,0,0,0},
@@ -490,16 +500,34 @@ dictType commandTableDictType = {
     NULL                       /* val destructor */
 };
 
+/* Lookup a command name in the perfect hash generated at build time by
+ * mkcmdhash (see cmdhash.h). The name is copied into a zero padded buffer
+ * and compared with the table entry a word at a time, masking the case bit
+ * of the letters, so no allocation and no byte by byte compare is needed. */
+static struct redisCommand *lookupCommandByName(const char *name, size_t len) {
+    const cmdhashEntry *e;
+    uint64_t in[CMDHASH_MAXLEN/8] = {0};
+    uint64_t diff = 0;
+    int d, slot, j;
+
+    if (len == 0 || len > CMDHASH_MAXLEN) return NULL;
+    d = cmdhashDisp[cmdhashFunction(0,name,len) % CMDHASH_SIZE];
+    slot = d < 0 ? -d-1 : (int)(cmdhashFunction(d,name,len) % CMDHASH_SIZE);
+    e = cmdhashTable+slot;
+    if (e->len != len) return NULL;
+
+    memcpy(in,name,len);
+    for (j = 0; j < CMDHASH_MAXLEN/8; j++)
+        diff |= (in[j] ^ e->name.w[j]) & ~e->mask.w[j];
+    return diff ? NULL : redisCommandTable+e->index;
+}
+
 struct redisCommand *lookupCommandByCString(char *s) {
-    struct redisCommand *cmd;
-    sds name = sdsnew(s);
-    cmd = dictFetchValue(server.commands, name);
-    sdsfree(name);
-    return cmd;
+    return lookupCommandByName(s,strlen(s));
 }
 
 struct redisCommand *lookupCommand(sds name) {
-    return dictFetchValue(server.commands, name);
+    return lookupCommandByName(name,sdslen(name));
 }
 /* Populates the Redis Command Table starting from the hard coded list
  * we have on top of redis.c file. */
@@ -535,6 +563,11 @@ void populateCommandTable(void) {
          * by rename-command statements in redis.conf. */
         retval2 = dictAdd(server.orig_commands, sdsnew(c->name), c);
         serverAssert(retval1 == DICT_OK && retval2 == DICT_OK);
+        if (lookupCommandByName(c->name,strlen(c->name)) != c) {
+            serverLog(LL_WARNING,"Command '%s' missing from cmdhash_table.h, "
+                                 "rebuild it with make.", c->name);
+            serverPanic("Stale command perfect hash");
+        }
     }
 }
 
@@ -543,7 +576,9 @@ void initServerConfig(void) {
     getRandomHexChars(server.runid,CONFIG_RUN_ID_SIZE);
     server.configfile = NULL;
     server.executable = NULL;
-    server.hz = CONFIG_DEFAULT_HZ;
+    server.hz = server.config_hz = CONFIG_DEFAULT_HZ;
+    server.dynamic_hz = CONFIG_DEFAULT_DYNAMIC_HZ;
+    server.cron_max_cpu_perc = CONFIG_DEFAULT_CRON_MAX_CPU_PERC;
     server.runid[CONFIG_RUN_ID_SIZE] = '\0';
     server.arch_bits = (sizeof(long) == 8) ? 64 : 32;
     server.port = CONFIG_DEFAULT_SERVER_PORT;
@@ -554,6 +589,18 @@ void initServerConfig(void) {
     server.ipfd_count = 0;
     server.sofd = -1;
     server.protected_mode = CONFIG_DEFAULT_PROTECTED_MODE;
+    server.max_accepts_per_call = CONFIG_DEFAULT_MAX_ACCEPTS_PER_CALL;
+    server.accept_latency_target = CONFIG_DEFAULT_ACCEPT_LATENCY_TARGET;
+    server.max_commands_per_event = CONFIG_DEFAULT_MAX_COMMANDS_PER_EVENT;
+    server.busy_poll_usec = CONFIG_DEFAULT_BUSY_POLL_USEC;
+    server.so_busy_poll = CONFIG_DEFAULT_SO_BUSY_POLL;
+    server.loop_slow_threshold = CONFIG_DEFAULT_LOOP_SLOW_THRESHOLD;
+    server.exec_threads = CONFIG_DEFAULT_EXEC_THREADS;
+    server.slow_lane = CONFIG_DEFAULT_SLOW_LANE;
+    server.slow_lane_budget = CONFIG_DEFAULT_SLOW_LANE_BUDGET;
+    server.resume_batch = CONFIG_DEFAULT_RESUME_BATCH;
+    server.overload_latency = CONFIG_DEFAULT_OVERLOAD_LATENCY;
+    server.overload_queue = CONFIG_DEFAULT_OVERLOAD_QUEUE;
     server.dbnum = CONFIG_DEFAULT_DBNUM;
     server.verbosity = CONFIG_DEFAULT_VERBOSITY;
     server.maxidletime = CONFIG_DEFAULT_CLIENT_TIMEOUT;
@@ -594,12 +641,23 @@ void initServerConfig(void) {
     server.rdb_checksum = CONFIG_DEFAULT_RDB_CHECKSUM;
     server.stop_writes_on_bgsave_err = CONFIG_DEFAULT_STOP_WRITES_ON_BGSAVE_ERROR;
     server.activerehashing = CONFIG_DEFAULT_ACTIVE_REHASHING;
+    server.keyspace_slots = CONFIG_DEFAULT_KEYSPACE_SLOTS;
+    server.prefix_index = CONFIG_DEFAULT_PREFIX_INDEX;
     server.notify_keyspace_events = 0;
     server.maxclients = CONFIG_DEFAULT_MAX_CLIENTS;
     server.bpop_blocked_clients = 0;
     server.maxmemory = CONFIG_DEFAULT_MAXMEMORY;
     server.maxmemory_policy = CONFIG_DEFAULT_MAXMEMORY_POLICY;
     server.maxmemory_samples = CONFIG_DEFAULT_MAXMEMORY_SAMPLES;
+    server.lfu_log_factor = CONFIG_DEFAULT_LFU_LOG_FACTOR;
+    server.lfu_decay_time = CONFIG_DEFAULT_LFU_DECAY_TIME;
+    server.maxmemory_admission = CONFIG_DEFAULT_MAXMEMORY_ADMISSION;
+    server.admission_sketch_width = CONFIG_DEFAULT_ADMISSION_SKETCH_WIDTH;
+    server.hotkeys_sample_rate = CONFIG_DEFAULT_HOTKEYS_SAMPLE_RATE;
+    server.hotkeys_capacity = CONFIG_DEFAULT_HOTKEYS_CAPACITY;
+    server.bigkeys_capacity = CONFIG_DEFAULT_BIGKEYS_CAPACITY;
+    server.mrc_sample_keys = CONFIG_DEFAULT_MRC_SAMPLE_KEYS;
+    server.lazyfree_lazy_user_del = CONFIG_DEFAULT_LAZYFREE_LAZY_USER_DEL;
     server.hash_max_ziplist_entries = OBJ_HASH_MAX_ZIPLIST_ENTRIES;
     server.hash_max_ziplist_value = OBJ_HASH_MAX_ZIPLIST_VALUE;
     server.list_max_ziplist_size = OBJ_LIST_MAX_ZIPLIST_SIZE;
@@ -872,168 +930,93 @@ void serverLog(int level, const char *fmt, ...) {
     serverLogRaw(level,msg);
 }
 
-/* Helper function for the activeExpireCycle() function.
- * This function will try to expire the key that is stored in the hash table
- * entry 'de' of the 'expires' hash table of a Redis database.
+/* Delete a key found expired by activeExpireCycle(). */
+static void activeExpireCycleExpireKey(redisDb *db, robj *keyobj) {
+    incrRefCount(keyobj);
+    propagateExpire(db,keyobj);
+    dbDelete(db,keyobj);
+    notifyKeyspaceEvent(NOTIFY_EXPIRED,
+        "expired",keyobj,db->id);
+    decrRefCount(keyobj);
+    server.stat_expiredkeys++;
+}
+
+/* Try to expire the keys that timed out in the DBs. Every DB keeps the keys
+ * with an expire ordered by timeout (see db->expires_index), so the cycle
+ * just pops the keys whose timeout is in the past, oldest first, and stops
+ * at the first one still valid or when the time limit is reached.
  *
- * If the key is found to be expired, it is removed from the database and
- * 1 is returned. Otherwise no operation is performed and 0 is returned.
+ * The DBs are visited starting from the one where the previous call stopped
+ * for the time limit, so that the time is distributed evenly across DBs.
  *
- * When a key is expired, server.stat_expiredkeys is incremented.
+ * If type is ACTIVE_EXPIRE_CYCLE_FAST the function will try to run a
+ * "fast" expire cycle that takes no longer than ACTIVE_EXPIRE_CYCLE_FAST_DURATION
+ * microseconds, and is not repeated again before the same amount of time.
+ * It is called by beforeSleep(), so keys timing out between two cron
+ * cycles don't wait for the next one.
  *
- * The parameter 'now' is the current time in milliseconds as is passed
- * to the function to avoid too many gettimeofday() syscalls. */
-int activeExpireCycleTryExpire(redisDb *db, dictEntry *de, long long now) {
-    long long t = dictGetSignedIntegerVal(de);
-    if (now > t) {
-        sds key = dictGetKey(de);
-        robj *keyobj = createStringObject(key,sdslen(key));
-
-        propagateExpire(db,keyobj);
-        dbDelete(db,keyobj);
-        notifyKeyspaceEvent(NOTIFY_EXPIRED,
-            "expired",keyobj,db->id);
-        decrRefCount(keyobj);
-        server.stat_expiredkeys++;
-        return 1;
-    } else {
-        return 0;
-    }
-}
-
+ * If type is ACTIVE_EXPIRE_CYCLE_SLOW, the normal expire cycle is
+ * executed, where the time limit is a percentage of the cron period
+ * as specified by the ACTIVE_EXPIRE_CYCLE_SLOW_TIME_PERC define. */
 void activeExpireCycle(int type) {
     /* This function has some global state in order to continue the work
      * incrementally across calls. */
-    // static unsigned int current_db = 0; /* Last DB tested. */
-    // static int timelimit_exit = 0;      /* Time limit hit in previous call? */
-    // static long long last_fast_cycle = 0; /* When last fast cycle ran. */
-
-    // int j, iteration = 0;
-    // int dbs_per_call = CRON_DBS_PER_CALL;
-    // long long start = ustime(), timelimit;
-
-    // /* When clients are paused the dataset should be static not just from the
-    //  * POV of clients not being able to write, but also from the POV of
-    //  * expires and evictions of keys not being performed. */
-    //  if (clientsArePaused()) return;
-
-    // if (type == ACTIVE_EXPIRE_CYCLE_FAST) {
-    //     /* Don't start a fast cycle if the previous cycle did not exited
-    //      * for time limt. Also don't repeat a fast cycle for the same period
-    //      * as the fast cycle total duration itself. */
-    //     if (!timelimit_exit) return;
-    //     if (start < last_fast_cycle + ACTIVE_EXPIRE_CYCLE_FAST_DURATION*2) return;
-    //     last_fast_cycle = start;
-    // }
+    static unsigned int current_db = 0; /* Last DB tested. */
+    static long long last_fast_cycle = 0; /* When last fast cycle ran. */
+
+    int j, iteration = 0;
+    long long start = ustime(), now = start/1000, timelimit;
+
+    /* When clients are paused the dataset should be static not just from the
+     * POV of clients not being able to write, but also from the POV of
+     * expires and evictions of keys not being performed. */
+    if (clientsArePaused()) return;
+
+    if (type == ACTIVE_EXPIRE_CYCLE_FAST) {
+        /* Don't repeat a fast cycle for the same period as the fast cycle
+         * total duration itself. */
+        if (start < last_fast_cycle + ACTIVE_EXPIRE_CYCLE_FAST_DURATION*2) return;
+        last_fast_cycle = start;
+    }
 
-    // /* We usually should test CRON_DBS_PER_CALL per iteration, with
-    //  * two exceptions:
-    //  *
-    //  * 1) Don't test more DBs than we have.
-    //  * 2) If last time we hit the time limit, we want to scan all DBs
-    //  * in this iteration, as there is work to do in some DB and we don't want
-    //  * expired keys to use memory for too much time. */
-    // if (dbs_per_call > server.dbnum || timelimit_exit)
-    //     dbs_per_call = server.dbnum;
-
-    // /* We can use at max ACTIVE_EXPIRE_CYCLE_SLOW_TIME_PERC percentage of CPU time
-    //  * per iteration. Since this function gets called with a frequency of
-    //  * server.hz times per second, the following is the max amount of
-    //  * microseconds we can spend in this function. */
-    // timelimit = 1000000*ACTIVE_EXPIRE_CYCLE_SLOW_TIME_PERC/server.hz/100;
-    // timelimit_exit = 0;
-    // if (timelimit <= 0) timelimit = 1;
-
-    // if (type == ACTIVE_EXPIRE_CYCLE_FAST)
-    //     timelimit = ACTIVE_EXPIRE_CYCLE_FAST_DURATION; /* in microseconds. */
-
-    // for (j = 0; j < dbs_per_call; j++) {
-    //     int expired;
-    //     redisDb *db = server.db+(current_db % server.dbnum);
-
-    //     /* Increment the DB now so we are sure if we run out of time
-    //      * in the current DB we'll restart from the next. This allows to
-    //      * distribute the time evenly across DBs. */
-    //     current_db++;
-
-    //     /* Continue to expire if at the end of the cycle more than 25%
-    //      * of the keys were expired. */
-    //     do {
-    //         unsigned long num, slots;
-    //         long long now, ttl_sum;
-    //         int ttl_samples;
-
-    //         /* If there is nothing to expire try next DB ASAP. */
-    //         if ((num = dictSize(db->expires)) == 0) {
-    //             db->avg_ttl = 0;
-    //             break;
-    //         }
-    //         slots = dictSlots(db->expires);
-    //         now = mstime();
-
-    //         /* When there are less than 1% filled slots getting random
-    //          * keys is expensive, so stop here waiting for better times...
-    //          * The dictionary will be resized asap. */
-    //         if (num && slots > DICT_HT_INITIAL_SIZE &&
-    //             (num*100/slots < 1)) break;
-
-    //         /* The main collection cycle. Sample random keys among keys
-    //          * with an expire set, checking for expired ones. */
-    //         expired = 0;
-    //         ttl_sum = 0;
-    //         ttl_samples = 0;
-
-    //         if (num > ACTIVE_EXPIRE_CYCLE_LOOKUPS_PER_LOOP)
-    //             num = ACTIVE_EXPIRE_CYCLE_LOOKUPS_PER_LOOP;
-
-    //         while (num--) {
-    //             dictEntry *de;
-    //             long long ttl;
-
-    //             if ((de = dictGetRandomKey(db->expires)) == NULL) break;
-    //             ttl = dictGetSignedIntegerVal(de)-now;
-    //             if (activeExpireCycleTryExpire(db,de,now)) expired++;
-    //             if (ttl > 0) {
-    //                 /* We want the average TTL of keys yet not expired. */
-    //                 ttl_sum += ttl;
-    //                 ttl_samples++;
-    //             }
-    //         }
+    /* We can use at max ACTIVE_EXPIRE_CYCLE_SLOW_TIME_PERC percentage of CPU time
+     * per iteration. Since this function gets called with a frequency of
+     * server.hz times per second, the following is the max amount of
+     * microseconds we can spend in this function. */
+    timelimit = 1000000*ACTIVE_EXPIRE_CYCLE_SLOW_TIME_PERC/server.hz/100;
+    if (timelimit <= 0) timelimit = 1;
 
-    //         /* Update the average TTL stats for this database. */
-    //         if (ttl_samples) {
-    //             long long avg_ttl = ttl_sum/ttl_samples;
+    if (type == ACTIVE_EXPIRE_CYCLE_FAST)
+        timelimit = ACTIVE_EXPIRE_CYCLE_FAST_DURATION; /* in microseconds. */
 
-    //             /* Do a simple running average with a few samples.
-    //              * We just use the current estimate with a weight of 2%
-    //              * and the previous estimate with a weight of 98%. */
-    //             if (db->avg_ttl == 0) db->avg_ttl = avg_ttl;
-    //             db->avg_ttl = (db->avg_ttl/50)*49 + (avg_ttl/50);
-    //         }
+    for (j = 0; j < server.dbnum; j++) {
+        redisDb *db = server.db+(current_db % server.dbnum);
+        zskiplistNode *head;
 
-    //         /* We can't block forever here even if there are many keys to
-    //          * expire. So after a given amount of milliseconds return to the
-    //          * caller waiting for the other active expire cycle. */
-    //         iteration++;
-    //         if ((iteration & 0xf) == 0) { /* check once every 16 iterations. */
-    //             long long elapsed = ustime()-start;
+        /* A key is expired when its timeout is in the past, like in
+         * expireIfNeeded(). */
+        while ((head = db->expires_index->header->level[0].forward) != NULL &&
+               now > (long long)head->score)
+        {
+            activeExpireCycleExpireKey(db,head->obj);
 
-    //             latencyAddSampleIfNeeded("expire-cycle",elapsed/1000);
-    //             if (elapsed > timelimit) timelimit_exit = 1;
-    //         }
-    //         if (timelimit_exit) return;
-    //         /* We don't repeat the cycle if there are less than 25% of keys
-    //          * found expired in the current DB. */
-    //     } while (expired > ACTIVE_EXPIRE_CYCLE_LOOKUPS_PER_LOOP/4);
-    // }
+            /* We can't block forever here even if there are many keys to
+             * expire. So after a given amount of microseconds return to the
+             * caller, next time we restart from this DB. */
+            if ((++iteration & 0xf) == 0 && ustime()-start > timelimit)
+                return;
+        }
+        current_db++;
+    }
 }
 
 /* This function gets called every time Redis is entering the
  * main loop of the event driven library, that is, before to sleep
  * for ready file descriptors. */
 void beforeSleep(struct aeEventLoop *eventLoop) {
-    UNUSED(eventLoop);
-    
+    /* Account the iteration that just ended to the loop profiler. */
+    loopProfileEndIteration(eventLoop);
+
     /* Call the Redis Cluster before sleep function. Note that this function
     * may change the state of Redis Cluster (from ok to fail or vice versa),
          * so it's a good idea to call it before serving the unblocked clients
@@ -1042,8 +1025,10 @@ void beforeSleep(struct aeEventLoop *eventLoop) {
 
     /* Run a fast expire cycle (the called function will return
      * ASAP if a fast cycle is not needed). */
+    loopProfileBeginPhase();
     if (server.active_expire_enabled && server.masterhost == NULL)
         activeExpireCycle(ACTIVE_EXPIRE_CYCLE_FAST);
+    loopProfileEndPhase(LOOP_PHASE_EXPIRE);
 
     /* Send all the slaves an ACK request if at least one client blocked
      * during the previous event loop iteration. */
@@ -1072,14 +1057,360 @@ void beforeSleep(struct aeEventLoop *eventLoop) {
     /* Write the AOF buffer on disk */
     // flushAppendOnlyFile(0);
 
+    /* Run the next batch of commands of clients that used their budget,
+     * then the commands queued for parallel execution, the slow lane,
+     * after every fast command read in this iteration, and finally the
+     * next batch of the resumable commands. */
+    loopProfileBeginPhase();
+    if (listLength(server.clients_pending_input))
+        handleClientsWithPendingInput();
+    loopProfileEndPhase(LOOP_PHASE_PENDING_INPUT);
+    loopProfileBeginPhase();
+    if (threadexecPendingCommands()) threadexecRunPending();
+    loopProfileEndPhase(LOOP_PHASE_THREADS);
+    loopProfileBeginPhase();
+    if (listLength(server.clients_slow_lane)) handleClientsInSlowLane();
+    loopProfileEndPhase(LOOP_PHASE_SLOW_LANE);
+    loopProfileBeginPhase();
+    if (listLength(server.clients_resuming) ||
+        listLength(server.clients_resume_waiting))
+        handleResumableCommands();
+    loopProfileEndPhase(LOOP_PHASE_RESUME);
+
     /* Handle writes with pending output buffers. */
+    loopProfileBeginPhase();
     handleClientsWithPendingWrites();
+    loopProfileEndPhase(LOOP_PHASE_WRITES);
+
+    /* Don't block in the poll if there are commands already waiting. */
+    aeSetDontWait(server.el,listLength(server.clients_pending_input) != 0 ||
+                            listLength(server.clients_slow_lane) != 0 ||
+                            listLength(server.clients_resuming) != 0 ||
+                            threadexecPendingCommands() != 0);
+
+    server.el_sleep_time = ustime();
 }
 
-int serverCron(struct aeEventLoop *eventLoop, long long id, void *clientData) {
+/* Return the number of commands waiting to be executed in the next
+ * iterations: clients left over by the commands budget, slow lane and
+ * threaded batch. */
+static long long queuedCommands(void) {
+    return listLength(server.clients_pending_input) +
+           listLength(server.clients_slow_lane) +
+           threadexecPendingCommands();
+}
+
+/* Update the overload state used by processCommand() for admission control.
+ * The server is overloaded when the average time the event loop stays busy
+ * per iteration exceeds server.overload_latency, or when more than
+ * server.overload_queue commands wait to be executed. It stops being
+ * overloaded only once both fall below half the limits, so that the state
+ * doesn't flap as soon as shedding makes the loop fast again.
+ *
+ * Called every time we return from the event loop multiplexing API. */
+static void updateOverloadState(void) {
+    static time_t lastlog = 0;
+    long long queued;
+    int level;
+
+    server.el_busy_avg = (server.el_busy_avg*7 + server.el_busy_time)/8;
+    if (!server.overload_latency && !server.overload_queue) {
+        server.overloaded = 0;
+        return;
+    }
+
+    queued = queuedCommands();
+    if (!server.overloaded) {
+        if ((server.overload_latency &&
+             server.el_busy_avg > server.overload_latency) ||
+            (server.overload_queue && queued > server.overload_queue))
+        {
+            server.overloaded = 1;
+            server.overload_start = mstime();
+            server.stat_overload_events++;
+
+            /* The state can flap under sustained load: warn at most once
+             * per minute, INFO admission has the counters. */
+            level = time(NULL)-lastlog >= 60 ? LL_WARNING : LL_VERBOSE;
+            if (level == LL_WARNING) lastlog = time(NULL);
+            serverLog(level,"Server overloaded (busy %lld usec per "
+                "iteration, %lld queued commands): shedding load.",
+                server.el_busy_avg, queued);
+        }
+    } else {
+        if ((!server.overload_latency ||
+             server.el_busy_avg <= server.overload_latency/2) &&
+            (!server.overload_queue || queued <= server.overload_queue/2))
+        {
+            long long elapsed = mstime()-server.overload_start;
+
+            server.overloaded = 0;
+            server.stat_overload_time += elapsed;
+            serverLog(LL_VERBOSE,"Server no longer overloaded after %lld ms.",
+                elapsed);
+        }
+    }
+}
+
+/* Return true if the command of the client must be refused because the
+ * server is overloaded, see CLIENT_PRIORITY_*. The master, the slaves and
+ * admin commands are never refused, so that the server can still be
+ * inspected and reconfigured. */
+static int overloadRejectCommand(client *c) {
+    if (c->flags & (CLIENT_MASTER|CLIENT_SLAVE|CLIENT_LUA) || c->fd <= 0)
+        return 0;
+    if (c->cmd->flags & CMD_ADMIN || c->priority == CLIENT_PRIORITY_HIGH)
+        return 0;
+    if (c->priority == CLIENT_PRIORITY_LOW) {
+        server.stat_overload_rejected_low++;
+        return 1;
+    }
+    if (!(c->cmd->flags & CMD_FAST)) {
+        server.stat_overload_rejected_slow++;
+        return 1;
+    }
+    return 0;
+}
+
+/* This function is called immediately after the event loop multiplexing
+ * API returned, and the control is going to soon return to Redis by invoking
+ * the different events callbacks. */
+void afterSleep(struct aeEventLoop *eventLoop) {
+    long long now = ustime();
+    UNUSED(eventLoop);
+
+    /* The time spent between the previous wake up and the moment we entered
+     * the poll again is how long the last iteration kept the loop busy. */
+    if (server.el_wakeup_time)
+        server.el_busy_time = server.el_sleep_time - server.el_wakeup_time;
+    server.el_wakeup_time = now;
+    updateAcceptBudget();
+    updateOverloadState();
+}
+
+/* ======================= Cron: called every 1000/hz ms ===================== */
+
+/* Add a sample to the operations per second array of samples. */
+void trackInstantaneousMetric(int metric, long long current_reading) {
+    long long t = mstime() - server.inst_metric[metric].last_sample_time;
+    long long ops = current_reading -
+                    server.inst_metric[metric].last_sample_count;
+    long long ops_sec;
+
+    ops_sec = t > 0 ? (ops*1000/t) : 0;
+
+    server.inst_metric[metric].samples[server.inst_metric[metric].idx] =
+        ops_sec;
+    server.inst_metric[metric].idx++;
+    server.inst_metric[metric].idx %= STATS_METRIC_SAMPLES;
+    server.inst_metric[metric].last_sample_time = mstime();
+    server.inst_metric[metric].last_sample_count = current_reading;
+}
+
+/* Return the mean of all the samples. */
+long long getInstantaneousMetric(int metric) {
+    int j;
+    long long sum = 0;
+
+    for (j = 0; j < STATS_METRIC_SAMPLES; j++)
+        sum += server.inst_metric[metric].samples[j];
+    return sum / STATS_METRIC_SAMPLES;
+}
+
+/* Check for timeouts. Returns non-zero if the client was terminated.
+ * The function gets the current time in milliseconds as argument since
+ * it gets called multiple times in a loop, so calling gettimeofday() for
+ * each iteration would be costly without any actual gain. */
+int clientsCronHandleTimeout(client *c, mstime_t now_ms) {
+    time_t now = now_ms/1000;
+
+    if (server.maxidletime &&
+        !(c->flags & (CLIENT_SLAVE|CLIENT_MASTER|CLIENT_BLOCKED|CLIENT_PUBSUB|
+                      CLIENT_PENDING_COMMAND|CLIENT_SLOW_LANE|
+                      CLIENT_RESUMING)) &&
+        (now - c->lastinteraction > server.maxidletime))
+    {
+        serverLog(LL_VERBOSE,"Closing idle client");
+        freeClient(c);
+        return 1;
+    }
     return 0;
 }
 
+/* This job checks a few clients every cycle, for timeouts and query and
+ * reply buffers to shrink. At least CLIENTS_CRON_MIN_ITERATIONS clients are checked, and
+ * as many as needed to check every client once per second, but the job
+ * stops when its budget is used. */
+void clientsCron(long long budget) {
+    int numclients = listLength(server.clients);
+    int iterations = numclients/server.hz;
+    mstime_t now = mstime();
+    long long start = ustime();
+
+    if (iterations < CLIENTS_CRON_MIN_ITERATIONS)
+        iterations = (numclients < CLIENTS_CRON_MIN_ITERATIONS) ?
+                     numclients : CLIENTS_CRON_MIN_ITERATIONS;
+
+    while(listLength(server.clients) && iterations--) {
+        client *c;
+        listNode *head;
+
+        /* Rotate the list, take the current head, process.
+         * This way if the client must be removed from the list it's the
+         * first element and we don't incur into O(N) computation. */
+        listRotate(server.clients);
+        head = listFirst(server.clients);
+        c = listNodeValue(head);
+        if (clientsCronHandleTimeout(c,now)) continue;
+        if (clientsCronResizeQueryBuffer(c)) continue;
+        if (clientsCronResizeReplyBuffer(c)) continue;
+        if ((iterations & 15) == 0 && ustime()-start > budget) break;
+    }
+}
+
+/* Return true if the dictionary has less than HASHTABLE_MIN_FILL percent of
+ * its slots used, so that it's worth to resize it to save memory. */
+int htNeedsResize(dict *dict) {
+    long long size, used;
+
+    size = dictSlots(dict);
+    used = dictSize(dict);
+    return (size > DICT_HT_INITIAL_SIZE &&
+            (used*100/size < HASHTABLE_MIN_FILL));
+}
+
+/* If the percentage of used slots in the HT reaches HASHTABLE_MIN_FILL
+ * we resize the hash table to save memory. Up to CRON_DICTS_PER_DB dicts
+ * of the keyspace are checked per call. The dicts of a DB locked by a
+ * resumable command keep their size. */
+void tryResizeHashTables(int dbid) {
+    redisDb *db = server.db+dbid;
+    int j;
+
+    if (db->resume_locks) return;
+    for (j = 0; j < db->dict_count && j < CRON_DICTS_PER_DB; j++) {
+        dict *d = db->dict[db->resize_cursor];
+
+        db->resize_cursor = (db->resize_cursor+1) % db->dict_count;
+        if (d && htNeedsResize(d) && dictResize(d) == DICT_OK)
+            listAddNodeTail(db->rehashing,d);
+    }
+}
+
+/* Rehash the dictionary, if it is rehashing, until the deadline (ustime())
+ * or the end of the rehashing. Returns 1 if some work was done. */
+static int dictRehashUntil(dict *d, long long deadline) {
+    if (!dictIsRehashing(d)) return 0;
+    while (dictRehash(d,100) && ustime() < deadline);
+    return 1;
+}
+
+/* Our hash table implementation performs rehashing incrementally while
+ * we write/read from the hash table. Still if the server is idle, the hash
+ * table will use two tables for a long time. So we try to use part of the
+ * cron budget in order to rehash. The function returns 1 if some rehashing
+ * was performed, otherwise 0 is returned. */
+int incrementallyRehash(int dbid, long long deadline) {
+    list *l = server.db[dbid].rehashing;
+    listNode *ln;
+    int work = 0;
+
+    if (server.db[dbid].resume_locks) return 0;
+    while ((ln = listFirst(l)) != NULL && ustime() < deadline) {
+        dict *d = listNodeValue(ln);
+
+        if (dictRehashUntil(d,deadline)) work = 1;
+        if (!dictIsRehashing(d)) listDelNode(l,ln);
+    }
+    return work;
+}
+
+/* This job handles the background operations on the keyspace: active
+ * expiring of keys, and resizing and incremental rehashing of the
+ * dictionaries with what is left of the budget. The slow expire cycle
+ * limits itself to ACTIVE_EXPIRE_CYCLE_SLOW_TIME_PERC of the cron period. */
+void databasesCron(long long budget) {
+    /* This function has some global state in order to continue the work
+     * incrementally across calls. */
+    static unsigned int resize_db = 0;
+    static unsigned int rehash_db = 0;
+    int dbs_per_call = CRON_DBS_PER_CALL;
+    long long deadline = ustime()+budget;
+    int j;
+
+    /* Expire the keys that timed out. Not required for slaves
+     * as master will synthesize DELs for us. */
+    if (server.active_expire_enabled && server.masterhost == NULL)
+        activeExpireCycle(ACTIVE_EXPIRE_CYCLE_SLOW);
+
+    /* Don't test more DBs than we have. */
+    if (dbs_per_call > server.dbnum) dbs_per_call = server.dbnum;
+
+    /* Resize */
+    for (j = 0; j < dbs_per_call; j++) {
+        tryResizeHashTables(resize_db % server.dbnum);
+        resize_db++;
+    }
+
+    /* Rehash, one DB per call. */
+    if (server.activerehashing) {
+        for (j = 0; j < dbs_per_call && ustime() < deadline; j++) {
+            if (incrementallyRehash(rehash_db % server.dbnum,deadline))
+                break;
+            rehash_db++;
+        }
+    }
+}
+
+/* This job samples the instantaneous metrics and the memory usage. */
+void statsCron(long long budget) {
+    size_t zmalloc_used = zmalloc_used_memory();
+    UNUSED(budget);
+
+    trackInstantaneousMetric(STATS_METRIC_COMMAND,server.stat_numcommands);
+    trackInstantaneousMetric(STATS_METRIC_NET_INPUT,
+            server.stat_net_input_bytes);
+    trackInstantaneousMetric(STATS_METRIC_NET_OUTPUT,
+            server.stat_net_output_bytes);
+
+    /* Record the max memory used since the server was started. */
+    if (zmalloc_used > server.stat_peak_memory)
+        server.stat_peak_memory = zmalloc_used;
+
+    /* Sample the RSS here since this is a relatively slow call. */
+    server.resident_set_size = zmalloc_get_rss();
+}
+
+/* We take a cached value of the unix time in the global state because with
+ * virtual memory and aging there is to store the current time in objects at
+ * every object access, and accuracy is not needed. To access a global var is
+ * a lot faster than calling time(NULL) */
+void updateCachedTime(void) {
+    server.unixtime = time(NULL);
+    server.mstime = mstime();
+}
+
+/* This is our timer interrupt, called server.hz times per second. The
+ * maintenance work is done by the jobs registered in initServer(), see
+ * cron.c: the ones that are due run within the cycle budget. */
+int serverCron(struct aeEventLoop *eventLoop, long long id, void *clientData) {
+    UNUSED(eventLoop);
+    UNUSED(id);
+    UNUSED(clientData);
+
+    /* Update the time cache. */
+    updateCachedTime();
+
+    /* We have just LRU_BITS bits per object for LRU information.
+     * So we use an (eventually wrapping) LRU clock. */
+    server.lruclock = getLRUClock();
+
+    cronUpdateHz();
+    cronRunJobs();
+    server.cronloops++;
+    return 1000/server.hz;
+}
+
 unsigned int dictObjHash(const void *key) {
     const robj *o = key;
     return dictGenHashFunction(o->ptr, sdslen((sds)o->ptr));
@@ -1098,16 +1429,6 @@ void dictListDestructor(void *privdata, void *val)
     listRelease((list*)val);
 }
 
-/* Db->expires */
-dictType keyptrDictType = {
-    dictSdsHash,               /* hash function */
-    NULL,                      /* key dup */
-    NULL,                      /* val dup */
-    dictSdsKeyCompare,         /* key compare */
-    NULL,                      /* key destructor */
-    NULL                       /* val destructor */
-};
-
 /* Db->dict, keys are sds strings, vals are Redis objects. */
 dictType dbDictType = {
     dictSdsHash,                /* hash function */
@@ -1139,19 +1460,6 @@ dictType zsetDictType = {
     NULL                       /* val destructor */
 };
 
-/* Create a new eviction pool. */
-struct evictionPoolEntry *evictionPoolAlloc(void) {
-    struct evictionPoolEntry *ep;
-    int j;
-
-    ep = zmalloc(sizeof(*ep)*MAXMEMORY_EVICTION_POOL_SIZE);
-    for (j = 0; j < MAXMEMORY_EVICTION_POOL_SIZE; j++) {
-        ep[j].idle = 0;
-        ep[j].key = NULL;
-    }
-    return ep;
-}
-
 /* Initialize a set of file descriptors to listen to the specified 'port'
  * binding the addresses specified in the Redis server configuration.
  *
@@ -1303,6 +1611,8 @@ void createSharedObjects(void) {
         "-NOREPLICAS Not enough good slaves to write.\r\n"));
     shared.busykeyerr = createObject(OBJ_STRING,sdsnew(
         "-BUSYKEY Target key name already exists.\r\n"));
+    shared.overloaderr = createObject(OBJ_STRING,sdsnew(
+        "-OVERLOAD Server is overloaded, retry later.\r\n"));
     shared.space = createObject(OBJ_STRING,sdsnew(" "));
     shared.colon = createObject(OBJ_STRING,sdsnew(":"));
     shared.plus = createObject(OBJ_STRING,sdsnew("+"));
@@ -1328,7 +1638,8 @@ void createSharedObjects(void) {
     shared.lpop = createStringObject("LPOP",4);
     shared.lpush = createStringObject("LPUSH",5);
     for (j = 0; j < OBJ_SHARED_INTEGERS; j++) {
-        shared.integers[j] = createObject(OBJ_STRING,(void*)(long)j);
+        shared.integers[j] =
+            makeObjectShared(createObject(OBJ_STRING,(void*)(long)j));
         shared.integers[j]->encoding = OBJ_ENCODING_INT;
     }
     for (j = 0; j < OBJ_SHARED_BULKHDR_LEN; j++) {
@@ -1363,17 +1674,30 @@ void initServer(void) {
     server.slaves = listCreate();
     server.monitors = listCreate();
     server.clients_pending_write = listCreate();
+    server.clients_pending_input = listCreate();
+    server.clients_slow_lane = listCreate();
+    server.slow_lane_client = NULL;
+    server.slow_lane_left = 0;
+    server.clients_resuming = listCreate();
+    server.clients_resume_waiting = listCreate();
+    server.resume_locks = 0;
     server.slaveseldb = -1; /* Force to emit the first SELECT command. */
     server.unblocked_clients = listCreate();
     server.ready_keys = listCreate();
     server.clients_waiting_acks = listCreate();
     server.get_ack_from_slaves = 0;
     server.clients_paused = 0;
+    server.accept_budget = server.max_accepts_per_call;
+    server.accepts_left = server.accept_budget;
+    server.el_wakeup_time = 0;
+    server.el_sleep_time = 0;
+    server.el_busy_time = 0;
     server.system_memory_size = zmalloc_get_memory_size();
 
     createSharedObjects();
     // adjustOpenFilesLimit();
     server.el = aeCreateEventLoop(server.maxclients+CONFIG_FDSET_INCR);
+    aeSetBusyPoll(server.el,server.busy_poll_usec);
     server.db = zmalloc(sizeof(redisDb)*server.dbnum);
 
     /* Open the TCP listening socket for the user commands. */
@@ -1400,17 +1724,23 @@ void initServer(void) {
         exit(1);
     }
 
-    /* Create the Redis databases, and initialize other internal state. */
+    /* Create the Redis databases, and initialize other internal state.
+     * Redis Cluster needs the keys of a slot: use a dict per slot. */
+    if (server.cluster_enabled) server.keyspace_slots = 1;
     for (j = 0; j < server.dbnum; j++) {
-        server.db[j].dict = dictCreate(&dbDictType,NULL);
-        server.db[j].expires = dictCreate(&keyptrDictType,NULL);
+        dbInitKeyspace(&server.db[j]);
+        server.db[j].expires_index = zslCreate();
         server.db[j].blocking_keys = dictCreate(&keylistDictType,NULL);
         server.db[j].ready_keys = dictCreate(&setDictType,NULL);
         server.db[j].watched_keys = dictCreate(&keylistDictType,NULL);
         server.db[j].eviction_pool = evictionPoolAlloc();
         server.db[j].id = j;
         server.db[j].avg_ttl = 0;
+        server.db[j].resume_locks = 0;
     }
+    admissionInit();
+    mrcInit();
+    keystatsInit();
     server.pubsub_channels = dictCreate(&keylistDictType,NULL);
     server.pubsub_patterns = listCreate();
     // listSetFreeMethod(server.pubsub_patterns,freePubsubPattern);
@@ -1431,12 +1761,33 @@ void initServer(void) {
     /* A few stats we don't want to reset: server startup time, and peak mem. */
     server.stat_starttime = time(NULL);
     server.stat_peak_memory = 0;
+    server.stat_accept_budget_hits = 0;
+    server.stat_pipeline_batches = 0;
+    server.stat_threaded_commands = 0;
+    server.stat_threaded_batches = 0;
+    server.stat_pipeline_budget_hits = 0;
+    memset(server.stat_pipeline_depth,0,sizeof(server.stat_pipeline_depth));
+    memset(server.stat_lane_calls,0,sizeof(server.stat_lane_calls));
+    memset(server.stat_lane_latency,0,sizeof(server.stat_lane_latency));
+    server.stat_slow_lane_deferred = 0;
+    server.stat_slow_lane_budget_hits = 0;
+    server.stat_resumed_commands = 0;
+    server.stat_resume_batches = 0;
+    server.stat_resume_delayed_writes = 0;
+    server.stat_overload_events = 0;
+    server.stat_overload_time = 0;
+    server.stat_overload_rejected_low = 0;
+    server.stat_overload_rejected_slow = 0;
+    server.el_busy_avg = 0;
+    server.overloaded = 0;
+    server.overload_start = 0;
     server.resident_set_size = 0;
     server.lastbgsave_status = C_OK;
     server.aof_last_write_status = C_OK;
     server.aof_last_write_errno = 0;
     server.repl_good_slaves_count = 0;
-    // updateCachedTime();
+    memset(server.inst_metric,0,sizeof(server.inst_metric));
+    updateCachedTime();
 
     /* Create the serverCron() time event, that's our main way to process
      * background operations. */
@@ -1483,8 +1834,14 @@ void initServer(void) {
     // replicationScriptCacheInit();
     // scriptingInit(1);
     // slowlogInit();
+    loopProfileInit();
+    threadexecInit();
+    cronInit();
+    cronRegisterJob("stats",statsCron,100);
+    cronRegisterJob("clients",clientsCron,0);
+    cronRegisterJob("databases",databasesCron,0);
     // latencyMonitorInit();
-    // bioInit();
+    bioInit();
 }
 
 void redisOutOfMemoryHandler(size_t allocation_size) {
@@ -1807,6 +2164,7 @@ void call(client *c, int flags) {
         c->lastcmd->microseconds += duration;
         c->lastcmd->calls++;
     }
+    loopProfileCommand(c->cmd,duration);
 
     /* Propagate the command into the AOF and replication link */
     if (flags & CMD_CALL_PROPAGATE &&
@@ -1911,6 +2269,29 @@ int processCommand(client *c) {
         return C_OK;
     }
 
+    /* Shed load if the server is overloaded: the error is retryable, it is
+     * better to have some clients retry later than every client timing
+     * out. */
+    if (server.overloaded && overloadRejectCommand(c)) {
+        flagTransaction(c);
+        addReply(c,shared.overloaderr);
+        return C_OK;
+    }
+
+    /* Handle the maxmemory directive.
+     *
+     * First we try to free some memory if possible (if there are volatile
+     * keys in the dataset). If there are not the only thing we can do
+     * is returning an error. */
+    if (server.maxmemory) {
+        int retval = freeMemoryIfNeeded();
+        if ((c->cmd->flags & CMD_DENYOOM) && retval == C_ERR) {
+            flagTransaction(c);
+            addReply(c, shared.oomerr);
+            return C_OK;
+        }
+    }
+
     /* Don't accept write commands if there are problems persisting on disk
      * and if this is a master instance. */
     if (((server.stop_writes_on_bgsave_err &&
@@ -1946,15 +2327,361 @@ int processCommand(client *c) {
     {
         queueMultiCommand(c);
         addReply(c,shared.queued);
+    } else if (resumeQueueWrite(c) == C_OK) {
+        /* Executed once the DB is unlocked, see handleResumableCommands(). */
+        return C_OK;
+    } else if (threadexecQueueCommand(c) == C_OK) {
+        /* Executed by the threads before re-entering the event loop. */
+        return C_OK;
+    } else if (clientQueueSlowLane(c) == C_OK) {
+        /* Executed after the fast commands, see handleClientsInSlowLane(). */
+        return C_OK;
     } else {
+        int lane = (c->cmd->flags & CMD_FAST) ? LANE_FAST : LANE_SLOW;
+
         call(c,CMD_CALL_FULL);
         c->woff = server.master_repl_offset;
+        statLaneLatency(c,lane,server.el_wakeup_time);
         // if (listLength(server.ready_keys))
         //     handleClientsBlockedOnLists();
     }
     return C_OK;
 }
 
+/* Return the upper bound, in usec, of the bucket of the power of two
+ * histogram 'hist' containing the given percentile of its 'count' samples. */
+static long long latencyPercentile(long long *hist, int buckets,
+                                   long long count, double perc)
+{
+    long long seen = 0;
+    int j;
+
+    if (count == 0) return 0;
+    for (j = 0; j < buckets-1; j++) {
+        seen += hist[j];
+        if (seen*100.0 >= count*perc) break;
+    }
+    return (2LL<<j)-1;
+}
+
+/* Return the upper bound, in usec, of the latency bucket containing the
+ * given percentile of the commands executed by the lane. */
+static long long laneLatencyPercentile(int lane, double perc) {
+    return latencyPercentile(server.stat_lane_latency[lane],
+        STATS_LANE_LATENCY_BUCKETS,server.stat_lane_calls[lane],perc);
+}
+
+/* Append to the INFO string the samples and the percentiles of one of the
+ * wake up latency histograms of the event loop. */
+static sds catLoopLatencyInfo(sds info, char *name, long long *hist) {
+    long long count = 0;
+    int j;
+
+    for (j = 0; j < AE_LATENCY_BUCKETS; j++) count += hist[j];
+    return sdscatprintf(info,
+        "%s:samples=%lld,p50_usec=%lld,p99_usec=%lld,p999_usec=%lld\r\n",
+        name, count,
+        latencyPercentile(hist,AE_LATENCY_BUCKETS,count,50.0),
+        latencyPercentile(hist,AE_LATENCY_BUCKETS,count,99.0),
+        latencyPercentile(hist,AE_LATENCY_BUCKETS,count,99.9));
+}
+
+/* Convert an amount of bytes into a human readable string in the form
+ * of 100B, 2G, 100M, 4K, and so forth. */
+void bytesToHuman(char *s, unsigned long long n) {
+    double d;
+
+    if (n < 1024) {
+        /* Bytes */
+        sprintf(s,"%lluB",n);
+        return;
+    } else if (n < (1024*1024)) {
+        d = (double)n/(1024);
+        sprintf(s,"%.2fK",d);
+    } else if (n < (1024LL*1024*1024)) {
+        d = (double)n/(1024*1024);
+        sprintf(s,"%.2fM",d);
+    } else {
+        d = (double)n/(1024LL*1024*1024);
+        sprintf(s,"%.2fG",d);
+    }
+}
+
+/* Create the string returned by the INFO command. This is decoupled
+ * by the INFO command itself as we need to report the same information
+ * on memory corruption problems. */
+sds genRedisInfoString(char *section) {
+    sds info = sdsempty();
+    time_t uptime = time(NULL)-server.stat_starttime;
+    int allsections = 0, defsections = 0;
+    int sections = 0, j;
+
+    if (section == NULL) section = "default";
+    allsections = strcasecmp(section,"all") == 0;
+    defsections = strcasecmp(section,"default") == 0;
+
+    /* Server */
+    if (allsections || defsections || !strcasecmp(section,"server")) {
+        if (sections++) info = sdscat(info,"\r\n");
+        info = sdscatprintf(info,
+            "# Server\r\n"
+            "redis_version:%s\r\n"
+            "redis_git_sha1:%s\r\n"
+            "multiplexing_api:%s\r\n"
+            "process_id:%ld\r\n"
+            "tcp_port:%d\r\n"
+            "uptime_in_seconds:%jd\r\n"
+            "uptime_in_days:%jd\r\n"
+            "hz:%d\r\n",
+            REDIS_VERSION,
+            redisGitSHA1(),
+            aeGetApiName(),
+            (long) getpid(),
+            server.port,
+            (intmax_t)uptime,
+            (intmax_t)(uptime/(3600*24)),
+            server.hz);
+    }
+
+    /* Clients */
+    if (allsections || defsections || !strcasecmp(section,"clients")) {
+        unsigned long lol, bib, idle;
+        size_t idle_mem;
+        getClientsMaxBuffers(&lol,&bib);
+        idle_mem = getClientsIdleMemory(&idle);
+        if (sections++) info = sdscat(info,"\r\n");
+        info = sdscatprintf(info,
+            "# Clients\r\n"
+            "connected_clients:%lu\r\n"
+            "client_longest_output_list:%lu\r\n"
+            "client_biggest_input_buf:%lu\r\n"
+            "blocked_clients:%u\r\n"
+            "idle_clients:%lu\r\n"
+            "idle_client_avg_memory:%zu\r\n",
+            listLength(server.clients)-listLength(server.slaves),
+            lol, bib,
+            server.bpop_blocked_clients,
+            idle, idle ? idle_mem/idle : 0);
+    }
+
+    /* Memory */
+    if (allsections || defsections || !strcasecmp(section,"memory")) {
+        char hmem[64];
+        size_t zmalloc_used = zmalloc_used_memory();
+        unsigned long long index_keys = 0;
+        size_t index_bytes = 0;
+
+        for (j = 0; j < server.dbnum; j++) {
+            radixTree *rt = server.db[j].prefix_index;
+
+            if (rt == NULL) continue;
+            index_keys += rt->numele;
+            index_bytes += radixMemory(rt);
+        }
+
+        if (zmalloc_used > server.stat_peak_memory)
+            server.stat_peak_memory = zmalloc_used;
+        bytesToHuman(hmem,zmalloc_used);
+        if (sections++) info = sdscat(info,"\r\n");
+        info = sdscatprintf(info,
+            "# Memory\r\n"
+            "used_memory:%zu\r\n"
+            "used_memory_human:%s\r\n"
+            "used_memory_rss:%zu\r\n"
+            "used_memory_peak:%zu\r\n"
+            "maxmemory:%llu\r\n"
+            "maxmemory_policy:%s\r\n"
+            "maxmemory_admission:%s\r\n"
+            "mem_allocator:%s\r\n"
+            "lazyfree_pending_objects:%zu\r\n"
+            "prefix_index_keys:%llu\r\n"
+            "prefix_index_bytes:%zu\r\n"
+            "prefix_index_bytes_per_key:%.2f\r\n"
+            "mrc_sample_rate:%.6f\r\n"
+            "mrc_sampled_keys:%llu\r\n"
+            "mrc_memory:%zu\r\n",
+            zmalloc_used,
+            hmem,
+            server.resident_set_size,
+            server.stat_peak_memory,
+            server.maxmemory,
+            evictPolicyToString(),
+            server.admission_sketch ? "tinylfu" : "none",
+            ZMALLOC_LIB,
+            lazyfreeGetPendingObjectsCount(),
+            index_keys,
+            index_bytes,
+            index_keys ? (double)index_bytes/index_keys : 0,
+            server.mrc ? mrcSampleRate(server.mrc) : 0,
+            server.mrc ? (unsigned long long)server.mrc->count : 0,
+            server.mrc ? mrcMemory(server.mrc) : 0);
+    }
+
+    /* Stats */
+    if (allsections || defsections || !strcasecmp(section,"stats")) {
+        if (sections++) info = sdscat(info,"\r\n");
+        info = sdscatprintf(info,
+            "# Stats\r\n"
+            "total_connections_received:%lld\r\n"
+            "total_commands_processed:%lld\r\n"
+            "total_net_input_bytes:%lld\r\n"
+            "total_net_output_bytes:%lld\r\n"
+            "rejected_connections:%lld\r\n"
+            "accept_budget:%d\r\n"
+            "accept_budget_hits:%lld\r\n"
+            "expired_keys:%lld\r\n"
+            "evicted_keys:%lld\r\n"
+            "admission_admitted_keys:%lld\r\n"
+            "admission_rejected_keys:%lld\r\n"
+            "keyspace_hits:%lld\r\n"
+            "keyspace_misses:%lld\r\n"
+            "busy_poll_usec:%lld\r\n"
+            "busy_poll_hits:%lld\r\n"
+            "busy_poll_sleeps:%lld\r\n"
+            "busy_poll_spin_usec:%lld\r\n"
+            "threaded_commands:%lld\r\n"
+            "threaded_batches:%lld\r\n"
+            "eventloop_busy_usec:%lld\r\n"
+            "instantaneous_ops_per_sec:%lld\r\n"
+            "instantaneous_input_kbps:%.2f\r\n"
+            "instantaneous_output_kbps:%.2f\r\n",
+            server.stat_numconnections,
+            server.stat_numcommands,
+            server.stat_net_input_bytes,
+            server.stat_net_output_bytes,
+            server.stat_rejected_conn,
+            server.accept_budget,
+            server.stat_accept_budget_hits,
+            server.stat_expiredkeys,
+            server.stat_evictedkeys,
+            server.stat_admission_admitted,
+            server.stat_admission_rejected,
+            server.stat_keyspace_hits,
+            server.stat_keyspace_misses,
+            server.el->busypoll_usec,
+            server.el->busypoll_hits,
+            server.el->busypoll_sleeps,
+            server.el->busypoll_spin_usec,
+            server.stat_threaded_commands,
+            server.stat_threaded_batches,
+            server.el_busy_time,
+            getInstantaneousMetric(STATS_METRIC_COMMAND),
+            (float)getInstantaneousMetric(STATS_METRIC_NET_INPUT)/1024,
+            (float)getInstantaneousMetric(STATS_METRIC_NET_OUTPUT)/1024);
+        info = catLoopLatencyInfo(info,"eventloop_wakeup_latency",
+                                  server.el->wakeup_hist);
+        info = catLoopLatencyInfo(info,"eventloop_timer_lateness",
+                                  server.el->timer_hist);
+    }
+
+    /* Pipeline: how many commands clients send back to back. Every
+     * pipeline_depth_<n> field counts the batches of n to 2n-1 commands. */
+    if (allsections || defsections || !strcasecmp(section,"pipeline")) {
+        int j;
+
+        if (sections++) info = sdscat(info,"\r\n");
+        info = sdscatprintf(info,
+            "# Pipeline\r\n"
+            "max_commands_per_event:%d\r\n"
+            "pipeline_batches:%lld\r\n"
+            "pipeline_budget_hits:%lld\r\n"
+            "pipeline_pending_clients:%lu\r\n",
+            server.max_commands_per_event,
+            server.stat_pipeline_batches,
+            server.stat_pipeline_budget_hits,
+            listLength(server.clients_pending_input));
+        for (j = 0; j < STATS_PIPELINE_DEPTH_BUCKETS; j++) {
+            info = sdscatprintf(info,"pipeline_depth_%lld:%lld\r\n",
+                1LL<<j, server.stat_pipeline_depth[j]);
+        }
+    }
+
+    /* Cron */
+    if (allsections || defsections || !strcasecmp(section,"cron")) {
+        if (sections++) info = sdscat(info,"\r\n");
+        info = cronCatInfoString(info);
+    }
+
+    /* Admission control. overload_time_ms includes the current overload. */
+    if (allsections || defsections || !strcasecmp(section,"admission")) {
+        if (sections++) info = sdscat(info,"\r\n");
+        info = sdscatprintf(info,
+            "# Admission\r\n"
+            "overload_latency_usec:%lld\r\n"
+            "overload_queue:%lld\r\n"
+            "overloaded:%d\r\n"
+            "eventloop_busy_avg_usec:%lld\r\n"
+            "queued_commands:%lld\r\n"
+            "overload_events:%lld\r\n"
+            "overload_time_ms:%lld\r\n"
+            "rejected_low_priority:%lld\r\n"
+            "rejected_slow_commands:%lld\r\n",
+            server.overload_latency,
+            server.overload_queue,
+            server.overloaded,
+            server.el_busy_avg,
+            queuedCommands(),
+            server.stat_overload_events,
+            server.stat_overload_time +
+                (server.overloaded ? mstime()-server.overload_start : 0),
+            server.stat_overload_rejected_low,
+            server.stat_overload_rejected_slow);
+    }
+
+    /* Lanes: latency of the fast and slow commands, from the event loop
+     * wake up to their completion. Percentiles are the upper bound of the
+     * power of two bucket they fall in. */
+    if (allsections || defsections || !strcasecmp(section,"lanes")) {
+        char *lanename[LANES] = {"fast","slow"};
+        int lane;
+
+        if (sections++) info = sdscat(info,"\r\n");
+        info = sdscatprintf(info,
+            "# Lanes\r\n"
+            "slow_lane:%s\r\n"
+            "slow_lane_budget:%d\r\n"
+            "slow_lane_clients:%lu\r\n"
+            "slow_lane_deferred:%lld\r\n"
+            "slow_lane_budget_hits:%lld\r\n"
+            "resume_batch:%ld\r\n"
+            "resuming_clients:%lu\r\n"
+            "resume_waiting_writes:%lu\r\n"
+            "resumed_commands:%lld\r\n"
+            "resume_batches:%lld\r\n"
+            "resume_delayed_writes:%lld\r\n",
+            server.slow_lane ? "yes" : "no",
+            server.slow_lane_budget,
+            listLength(server.clients_slow_lane),
+            server.stat_slow_lane_deferred,
+            server.stat_slow_lane_budget_hits,
+            server.resume_batch,
+            listLength(server.clients_resuming),
+            listLength(server.clients_resume_waiting),
+            server.stat_resumed_commands,
+            server.stat_resume_batches,
+            server.stat_resume_delayed_writes);
+        for (lane = 0; lane < LANES; lane++) {
+            info = sdscatprintf(info,
+                "lane_%s:calls=%lld,p50_usec=%lld,p99_usec=%lld,p999_usec=%lld\r\n",
+                lanename[lane], server.stat_lane_calls[lane],
+                laneLatencyPercentile(lane,50.0),
+                laneLatencyPercentile(lane,99.0),
+                laneLatencyPercentile(lane,99.9));
+        }
+    }
+    return info;
+}
+
+void infoCommand(client *c) {
+    char *section = c->argc == 2 ? c->argv[1]->ptr : "default";
+
+    if (c->argc > 2) {
+        addReply(c,shared.syntaxerr);
+        return;
+    }
+    addReplyBulkSds(c, genRedisInfoString(section));
+}
+
 void redisAsciiArt(void) {
     #include "asciilogo.h"
         char *buf = zmalloc(1024*16);
@@ -2169,6 +2896,7 @@ int main(int argc, char **argv) {
     }
 
     aeSetBeforeSleepProc(server.el,beforeSleep);
+    aeSetAfterSleepProc(server.el,afterSleep);
     aeMain(server.el);
     aeDeleteEventLoop(server.el);
     return 0;
@@ -30,6 +30,9 @@ typedef long long mstime_t; /* millisecond time type. */
 #include "anet.h"    /* Networking the easy way */
 #include "ziplist.h" /* Compact list data structure */
 #include "intset.h"  /* Compact integer set structure */
+#include "freqsketch.h" /* Approximate access frequency of keys */
+#include "mrc.h"        /* Miss ratio curve estimation */
+#include "radix.h"   /* Radix tree, for the prefix index */
 #include "version.h" /* Version macro */
 #include "util.h"    /* Misc functions useful in many places */
 #include "latency.h" /* Latency monitor API */
@@ -51,13 +54,32 @@ typedef long long mstime_t; /* millisecond time type. */
 #define CONFIG_DEFAULT_HZ        10      /* Time interrupt calls/sec. */
 #define CONFIG_MIN_HZ            1
 #define CONFIG_MAX_HZ            500
+#define CONFIG_DEFAULT_DYNAMIC_HZ 1     /* Adapt hz to clients and keys. */
+#define CONFIG_DEFAULT_CRON_MAX_CPU_PERC 25 /* Of every cron period. */
 #define CONFIG_DEFAULT_SERVER_PORT        6379    /* TCP port */
 #define CONFIG_DEFAULT_TCP_BACKLOG       511     /* TCP listen backlog */
 #define CONFIG_DEFAULT_CLIENT_TIMEOUT       0       /* default client timeout: infinite */
 #define CONFIG_DEFAULT_DBNUM     16
 #define CONFIG_MAX_LINE    1024
 #define CRON_DBS_PER_CALL 16
+#define CRON_DICTS_PER_DB 256 /* Keyspace dicts checked for resize per call. */
+#define CLIENTS_CRON_MIN_ITERATIONS 5
 #define NET_MAX_WRITES_PER_EVENT (1024*64)
+#define CONFIG_DEFAULT_MAX_ACCEPTS_PER_CALL 1000 /* Accept budget ceiling. */
+#define CONFIG_MIN_ACCEPTS_PER_CALL 16     /* Accept budget floor and step. */
+#define CONFIG_DEFAULT_ACCEPT_LATENCY_TARGET 2000 /* Busy usec per iteration. */
+#define CONFIG_DEFAULT_MAX_COMMANDS_PER_EVENT 256 /* Per client, per iteration. */
+#define CONFIG_DEFAULT_BUSY_POLL_USEC 0   /* Event loop spin before sleeping. */
+#define CONFIG_DEFAULT_SO_BUSY_POLL 0     /* SO_BUSY_POLL usec on clients. */
+#define CONFIG_DEFAULT_LOOP_SLOW_THRESHOLD 10000 /* Busy usec per iteration. */
+#define CONFIG_DEFAULT_EXEC_THREADS 0     /* Threads for single key reads. */
+#define THREADEXEC_STRIPES 1024           /* Key locks, must be power of 2. */
+#define CONFIG_DEFAULT_SLOW_LANE 0        /* Run non fast commands last. */
+#define CONFIG_DEFAULT_SLOW_LANE_BUDGET 64 /* Slow commands per iteration. */
+#define CONFIG_DEFAULT_RESUME_BATCH 10000 /* Keys a resumable command visits
+                                             per iteration, 0 = no batches. */
+#define CONFIG_DEFAULT_OVERLOAD_LATENCY 0 /* Avg busy usec per iteration, 0 = off. */
+#define CONFIG_DEFAULT_OVERLOAD_QUEUE 0   /* Queued commands, 0 = off. */
 #define PROTO_SHARED_SELECT_CMDS 10
 #define OBJ_SHARED_INTEGERS 10000
 #define OBJ_SHARED_BULKHDR_LEN 32
@@ -100,6 +122,17 @@ typedef long long mstime_t; /* millisecond time type. */
 #define CONFIG_DEFAULT_REPL_DISABLE_TCP_NODELAY 0
 #define CONFIG_DEFAULT_MAXMEMORY 0
 #define CONFIG_DEFAULT_MAXMEMORY_SAMPLES 5
+#define CONFIG_DEFAULT_LFU_LOG_FACTOR 10
+#define CONFIG_DEFAULT_LFU_DECAY_TIME 1
+#define CONFIG_DEFAULT_MAXMEMORY_ADMISSION 0
+#define CONFIG_DEFAULT_ADMISSION_SKETCH_WIDTH (1<<20)
+#define CONFIG_DEFAULT_HOTKEYS_SAMPLE_RATE 16 /* Lookups per sample, 0 = off. */
+#define CONFIG_DEFAULT_HOTKEYS_CAPACITY 64   /* Keys tracked by KEYSTATS HOT. */
+#define CONFIG_DEFAULT_BIGKEYS_CAPACITY 16   /* Keys per type, 0 = off. */
+#define CONFIG_DEFAULT_MRC_SAMPLE_KEYS 16384 /* Miss ratio curve, 0 = off. */
+#define CONFIG_DEFAULT_LAZYFREE_LAZY_USER_DEL 1
+#define CONFIG_DEFAULT_KEYSPACE_SLOTS 0
+#define CONFIG_DEFAULT_PREFIX_INDEX 0
 #define CONFIG_DEFAULT_AOF_FILENAME "appendonly.aof"
 #define CONFIG_DEFAULT_AOF_NO_FSYNC_ON_REWRITE 0
 #define CONFIG_DEFAULT_AOF_LOAD_TRUNCATED 1
@@ -125,13 +158,26 @@ typedef long long mstime_t; /* millisecond time type. */
 #define STATS_METRIC_NET_INPUT 1    /* Bytes read to network .*/
 #define STATS_METRIC_NET_OUTPUT 2   /* Bytes written to network. */
 #define STATS_METRIC_COUNT 3
+#define STATS_PIPELINE_DEPTH_BUCKETS 12 /* 1, 2-3, 4-7, ... 2048+ commands. */
+#define STATS_LANE_LATENCY_BUCKETS 24 /* Power of two usec, up to ~8s. */
+
+/* Scheduling lanes: commands flagged CMD_FAST run as soon as they are read,
+ * the others are queued in the slow lane and run after them. */
+#define LANE_FAST 0
+#define LANE_SLOW 1
+#define LANES 2
 
 /* Protocol and I/O related defines */
 #define PROTO_MAX_QUERYBUF_LEN  (1024*1024*1024) /* 1GB max query buffer. */
 #define PROTO_IOBUF_LEN         (1024*16)  /* Generic I/O buffer size */
 #define PROTO_REPLY_CHUNK_BYTES (16*1024) /* 16k output buffer */
+#define PROTO_REPLY_MIN_BYTES   (1024) /* Initial size of the reply buffer. */
+#define PROTO_REPLY_IDLE_SECS   2   /* Idle time before the buffer is freed. */
+#define PROTO_DEFERRED_HDR_BYTES 32 /* Room reserved for a deferred length. */
 #define PROTO_INLINE_MAX_SIZE   (1024*64) /* Max size of inline reads */
 #define PROTO_MBULK_BIG_ARG     (1024*32)
+#define PROTO_ARGV_POOL_SIZE    8   /* Argument objects recycled per client. */
+#define PROTO_ARGV_POOL_MAX_ARG 256 /* Bigger RAW arguments aren't recycled. */
 #define LONG_STR_SIZE      21          /* Bytes needed for long -> str + '\0' */
 #define AOF_AUTOSYNC_BYTES (1024*1024*32) /* fdatasync every 32MB */
 
@@ -245,6 +291,19 @@ typedef long long mstime_t; /* millisecond time type. */
 #define CLIENT_REPLY_SKIP (1<<24)  /* Don't send just this reply. */
 #define CLIENT_LUA_DEBUG (1<<25)  /* Run EVAL in debug mode. */
 #define CLIENT_LUA_DEBUG_SYNC (1<<26)  /* EVAL debugging without fork() */
+#define CLIENT_PENDING_INPUT (1<<27) /* Client used its commands budget and has
+                                        more commands in server.clients_pending_input. */
+#define CLIENT_PENDING_COMMAND (1<<28) /* Command queued for threaded execution. */
+#define CLIENT_SLOW_LANE (1<<29) /* Command queued in server.clients_slow_lane. */
+#define CLIENT_RESUMING (1<<30) /* Command running in batches, or write waiting
+                                   for them to finish. See resume.c. */
+
+/* Client priority, as set by CLIENT PRIORITY. When the server is overloaded
+ * low priority clients are refused every command, normal ones the commands
+ * not flagged CMD_FAST, high priority ones are always served. */
+#define CLIENT_PRIORITY_LOW 0
+#define CLIENT_PRIORITY_NORMAL 1
+#define CLIENT_PRIORITY_HIGH 2
 
 /* Client block type (btype field in client structure)
  * if CLIENT_BLOCKED flag is set. */
@@ -355,13 +414,23 @@ typedef long long mstime_t; /* millisecond time type. */
 #define SET_OP_DIFF 1
 #define SET_OP_INTER 2
 
-/* Redis maxmemory strategies */
-#define MAXMEMORY_VOLATILE_LRU 0
-#define MAXMEMORY_VOLATILE_TTL 1
-#define MAXMEMORY_VOLATILE_RANDOM 2
-#define MAXMEMORY_ALLKEYS_LRU 3
-#define MAXMEMORY_ALLKEYS_RANDOM 4
-#define MAXMEMORY_NO_EVICTION 5
+/* Redis maxmemory strategies. Instead of using just incremental number
+ * for this defines, we use a set of flags so that testing for certain
+ * properties common to multiple policies is faster. */
+#define MAXMEMORY_FLAG_LRU (1<<0)
+#define MAXMEMORY_FLAG_LFU (1<<1)
+#define MAXMEMORY_FLAG_ALLKEYS (1<<2)
+#define MAXMEMORY_FLAG_NO_SHARED_INTEGERS \
+    (MAXMEMORY_FLAG_LRU|MAXMEMORY_FLAG_LFU)
+
+#define MAXMEMORY_VOLATILE_LRU ((0<<8)|MAXMEMORY_FLAG_LRU)
+#define MAXMEMORY_VOLATILE_LFU ((1<<8)|MAXMEMORY_FLAG_LFU)
+#define MAXMEMORY_VOLATILE_TTL (2<<8)
+#define MAXMEMORY_VOLATILE_RANDOM (3<<8)
+#define MAXMEMORY_ALLKEYS_LRU ((4<<8)|MAXMEMORY_FLAG_LRU|MAXMEMORY_FLAG_ALLKEYS)
+#define MAXMEMORY_ALLKEYS_LFU ((5<<8)|MAXMEMORY_FLAG_LFU|MAXMEMORY_FLAG_ALLKEYS)
+#define MAXMEMORY_ALLKEYS_RANDOM ((6<<8)|MAXMEMORY_FLAG_ALLKEYS)
+#define MAXMEMORY_NO_EVICTION (7<<8)
 #define CONFIG_DEFAULT_MAXMEMORY_POLICY MAXMEMORY_NO_EVICTION
 
 /* Scripting */
@@ -434,6 +503,7 @@ typedef long long mstime_t; /* millisecond time type. */
 #define LRU_CLOCK_MAX ((1<<LRU_BITS)-1) /* Max value of obj->lru */
 #define LRU_CLOCK_RESOLUTION 1000 /* LRU clock resolution in ms */
 
+#define OBJ_SHARED_REFCOUNT INT_MAX
 typedef struct redisObject {
     unsigned type:4;
     unsigned encoding:4;
@@ -468,7 +538,7 @@ typedef struct redisObject {
  * Empty entries have the key pointer set to NULL. */
 #define MAXMEMORY_EVICTION_POOL_SIZE 16
 struct evictionPoolEntry {
-    unsigned long long idle;    /* Object idle time. */
+    unsigned long long idle;    /* Object idle time (inverse frequency for LFU) */
     sds key;                    /* Key name. */
 };
 
@@ -476,8 +546,19 @@ struct evictionPoolEntry {
  * by integers from 0 (the default database) up to the max configured
  * database. The database number is the 'id' field in the structure. */
 typedef struct redisDb {
-    dict *dict;                 /* The keyspace for this DB */
-    dict *expires;              /* Timeout of keys with a timeout set */
+    dict **dict;                /* The keyspace for this DB: 'dict_count'
+                                   dicts, see dbKeyDict(). */
+    int dict_count;             /* 1, or CLUSTER_SLOTS with keyspace_slots. */
+    unsigned long long key_count; /* Keys in all the dicts. */
+    unsigned long long *slot_key_index; /* Fenwick tree of the keys per slot,
+                                           NULL with a single dict. */
+    list *rehashing;            /* Dicts that started a rehash. */
+    int resize_cursor;          /* Next dict checked for a resize. */
+    radixTree *prefix_index;    /* The keys, by prefix. NULL if disabled. */
+    int resume_locks;           /* Resumable commands visiting the DB. */
+    struct zskiplist *expires_index; /* Keys with a timeout set, ordered by
+                                        timeout. The timeouts are in the
+                                        keys of 'dict'. */
     dict *blocking_keys;        /* Keys with clients waiting for data (BLPOP) */
     dict *ready_keys;           /* Blocked keys that received a PUSH */
     dict *watched_keys;         /* WATCHED keys for MULTI/EXEC CAS */
@@ -534,6 +615,17 @@ typedef struct readyList {
     robj *key;
 } readyList;
 
+/* Replies that don't fit the client reply buffer are appended to a list of
+ * these blocks, PROTO_REPLY_CHUNK_BYTES each unless a single reply is
+ * bigger. Only the bytes between start and used are sent: the room before
+ * start is where a deferred multi bulk length gets written. */
+typedef struct clientReplyBlock {
+    size_t size;    /* Allocated size of buf. */
+    size_t used;    /* Bytes of buf filled so far. */
+    size_t start;   /* Offset of the first byte to send. */
+    char buf[];
+} clientReplyBlock;
+
 /* With multiplexing we need to take per-client state.
  * Clients are taken in a linked list. */
 typedef struct client {
@@ -543,15 +635,27 @@ typedef struct client {
     int dictid;             /* ID of the currently SELECTed DB. */
     robj *name;             /* As set by CLIENT SETNAME. */
     sds querybuf;           /* Buffer we use to accumulate client queries. */
+    size_t qb_pos;          /* The position we have read in querybuf. */
     size_t querybuf_peak;   /* Recent (100ms or more) peak of querybuf size. */
     int argc;               /* Num of arguments of current command. */
+    int argv_len;           /* Size of argv array (may be more than argc) */
     robj **argv;            /* Arguments of current command. */
+    robj *argv_pool[PROTO_ARGV_POOL_SIZE]; /* Argument objects of previous
+                                              commands, ready for reuse. */
+    int argv_pool_len;      /* Objects in argv_pool. */
+    long long lane_since;   /* server.el_wakeup_time when queued in the slow
+                               lane, the command latency counts from here. */
+    int priority;           /* CLIENT_PRIORITY_* for admission control. */
+    struct resumeState *resume; /* Resumable command in progress, or NULL. */
     struct redisCommand *cmd, *lastcmd;  /* Last command executed. */
     int reqtype;            /* Request protocol type: PROTO_REQ_* */
     int multibulklen;       /* Number of multi bulk arguments left to read. */
     long bulklen;           /* Length of bulk argument in multi bulk request. */
-    list *reply;            /* List of reply objects to send to the client. */
-    unsigned long long reply_bytes; /* Tot bytes of objects in reply list. */
+    list *reply;            /* List of clientReplyBlock to send to the client,
+                               created on first use. */
+    unsigned long long reply_bytes; /* Tot bytes of blocks in reply list. */
+    listNode *reply_deferred; /* First block of the reply list waiting for
+                                 its deferred length, not sent until set. */
     size_t sentlen;         /* Amount of bytes already sent in the current
                                buffer or object being sent. */
     time_t ctime;           /* Client creation time. */
@@ -579,16 +683,25 @@ typedef struct client {
     int btype;              /* Type of blocking op if CLIENT_BLOCKED. */
     blockingState bpop;     /* blocking state */
     long long woff;         /* Last write global replication offset. */
-    list *watched_keys;     /* Keys WATCHED for MULTI/EXEC CAS */
-    dict *pubsub_channels;  /* channels a client is interested in (SUBSCRIBE) */
-    list *pubsub_patterns;  /* patterns a client is interested in (SUBSCRIBE) */
+    list *watched_keys;     /* Keys WATCHED for MULTI/EXEC CAS, or NULL. */
+    dict *pubsub_channels;  /* channels a client is interested in (SUBSCRIBE),
+                               or NULL if it never subscribed. */
+    list *pubsub_patterns;  /* patterns a client is interested in (SUBSCRIBE),
+                               or NULL if it never subscribed. */
     sds peerid;             /* Cached peer ID. */
+    listNode *client_list_node; /* list node in server.clients list. */
 
-    /* Response buffer */
+    /* Response buffer. Allocated with the first reply, it grows up to
+     * PROTO_REPLY_CHUNK_BYTES and shrinks back when it is mostly unused. */
     int bufpos;
-    char buf[PROTO_REPLY_CHUNK_BYTES];
+    size_t buf_usable_size; /* Allocated size of buf. */
+    size_t buf_peak;        /* Peak bufpos since the buffer was last drained. */
+    char *buf;
 } client;
 
+/* Length of the client reply list, that is not allocated until needed. */
+#define clientReplyListLength(c) ((c)->reply ? listLength((c)->reply) : 0)
+
 struct saveparam {
     time_t seconds;
     int changes;
@@ -600,7 +713,7 @@ struct sharedObjectsStruct {
     *emptymultibulk, *wrongtypeerr, *nokeyerr, *syntaxerr, *sameobjecterr,
     *outofrangeerr, *noscripterr, *loadingerr, *slowscripterr, *bgsaveerr,
     *masterdownerr, *roslaveerr, *execaborterr, *noautherr, *noreplicaserr,
-    *busykeyerr, *oomerr, *plus, *messagebulk, *pmessagebulk, *subscribebulk,
+    *busykeyerr, *oomerr, *overloaderr, *plus, *messagebulk, *pmessagebulk, *subscribebulk,
     *unsubscribebulk, *psubscribebulk, *punsubscribebulk, *del, *rpop, *lpop,
     *lpush, *emptyscan, *minstring, *maxstring,
     *select[PROTO_SHARED_SELECT_CMDS],
@@ -647,6 +760,7 @@ void zsetConvert(robj *zobj, int encoding);
 void zsetConvertToZiplistIfNeeded(robj *zobj, size_t maxelelen);
 int zsetScore(robj *zobj, robj *member, double *score);
 unsigned long zslGetRank(zskiplist *zsl, double score, robj *o);
+zskiplistNode* zslGetElementByRank(zskiplist *zsl, unsigned long rank);
 
 typedef struct zset {
     dict *dict;
@@ -704,6 +818,10 @@ struct redisServer {
     char *executable;           /* Absolute executable file path. */
     char **exec_argv;           /* Executable argv vector (copy). */
     int hz;                     /* serverCron() calls frequency in hertz */
+    int config_hz;              /* Configured hz, server.hz may be higher. */
+    int dynamic_hz;             /* Adapt hz to the number of clients and keys. */
+    int cron_max_cpu_perc;      /* Percentage of the cron period the cron jobs
+                                   can use. */
     redisDb *db;
     dict *commands;             /* Command table */
     dict *orig_commands;        /* Command table before command renaming. */
@@ -711,6 +829,8 @@ struct redisServer {
     unsigned lruclock:LRU_BITS; /* Clock for LRU eviction */
     int shutdown_asap;          /* SHUTDOWN needed ASAP */
     int activerehashing;        /* Incremental rehash in serverCron() */
+    int keyspace_slots;         /* One keyspace dict per hash slot. */
+    int prefix_index;           /* Index the keys of every DB by prefix. */
     char *requirepass;          /* Pass for AUTH command, or NULL */
     char *pidfile;              /* PID file path */
     int arch_bits;              /* 32 or 64 depending on sizeof(long) */
@@ -732,6 +852,10 @@ struct redisServer {
     list *clients;              /* List of active clients */
     list *clients_to_close;     /* Clients to close asynchronously */
     list *clients_pending_write; /* There is to write or install handler. */
+    list *clients_pending_input; /* Query buffer left over by the budget. */
+    list *clients_slow_lane;    /* Clients with a non fast command to run. */
+    list *clients_resuming;     /* Clients running a command in batches. */
+    list *clients_resume_waiting; /* Writes waiting for a locked DB. */
     list *slaves, *monitors;    /* List of slaves and MONITORs */
     client *current_client;     /* Current client, only used on crash report */
     int clients_paused;         /* True if clients are currently paused */
@@ -740,6 +864,33 @@ struct redisServer {
     dict *migrate_cached_sockets;/* MIGRATE cached sockets */
     uint64_t next_client_id;    /* Next client unique ID. Incremental. */
     int protected_mode;         /* Don't accept external connections. */
+    int max_accepts_per_call;   /* Ceiling of the per iteration accept budget. */
+    long long accept_latency_target; /* Busy usec per loop iteration above
+                                        which the accept budget shrinks. */
+    int accept_budget;          /* Accepts allowed per loop iteration. */
+    int accepts_left;           /* Accepts left in the current iteration. */
+    long long el_wakeup_time;   /* ustime() when the poll last returned. */
+    long long el_sleep_time;    /* ustime() when we last entered the poll. */
+    long long el_busy_time;     /* Usec spent out of the poll last iteration. */
+    int max_commands_per_event; /* Commands a client can run per iteration. */
+    long long busy_poll_usec;   /* Usec the event loop spins before sleeping. */
+    int so_busy_poll;           /* SO_BUSY_POLL usec for client sockets. */
+    long long loop_slow_threshold; /* Busy usec above which an event loop
+                                      iteration is logged by LOOPPROFILE. */
+    int exec_threads;           /* Threads running single key reads, 0 = off. */
+    int slow_lane;              /* Defer non fast commands to the slow lane. */
+    int slow_lane_budget;       /* Slow lane commands run per iteration. */
+    client *slow_lane_client;   /* Client whose slow commands run inline. */
+    int slow_lane_left;         /* Slow lane budget left for it. */
+    long resume_batch;          /* Keys visited per batch of a resumable
+                                   command, 0 = run to completion. */
+    int resume_locks;           /* DB locks held by resumable commands. */
+    long long overload_latency; /* Average busy usec per iteration, and */
+    long long overload_queue;   /* queued commands, above which the server is
+                                   overloaded and sheds load. 0 = no limit. */
+    long long el_busy_avg;      /* Moving average of el_busy_time. */
+    int overloaded;             /* True while shedding load. */
+    mstime_t overload_start;    /* When the server became overloaded. */
     /* RDB / AOF loading information */
     int loading;                /* We are loading data from disk if true */
     off_t loading_total_bytes;
@@ -756,12 +907,37 @@ struct redisServer {
     long long stat_numconnections;  /* Number of connections received */
     long long stat_expiredkeys;     /* Number of expired keys */
     long long stat_evictedkeys;     /* Number of evicted keys (maxmemory) */
+    long long stat_admission_admitted; /* New keys admitted and */
+    long long stat_admission_rejected; /* rejected by the admission filter. */
     long long stat_keyspace_hits;   /* Number of successful lookups of keys */
     long long stat_keyspace_misses; /* Number of failed lookups of keys */
     size_t stat_peak_memory;        /* Max used memory record */
     long long stat_fork_time;       /* Time needed to perform latest fork() */
     double stat_fork_rate;          /* Fork rate in GB/sec. */
     long long stat_rejected_conn;   /* Clients rejected because of maxclients */
+    long long stat_accept_budget_hits; /* Iterations that used all the accept
+                                          budget, leaving the rest queued. */
+    long long stat_pipeline_batches; /* Batches of commands run per client. */
+    long long stat_pipeline_budget_hits; /* Batches cut by the commands budget. */
+    long long stat_pipeline_depth[STATS_PIPELINE_DEPTH_BUCKETS]; /* Batches by
+                                       number of commands: power of two buckets. */
+    long long stat_threaded_commands; /* Commands executed in batches. */
+    long long stat_threaded_batches;  /* Batches executed by the threads. */
+    long long stat_lane_calls[LANES]; /* Commands executed by every lane. */
+    long long stat_lane_latency[LANES][STATS_LANE_LATENCY_BUCKETS]; /* Usec
+                                       from wake up to command completion. */
+    long long stat_slow_lane_deferred; /* Commands queued in the slow lane. */
+    long long stat_slow_lane_budget_hits; /* Iterations leaving slow commands
+                                             queued for the next one. */
+    long long stat_resumed_commands; /* Commands executed in batches, */
+    long long stat_resume_batches;   /* their batches after the first, */
+    long long stat_resume_delayed_writes; /* and the writes they delayed. */
+    long long stat_overload_events; /* Times the server became overloaded. */
+    long long stat_overload_time;   /* Milliseconds spent overloaded. */
+    long long stat_overload_rejected_low; /* Commands refused to low priority
+                                             clients while overloaded. */
+    long long stat_overload_rejected_slow; /* Non fast commands refused while
+                                              overloaded. */
     long long stat_sync_full;       /* Number of full resyncs with slaves. */
     long long stat_sync_partial_ok; /* Number of accepted PSYNC requests. */
     long long stat_sync_partial_err;/* Number of unaccepted PSYNC requests. */
@@ -908,6 +1084,18 @@ struct redisServer {
     unsigned long long maxmemory;   /* Max number of memory bytes to use */
     int maxmemory_policy;           /* Policy for key eviction */
     int maxmemory_samples;          /* Pricision of random sampling */
+    int lfu_log_factor;             /* LFU logarithmic counter factor. */
+    int lfu_decay_time;             /* LFU counter decay factor. */
+    int maxmemory_admission;        /* Use the TinyLFU admission filter. */
+    unsigned long admission_sketch_width; /* Counters per sketch row. */
+    freqSketch *admission_sketch;   /* Access frequency, NULL if disabled. */
+    long hotkeys_sample_rate;       /* Lookups per hot keys sample, 0 = off. */
+    int hotkeys_capacity;           /* Hot keys tracked. */
+    int bigkeys_capacity;           /* Big keys tracked per type, 0 = off. */
+    long mrc_sample_keys;           /* Keys sampled by the MRC, 0 = off. */
+    missRatioCurve *mrc;            /* Miss ratio curve, NULL if disabled. */
+    /* Lazy free */
+    int lazyfree_lazy_user_del;     /* DEL behaves like UNLINK. */
     /* Blocked clients */
     unsigned int bpop_blocked_clients; /* Number of clients blocked by lists */
     list *unblocked_clients; /* list of clients to unblock before next loop */
@@ -1076,6 +1264,57 @@ extern dictType replScriptCacheDictType;
  * Functions prototypes
  *----------------------------------------------------------------------------*/
 
+/* threadexec.c -- Parallel execution of single key reads */
+extern __thread int threadexec_parallel;
+/* Stats that commands running in parallel update. */
+#define atomicStatIncr(var) __atomic_add_fetch(&(var),1,__ATOMIC_RELAXED)
+void threadexecInit(void);
+int threadexecQueueCommand(client *c);
+void threadexecUnqueueClient(client *c);
+int threadexecRunPending(void);
+int threadexecPendingCommands(void);
+
+/* resume.c -- Commands executed in batches across event loop iterations */
+typedef int resumeProc(client *c, void *state);
+typedef void resumeFreeProc(void *state);
+int resumeCanYield(client *c);
+void resumeCommand(client *c, resumeProc *proc, resumeFreeProc *freeproc,
+                   void *state);
+int resumeQueueWrite(client *c);
+void resumeUnqueueClient(client *c);
+int handleResumableCommands(void);
+
+/* evict.c -- maxmemory handling and LRU/LFU eviction */
+#define LFU_INIT_VAL 5
+struct evictionPoolEntry *evictionPoolAlloc(void);
+unsigned long LFUGetTimeInMinutes(void);
+uint8_t LFULogIncr(uint8_t value);
+unsigned long LFUDecrAndReturn(robj *o);
+void updateLFU(robj *val);
+unsigned int objectInitialLRU(void);
+int freeMemoryIfNeeded(void);
+void admissionInit(void);
+void admissionRecordAccess(robj *key);
+int admissionRejectKey(redisDb *db, robj *key);
+void mrcInit(void);
+void mrcRecordAccess(robj *key);
+
+/* keystats.c -- Hot keys and big keys */
+void keystatsInit(void);
+void keystatsRecordAccess(redisDb *db, robj *key);
+void keystatsTrackSize(redisDb *db, robj *key, robj *val, int oldtype);
+void keystatsUntrackKey(redisDb *db, robj *key, int type);
+void keystatsEmptyDb(int dbid);
+
+/* lazyfree.c -- freeing of big values and databases in a bio thread */
+#define LAZYFREE_THRESHOLD 64 /* Free synchronously up to this effort. */
+int dbAsyncDelete(redisDb *db, robj *key);
+void emptyDbAsync(redisDb *db);
+size_t lazyfreeGetPendingObjectsCount(void);
+void lazyfreeFreeObjectFromBioThread(robj *o);
+void lazyfreeFreeDatabaseFromBioThread(dict **dicts, zskiplist *zsl);
+void lazyfreeFreePrefixIndexFromBioThread(radixTree *rt);
+
 /* Utils */
 long long ustime(void);
 long long mstime(void);
@@ -1097,10 +1336,19 @@ void sendReplyToClient(aeEventLoop *el, int fd, void *privdata, int mask);
 void *addDeferredMultiBulkLength(client *c);
 void setDeferredMultiBulkLength(client *c, void *node, long length);
 void processInputBuffer(client *c);
+int handleClientsWithPendingInput(void);
+int clientsCronResizeQueryBuffer(client *c);
+int clientsCronResizeReplyBuffer(client *c);
+size_t getClientsIdleMemory(unsigned long *idle_clients);
+int clientQueueSlowLane(client *c);
+int handleClientsInSlowLane(void);
+void statLaneLatency(client *c, int lane, long long since);
 void acceptHandler(aeEventLoop *el, int fd, void *privdata, int mask);
 void acceptTcpHandler(aeEventLoop *el, int fd, void *privdata, int mask);
 void acceptUnixHandler(aeEventLoop *el, int fd, void *privdata, int mask);
+void updateAcceptBudget(void);
 void readQueryFromClient(aeEventLoop *el, int fd, void *privdata, int mask);
+void clientInstallWriteHandler(client *c);
 void addReplyBulk(client *c, robj *obj);
 void addReplyBulkCString(client *c, const char *s);
 void addReplyBulkCBuffer(client *c, const void *p, size_t len);
@@ -1129,6 +1377,8 @@ void freeClientsInAsyncFreeQueue(void);
 void asyncCloseClientOnOutputBufferLimitReached(client *c);
 int getClientType(client *c);
 int getClientTypeByName(char *name);
+int getClientPriorityByName(char *name);
+char *getClientPriorityName(int priority);
 char *getClientTypeName(int class);
 void flushSlavesOutputBuffers(void);
 void disconnectSlaves(void);
@@ -1191,6 +1441,7 @@ void freeSetObject(robj *o);
 void freeZsetObject(robj *o);
 void freeHashObject(robj *o);
 robj *createObject(int type, void *ptr);
+robj *makeObjectShared(robj *o);
 robj *createStringObject(const char *ptr, size_t len);
 robj *createRawStringObject(const char *ptr, size_t len);
 robj *createEmbeddedStringObject(const char *ptr, size_t len);
@@ -1280,7 +1531,6 @@ typedef struct {
 } zlexrangespec;
 
 /* Core functions */
-int freeMemoryIfNeeded(void);
 int processCommand(client *c);
 void setupSignalHandlers(void);
 struct redisCommand *lookupCommand(sds name);
@@ -1310,6 +1560,11 @@ void resetCommandTableStats(void);
 void adjustOpenFilesLimit(void);
 void closeListeningSockets(int unlink_unix_socket);
 void updateCachedTime(void);
+void trackInstantaneousMetric(int metric, long long current_reading);
+long long getInstantaneousMetric(int metric);
+void clientsCron(long long budget);
+void databasesCron(long long budget);
+void statsCron(long long budget);
 void resetServerStats(void);
 unsigned int getLRUClock(void);
 const char *evictPolicyToString(void);
@@ -1369,6 +1624,7 @@ sds keyspaceEventsFlagsToString(int flags);
 void loadServerConfig(char *filename, char *options);
 void appendServerSaveParams(time_t seconds, int changes);
 void resetServerSaveParams(void);
+const char *evictPolicyToString(void);
 struct rewriteConfigState; /* Forward declaration to export API. */
 void rewriteConfigRewriteLine(struct rewriteConfigState *state, const char *option, sds line, int force);
 int rewriteConfig(char *path);
@@ -1378,6 +1634,7 @@ int removeExpire(redisDb *db, robj *key);
 void propagateExpire(redisDb *db, robj *key);
 int expireIfNeeded(redisDb *db, robj *key);
 long long getExpire(redisDb *db, robj *key);
+long long getEntryExpire(dictEntry *de);
 void setExpire(redisDb *db, robj *key, long long when);
 robj *lookupKey(redisDb *db, robj *key, int flags);
 robj *lookupKeyRead(redisDb *db, robj *key);
@@ -1394,11 +1651,20 @@ int dbExists(redisDb *db, robj *key);
 robj *dbRandomKey(redisDb *db);
 int dbDelete(redisDb *db, robj *key);
 robj *dbUnshareStringValue(redisDb *db, robj *key, robj *o);
-long long emptyDb(void(callback)(void*));
+#define EMPTYDB_NO_FLAGS 0      /* No flags. */
+#define EMPTYDB_ASYNC (1<<0)    /* Reclaim memory in another thread. */
+long long emptyDb(int dbnum, int flags, void(callback)(void*));
+int getFlushCommandFlags(client *c, int *flags);
 int selectDb(client *c, int id);
 void signalModifiedKey(redisDb *db, robj *key);
 void signalFlushedDb(int dbid);
 unsigned int getKeysInSlot(unsigned int hashslot, robj **keys, unsigned int count);
+void dbInitKeyspace(redisDb *db);
+dict *dbKeyDict(redisDb *db, sds key);
+dictEntry *dbFind(redisDb *db, sds key);
+int dbDictDelete(redisDb *db, sds key);
+dictEntry *dbGetRandomEntry(redisDb *db);
+unsigned int dbGetSomeEntries(redisDb *db, dictEntry **des, unsigned int count);
 unsigned int countKeysInSlot(unsigned int hashslot);
 unsigned int delKeysInSlot(unsigned int hashslot);
 int verifyClusterConfigWithData(void);
@@ -1464,6 +1730,7 @@ void setexCommand(client *c);
 void psetexCommand(client *c);
 void getCommand(client *c);
 void delCommand(client *c);
+void unlinkCommand(client *c);
 void existsCommand(client *c);
 void setbitCommand(client *c);
 void getbitCommand(client *c);
@@ -1599,6 +1866,8 @@ void readonlyCommand(client *c);
 void readwriteCommand(client *c);
 void dumpCommand(client *c);
 void objectCommand(client *c);
+void keystatsCommand(client *c);
+void mrcCommand(client *c);
 void clientCommand(client *c);
 void evalCommand(client *c);
 void evalShaCommand(client *c);
@@ -1644,6 +1913,7 @@ void bugReportStart(void);
 void serverLogObjectDebugInfo(robj *o);
 void sigsegvHandler(int sig, siginfo_t *info, void *secret);
 sds genRedisInfoString(char *section);
+void bytesToHuman(char *s, unsigned long long n);
 void enableWatchdog(int period);
 void disableWatchdog(void);
 void watchdogScheduleSignal(int period);
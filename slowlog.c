@@ -44,9 +44,13 @@ slowlogEntry *slowlogCreateEntry(robj **argv, int argc, long long duration) {
                     (unsigned long)
                     sdslen(argv[j]->ptr) - SLOWLOG_ENTRY_MAX_STRING);
                 se->argv[j] = createObject(OBJ_STRING,s);
-            } else {
+            } else if (argv[j]->refcount == OBJ_SHARED_REFCOUNT) {
                 se->argv[j] = argv[j];
-                incrRefCount(argv[j]);
+            } else {
+                /* Duplicate the argument: the object may also be the value
+                 * of a key, and a value freed by the lazyfree thread must
+                 * not be shared with the main thread. */
+                se->argv[j] = dupStringObject(argv[j]);
             }
         }
     }
@@ -98,7 +98,6 @@ void setCommand(client *c) {
 }
 
 int getGenericCommand(client *c) {
-    serverLog(LL_WARNING, "getGenericCommand:get command");
     robj *o;
     if ((o = lookupKeyReadOrReply(c,c->argv[1],shared.nullbulk)) == NULL)
         return C_OK;
@@ -0,0 +1,295 @@
+/* Parallel execution of independent single key commands.
+ *
+ * When exec-threads is greater than zero, read only fast commands (the
+ * ones flagged "r" and "F" in the command table) that access a single key
+ * are not executed by processCommand() right away. The client is flagged
+ * CLIENT_PENDING_COMMAND and queued, and before re-entering the event loop
+ * all the queued commands run as a batch: the worker threads and the main
+ * thread pick commands from the batch until it is empty, then the main
+ * thread waits for the workers to finish (fork-join).
+ *
+ * Everything else, multi key and write commands, MULTI/EXEC, admin
+ * commands, runs in the main thread outside the batch, so it is always
+ * executed exclusively. Inside a batch only read only commands run, so the
+ * keyspace dictionaries are never modified:
+ *
+ * - Incremental rehashing of the dictionaries is paused for the batch.
+ * - expireIfNeeded() only reports expired keys as missing, like slaves do,
+ *   the main thread deletes them later.
+ * - The side effects on the accessed key (the LRU field of the value, the
+ *   reference count of the value while building the reply) are serialized
+ *   by striped locks: the key hash selects one of THREADEXEC_STRIPES
+ *   mutexes, held while the command runs.
+ * - Replies go to the client output buffers, that are private to the
+ *   client, but scheduling the client for writing and checking the output
+ *   buffer limits touch global state, so they are deferred to the main
+ *   thread (see threadexec_parallel).
+ *
+ * The per command statistics, the slow log, the event loop profiler and
+ * the execution of the commands that follow in the client pipeline are
+ * handled by the main thread once the batch is complete. */
+
+#include "server.h"
+#include "slowlog.h"
+#include "looprofile.h"
+#include <pthread.h>
+
+/* True in the threads (main thread included) while they execute commands
+ * of a batch. */
+__thread int threadexec_parallel = 0;
+
+typedef struct threadexecJob {
+    client *c;              /* NULL if the client was freed meanwhile. */
+    int keyidx;             /* Position of the key in c->argv. */
+    long long duration;     /* Execution time in microseconds. */
+} threadexecJob;
+
+/* Commands queued for the next batch. */
+static threadexecJob *pending;
+static int pending_len, pending_size;
+
+/* Batch in execution (or just executed, waiting to be finished). */
+static threadexecJob *batch;
+static int batch_len, batch_size;
+static int batch_next;          /* Next job to pick. */
+static int batch_done;          /* Jobs completed. */
+static long long batch_gen;     /* Incremented for every batch. */
+static int batch_workers;       /* Workers inside threadexecWork(). */
+
+static pthread_t *workers;
+static pthread_mutex_t batch_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t batch_cond = PTHREAD_COND_INITIALIZER;
+static pthread_mutex_t stripes[THREADEXEC_STRIPES];
+
+/* Spin wait hint. */
+static inline void threadexecRelax(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__)
+    __asm__ __volatile__("yield");
+#endif
+}
+
+/* Execute the command of a job with the key stripe locked. */
+static void threadexecRunJob(threadexecJob *job) {
+    client *c = job->c;
+    robj *key = c->argv[job->keyidx];
+    unsigned int h = dictGenHashFunction(key->ptr,sdslen(key->ptr));
+    pthread_mutex_t *stripe = &stripes[h & (THREADEXEC_STRIPES-1)];
+    long long start;
+
+    pthread_mutex_lock(stripe);
+    start = ustime();
+    c->cmd->proc(c);
+    job->duration = ustime()-start;
+    pthread_mutex_unlock(stripe);
+}
+
+/* Pick and execute jobs of the current batch until there are no more. */
+static void threadexecWork(void) {
+    int j;
+
+    threadexec_parallel = 1;
+    while ((j = __atomic_fetch_add(&batch_next,1,__ATOMIC_SEQ_CST)) <
+           __atomic_load_n(&batch_len,__ATOMIC_SEQ_CST))
+    {
+        if (batch[j].c) threadexecRunJob(&batch[j]);
+        __atomic_add_fetch(&batch_done,1,__ATOMIC_SEQ_CST);
+    }
+    threadexec_parallel = 0;
+}
+
+static void *threadexecWorkerMain(void *arg) {
+    long long seen = 0;
+    UNUSED(arg);
+
+    while (1) {
+        pthread_mutex_lock(&batch_mutex);
+        while (batch_gen == seen)
+            pthread_cond_wait(&batch_cond,&batch_mutex);
+        seen = batch_gen;
+        /* Entered under the mutex: the main thread publishes a batch with
+         * the mutex held, once no worker is left in the previous one. */
+        __atomic_add_fetch(&batch_workers,1,__ATOMIC_SEQ_CST);
+        pthread_mutex_unlock(&batch_mutex);
+        threadexecWork();
+        __atomic_sub_fetch(&batch_workers,1,__ATOMIC_SEQ_CST);
+    }
+    return NULL;
+}
+
+/* Initialize the stripes and start server.exec_threads worker threads. */
+void threadexecInit(void) {
+    int j;
+
+    if (server.exec_threads <= 0) return;
+    for (j = 0; j < THREADEXEC_STRIPES; j++)
+        pthread_mutex_init(&stripes[j],NULL);
+
+    workers = zmalloc(sizeof(pthread_t)*server.exec_threads);
+    for (j = 0; j < server.exec_threads; j++) {
+        if (pthread_create(&workers[j],NULL,threadexecWorkerMain,NULL) != 0) {
+            serverLog(LL_WARNING,"Fatal: Can't initialize execution threads.");
+            exit(1);
+        }
+    }
+    serverLog(LL_NOTICE,"Executing single key read commands in %d threads.",
+        server.exec_threads);
+}
+
+/* Called by processCommand() when the command is ready to be executed.
+ * If the command can run in parallel the client is queued for the next
+ * batch, flagged CLIENT_PENDING_COMMAND, and C_OK is returned. Otherwise
+ * C_ERR is returned and the caller executes the command as usually. */
+int threadexecQueueCommand(client *c) {
+    struct redisCommand *cmd = c->cmd;
+    int numkeys, *keys, keyidx;
+
+    if (server.exec_threads <= 0) return C_ERR;
+    if ((cmd->flags & (CMD_FAST|CMD_READONLY)) != (CMD_FAST|CMD_READONLY) ||
+        cmd->flags & (CMD_WRITE|CMD_ADMIN))
+        return C_ERR;
+    if (c->flags & (CLIENT_MULTI|CLIENT_MASTER|CLIENT_SLAVE|CLIENT_MONITOR|
+                    CLIENT_LUA) || c->fd <= 0)
+        return C_ERR;
+
+    keys = getKeysFromCommand(cmd,c->argv,c->argc,&numkeys);
+    keyidx = numkeys == 1 ? keys[0] : -1;
+    getKeysFreeResult(keys);
+    if (keyidx == -1 || !sdsEncodedObject(c->argv[keyidx])) return C_ERR;
+
+    if (pending_len == pending_size) {
+        pending_size = pending_size ? pending_size*2 : 64;
+        pending = zrealloc(pending,sizeof(threadexecJob)*pending_size);
+    }
+    pending[pending_len].c = c;
+    pending[pending_len].keyidx = keyidx;
+    pending[pending_len].duration = 0;
+    pending_len++;
+    c->flags |= CLIENT_PENDING_COMMAND;
+    return C_OK;
+}
+
+/* Called by freeClient() for clients with a queued command. */
+void threadexecUnqueueClient(client *c) {
+    int j;
+
+    for (j = 0; j < pending_len; j++)
+        if (pending[j].c == c) pending[j].c = NULL;
+    for (j = 0; j < batch_len; j++)
+        if (batch[j].c == c) batch[j].c = NULL;
+    c->flags &= ~CLIENT_PENDING_COMMAND;
+}
+
+/* Do in the main thread what call() does after executing a command, then
+ * go on with the commands the client already sent. */
+static void threadexecFinishJob(threadexecJob *job) {
+    client *c = job->c;
+
+    c->flags &= ~CLIENT_PENDING_COMMAND;
+    c->lastcmd->microseconds += job->duration;
+    c->lastcmd->calls++;
+    server.stat_numcommands++;
+    server.stat_threaded_commands++;
+    slowlogPushEntryIfNeeded(c->argv,c->argc,job->duration);
+    loopProfileCommand(c->cmd,job->duration);
+    c->woff = server.master_repl_offset;
+    statLaneLatency(c,LANE_FAST,server.el_wakeup_time);
+    /* The lookups of the threads are not recorded. */
+    if (server.admission_sketch) admissionRecordAccess(c->argv[job->keyidx]);
+    if (server.hotkeys_sample_rate)
+        keystatsRecordAccess(c->db,c->argv[job->keyidx]);
+    if (server.mrc) mrcRecordAccess(c->argv[job->keyidx]);
+
+    /* Deferred by the parallel section, see prepareClientToWrite(). */
+    if (clientHasPendingReplies(c)) clientInstallWriteHandler(c);
+    asyncCloseClientOnOutputBufferLimitReached(c);
+
+    resetClient(c);
+    if (!(c->flags & CLIENT_PENDING_INPUT)) processInputBuffer(c);
+}
+
+/* Only the dicts in db->rehashing may be rehashing. Those that completed
+ * the rehash are dropped when pausing, so that resuming walks the same
+ * dicts: the lists can't change during the batch. */
+static void threadexecPauseRehashing(int pause) {
+    int j;
+
+    for (j = 0; j < server.dbnum; j++) {
+        list *l = server.db[j].rehashing;
+        listIter li;
+        listNode *ln;
+
+        listRewind(l,&li);
+        while ((ln = listNext(&li)) != NULL) {
+            dict *d = listNodeValue(ln);
+
+            if (pause) {
+                if (!dictIsRehashing(d)) {
+                    listDelNode(l,ln);
+                    continue;
+                }
+                dictPauseRehashing(d);
+            } else {
+                dictResumeRehashing(d);
+            }
+        }
+    }
+}
+
+/* Execute the queued commands. Finishing a batch may queue the next
+ * command of the same clients, so this is repeated, up to
+ * server.max_commands_per_event times like the commands budget of
+ * processInputBuffer(). Returns the number of commands executed. */
+int threadexecRunPending(void) {
+    int rounds = 0, processed = 0, j;
+
+    while (pending_len && rounds++ < server.max_commands_per_event) {
+        threadexecJob *tmp = batch;
+        int tmpsize = batch_size;
+
+        /* Workers late for the previous batch may still be in
+         * threadexecWork(), picking from batch_next after it's reset: the
+         * batch is published only once they left, with the mutex held so
+         * that no worker enters meanwhile. */
+        pthread_mutex_lock(&batch_mutex);
+        while (__atomic_load_n(&batch_workers,__ATOMIC_SEQ_CST))
+            threadexecRelax();
+        __atomic_store_n(&batch_done,0,__ATOMIC_SEQ_CST);
+        __atomic_store_n(&batch_next,0,__ATOMIC_SEQ_CST);
+
+        /* The pending queue becomes the batch. */
+        batch = pending;
+        batch_size = pending_size;
+        pending = tmp;
+        pending_size = tmpsize;
+        threadexecPauseRehashing(1);
+        __atomic_store_n(&batch_len,pending_len,__ATOMIC_SEQ_CST);
+        pending_len = 0;
+
+        /* A single command is not worth waking up the workers. */
+        if (batch_len > 1) {
+            batch_gen++;
+            pthread_cond_broadcast(&batch_cond);
+        }
+        pthread_mutex_unlock(&batch_mutex);
+        threadexecWork();
+        while (__atomic_load_n(&batch_done,__ATOMIC_SEQ_CST) < batch_len)
+            threadexecRelax();
+        threadexecPauseRehashing(0);
+        server.stat_threaded_batches++;
+
+        for (j = 0; j < batch_len; j++) {
+            if (batch[j].c == NULL) continue;
+            threadexecFinishJob(&batch[j]);
+            processed++;
+        }
+        __atomic_store_n(&batch_len,0,__ATOMIC_SEQ_CST);
+    }
+    return processed;
+}
+
+/* Return the number of commands queued for the next batch. */
+int threadexecPendingCommands(void) {
+    return pending_len;
+}